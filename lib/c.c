@@ -109,6 +109,126 @@ char *memcpy(char *dest, char *src, int count)
     return dest;
 }
 
+/* Byte loops filling, copying or scanning memory are compiled into calls to
+ * these helpers. They move a word at a time once the addresses are aligned,
+ * which only happens when both ends of a copy are equally misaligned, so
+ * overlapping copies give the same bytes as the loops would.
+ */
+void __fill_bytes(char *dest, int c, int count)
+{
+    int *w;
+    int word;
+
+    while (count > 0 && (dest & 3)) {
+        dest[0] = c;
+        dest++;
+        count--;
+    }
+    word = (c & 255) * 0x01010101;
+    w = dest;
+    while (count >= 4) {
+        w[0] = word;
+        w++;
+        count -= 4;
+    }
+    dest = w;
+    while (count > 0) {
+        dest[0] = c;
+        dest++;
+        count--;
+    }
+}
+
+void __copy_bytes_up(char *dest, char *src, int count)
+{
+    int *d, *s;
+
+    if (!((dest ^ src) & 3)) {
+        while (count > 0 && (dest & 3)) {
+            dest[0] = src[0];
+            dest++;
+            src++;
+            count--;
+        }
+        d = dest;
+        s = src;
+        while (count >= 4) {
+            d[0] = s[0];
+            d++;
+            s++;
+            count -= 4;
+        }
+        dest = d;
+        src = s;
+    }
+    while (count > 0) {
+        dest[0] = src[0];
+        dest++;
+        src++;
+        count--;
+    }
+}
+
+void __copy_bytes_down(char *dest, char *src, int count)
+{
+    int *d, *s;
+
+    if (count <= 0)
+        return;
+    dest += count;
+    src += count;
+    if (!((dest ^ src) & 3)) {
+        while (count > 0 && (dest & 3)) {
+            dest--;
+            src--;
+            dest[0] = src[0];
+            count--;
+        }
+        d = dest;
+        s = src;
+        while (count >= 4) {
+            d--;
+            s--;
+            d[0] = s[0];
+            count -= 4;
+        }
+        dest = d;
+        src = s;
+    }
+    while (count > 0) {
+        dest--;
+        src--;
+        dest[0] = src[0];
+        count--;
+    }
+}
+
+/* the length of @src, reading aligned words past its end at most */
+int __scan_bytes(char *src)
+{
+    char *p;
+    int *w;
+    int word;
+
+    p = src;
+    while (p & 3) {
+        if (!p[0])
+            return p - src;
+        p++;
+    }
+    w = p;
+    word = w[0];
+    /* only a zero byte borrows from its high bit */
+    while (!((word - 0x01010101) & ~word & 0x80808080)) {
+        w++;
+        word = w[0];
+    }
+    p = w;
+    while (p[0])
+        p++;
+    return p - src;
+}
+
 /* set 10 digits (32bit) without div */
 void __str_base10(char *pb, int val)
 {
@@ -514,6 +634,21 @@ char *fgets(char *str, int n, FILE *stream)
     return str;
 }
 
+/* Read up to @n items of @size bytes, and returns the number of complete items
+ * read before the end of file. */
+int fread(char *ptr, int size, int n, FILE *stream)
+{
+    int total = size * n, done = 0;
+
+    while (done < total) {
+        int r = __syscall(__syscall_read, stream, ptr + done, total - done);
+        if (r < 1)
+            break;
+        done += r;
+    }
+    return done / size;
+}
+
 int fputc(int c, FILE *stream)
 {
     char buf[1];
@@ -584,13 +719,15 @@ void *malloc(int size)
         chunk_t *fh = freelist_head;
         /* record the size of the chunk */
         int bsize = 0;
+        /* the size of a chunk includes its header */
+        int need = sizeof(chunk_t) + size;
 
         while (fh->next) {
-            if (fh->size >= size && !best_fit_chunk) {
+            if (fh->size >= need && !best_fit_chunk) {
                 /* first time setting fh as best_fit_chunk */
                 best_fit_chunk = fh;
                 bsize = fh->size;
-            } else if ((fh->size >= size) && best_fit_chunk &&
+            } else if ((fh->size >= need) && best_fit_chunk &&
                        (fh->size < bsize)) {
                 /* If there is a smaller chunk available, replace it. */
                 best_fit_chunk = fh;
@@ -629,8 +766,8 @@ void *malloc(int size)
     tail = allocated;
     tail->next = NULL;
     tail->size = allocated->size;
-    int offset = sizeof(chunk_t) - 4;
-    tail->ptr = tail + offset;
+    /* the data follows the header */
+    tail->ptr = tail + 1;
     return tail->ptr;
 }
 
@@ -83,7 +83,6 @@ void update_elf_offset(ph2_ir_t *ph2_ir)
     case OP_bit_or:
     case OP_bit_xor:
     case OP_negate:
-    case OP_log_and:
     case OP_bit_not:
         elf_offset += 4;
         return;
@@ -102,6 +101,9 @@ void update_elf_offset(ph2_ir_t *ph2_ir)
     case OP_log_or:
         elf_offset += 12;
         return;
+    case OP_log_and:
+        elf_offset += 16;
+        return;
     case OP_branch:
         if (ph2_ir->is_branch_detached)
             elf_offset += 12;
@@ -111,6 +113,9 @@ void update_elf_offset(ph2_ir_t *ph2_ir)
     case OP_return:
         elf_offset += 24;
         return;
+    case OP_tail_call:
+        elf_offset += 20;
+        return;
     default:
         printf("Unknown opcode\n");
         abort();
@@ -140,6 +145,7 @@ void cfg_flatten()
         /* reserve stack */
         flatten_ir = add_ph2_ir(OP_define);
         flatten_ir->src0 = fn->func->stack_size;
+        flatten_ir->func_name = fn->func->return_def.var_name;
 
         basic_block_t *bb;
         for (bb = fn->bbs; bb; bb = bb->rpo_next) {
@@ -154,7 +160,7 @@ void cfg_flatten()
                 flatten_ir = add_ph2_ir(OP_generic);
                 memcpy(flatten_ir, insn, sizeof(ph2_ir_t));
 
-                if (insn->op == OP_return)
+                if (insn->op == OP_return || insn->op == OP_tail_call)
                     /* restore sp */
                     flatten_ir->src1 = bb->belong_to->func->stack_size;
 
@@ -168,6 +174,9 @@ void cfg_flatten()
             }
         }
     }
+
+    /* functions taken from the prebuilt libc image */
+    libc_image_layout();
 }
 
 void emit(int code)
@@ -304,6 +313,14 @@ void emit_ph2_ir(ph2_ir_t *ph2_ir)
     case OP_indirect:
         emit(__blx(__AL, __r8));
         return;
+    case OP_tail_call:
+        func = find_func(ph2_ir->func_name);
+        emit(__movw(__AL, __r8, ph2_ir->src1 + 4));
+        emit(__movt(__AL, __r8, ph2_ir->src1 + 4));
+        emit(__add_r(__AL, __sp, __sp, __r8));
+        emit(__lw(__AL, __lr, __sp, -4));
+        emit(__b(__AL, func->fn->bbs->elf_offset - elf_code_idx));
+        return;
     case OP_return:
         if (ph2_ir->src0 == -1)
             emit(__mov_r(__AL, __r0, __r0));
@@ -369,8 +386,11 @@ void emit_ph2_ir(ph2_ir_t *ph2_ir)
         emit(__mov_i(__EQ, rd, 1));
         return;
     case OP_log_and:
-        /* FIXME: bad logical-and instruction */
-        emit(__and_r(__AL, rd, rn, rm));
+        /* test rm only when rn is non-zero */
+        emit(__teq(rn));
+        emit(__teq_c(__NE, rm));
+        emit(__mov_i(__NE, rd, 1));
+        emit(__mov_i(__EQ, rd, 0));
         return;
     case OP_log_or:
         emit(__or_r(__AL, rd, rn, rm));
@@ -424,11 +444,18 @@ void code_generate()
     emit(__add_r(__AL, __r8, __r12, __r8));
     emit(__lw(__AL, __r0, __r8, 0));
     emit(__add_i(__AL, __r1, __r8, 4));
-    emit(__b(__AL, MAIN_BB->elf_offset - elf_code_idx));
+    if (MAIN_BB)
+        emit(__b(__AL, MAIN_BB->elf_offset - elf_code_idx));
+    else
+        /* building the libc image, which has no `main` */
+        emit(__b(__AL, 0));
 
     int i;
     for (i = 0; i < ph2_ir_idx; i++) {
         ph2_ir = &PH2_IR[i];
+        libc_image_record(ph2_ir);
         emit_ph2_ir(ph2_ir);
     }
+
+    libc_image_emit();
 }
@@ -294,3 +294,8 @@ int __teq(arm_reg rd)
 {
     return __mov(__AL, 1, arm_teq, 1, rd, 0, 0);
 }
+
+int __teq_c(arm_cond_t cond, arm_reg rd)
+{
+    return __mov(cond, 1, arm_teq, 1, rd, 0, 0);
+}
@@ -0,0 +1 @@
+/root/repo/src/arm-codegen.c
\ No newline at end of file
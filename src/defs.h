@@ -14,19 +14,12 @@
 #define MAX_VAR_LEN 32
 #define MAX_TYPE_LEN 32
 #define MAX_PARAMS 8
-#define MAX_LOCALS 1450
-#define MAX_FIELDS 32
+#define MAX_FIELDS 48
 #define MAX_FUNCS 512
-#define MAX_FUNC_TRIES 2160
-#define MAX_BLOCKS 2048
-#define MAX_TYPES 64
-#define MAX_IR_INSTR 36864
-#define MAX_BB_PRED 128
-#define MAX_BB_DOM_SUCC 64
-#define MAX_GLOBAL_IR 256
+#define MAX_TYPES 128
+#define MAX_IR_INSTR 65536
 #define MAX_LABEL 4096
-#define MAX_SOURCE 278528
-#define MAX_CODE 262144
+#define MAX_CODE 524288
 #define MAX_DATA 262144
 #define MAX_SYMTAB 65536
 #define MAX_STRTAB 65536
@@ -37,7 +30,25 @@
 #define MAX_CASES 128
 #define MAX_NESTING 128
 #define MAX_OPERAND_STACK_SIZE 32
-#define MAX_ANALYSIS_STACK_SIZE 750
+
+#define MAX_SYMBOLS 32768
+#define MAX_IDENT_BUCKETS 4096  /* must be a power of two */
+#define MAX_SYMBOL_BUCKETS 8192 /* must be a power of two */
+#define GVN_BUCKETS 256         /* must be a power of two */
+#define MAX_INDUCTIONS 32
+#define UNROLL_BUDGET 48        /* instructions of an unrolled loop body */
+#define UNROLL_FACTOR 4
+#define UNROLL_MAX_TRIPS 8      /* trip count up to which loops fully unroll */
+
+/* instructions of a leaf inlined everywhere */
+#define INLINE_LEAF_BUDGET 24
+/* instructions of a function inlined into its only caller */
+#define INLINE_SINGLE_BUDGET 256
+/* caller size past which nothing is inlined */
+#define INLINE_CALLER_BUDGET 2048
+#define MAX_LIBC_RELOCS 8192
+#define ARENA_BLOCK_SIZE 262144
+#define SOURCE_CHUNK 65536 /* growth step of SOURCE and size of a single read */
 
 #define ELF_START 0x10000
 #define PTR_SIZE 4
@@ -69,20 +80,97 @@ typedef enum {
     TYPE_typedef
 } base_type_t;
 
+/* lexer tokens */
+typedef enum {
+    T_start, /* FIXME: it was intended to start the state machine. */
+    T_numeric,
+    T_identifier,
+    T_comma,  /* , */
+    T_string, /* null-terminated string */
+    T_char,
+    T_open_bracket,  /* ( */
+    T_close_bracket, /* ) */
+    T_open_curly,    /* { */
+    T_close_curly,   /* } */
+    T_open_square,   /* [ */
+    T_close_square,  /* ] */
+    T_asterisk,      /* '*' */
+    T_divide,        /* / */
+    T_mod,           /* % */
+    T_bit_or,        /* | */
+    T_bit_xor,       /* ^ */
+    T_bit_not,       /* ~ */
+    T_log_and,       /* && */
+    T_log_or,        /* || */
+    T_log_not,       /* ! */
+    T_lt,            /* < */
+    T_gt,            /* > */
+    T_le,            /* <= */
+    T_ge,            /* >= */
+    T_lshift,        /* << */
+    T_rshift,        /* >> */
+    T_dot,           /* . */
+    T_arrow,         /* -> */
+    T_plus,          /* + */
+    T_minus,         /* - */
+    T_minuseq,       /* -= */
+    T_pluseq,        /* += */
+    T_oreq,          /* |= */
+    T_andeq,         /* &= */
+    T_eq,            /* == */
+    T_noteq,         /* != */
+    T_assign,        /* = */
+    T_increment,     /* ++ */
+    T_decrement,     /* -- */
+    T_question,      /* ? */
+    T_colon,         /* : */
+    T_semicolon,     /* ; */
+    T_eof,           /* end-of-file (EOF) */
+    T_ampersand,     /* & */
+    T_return,
+    T_if,
+    T_else,
+    T_while,
+    T_for,
+    T_do,
+    T_typedef,
+    T_enum,
+    T_struct,
+    T_sizeof,
+    T_elipsis, /* ... */
+    T_switch,
+    T_case,
+    T_break,
+    T_default,
+    T_continue,
+    /* C pre-processor directives */
+    T_cppd_include,
+    T_cppd_define,
+    T_cppd_undef,
+    T_cppd_error,
+    T_cppd_if,
+    T_cppd_elif,
+    T_cppd_else,
+    T_cppd_endif,
+    T_cppd_ifdef,
+    T_cppd_ifndef,
+    T_cppd_pragma
+} token_t;
+
 /* IR opcode */
 typedef enum {
     /* intermediate use in front-end. No code generation */
     OP_generic,
 
     OP_phi,
-    OP_unwound_phi, /* work like address_of + store */
 
     /* calling convention */
-    OP_define,   /* function entry point */
-    OP_push,     /* prepare arguments */
-    OP_call,     /* function call */
-    OP_indirect, /* indirect call with function pointer */
-    OP_return,   /* explicit return */
+    OP_define,    /* function entry point */
+    OP_push,      /* prepare arguments */
+    OP_call,      /* function call */
+    OP_indirect,  /* indirect call with function pointer */
+    OP_return,    /* explicit return */
+    OP_tail_call, /* call in place of a return, on the caller's frame */
 
     OP_allocat, /* allocate space on stack */
     OP_assign,
@@ -143,7 +231,7 @@ typedef enum {
 /* variable definition */
 typedef struct {
     int counter;
-    int stack[64];
+    int *stack; /* shares the capacity of the subscripts of its variable */
     int stack_idx;
 } rename_t;
 
@@ -156,9 +244,24 @@ struct ref_block_list {
 
 typedef struct ref_block_list ref_block_list_t;
 
+/* value of a variable in constant propagation */
+typedef enum {
+    LATTICE_TOP,   /* not known yet */
+    LATTICE_CONST, /* always lattice_val */
+    LATTICE_BOTTOM /* varies or unknown */
+} lattice_t;
+
+/* an instruction reading a variable, see build_def_use() */
+struct use {
+    struct insn *insn;
+    struct use *next;
+};
+
+typedef struct use use_t;
+
 struct var {
-    char type_name[MAX_TYPE_LEN];
-    char var_name[MAX_VAR_LEN];
+    char *type_name; /* names are stored once, see intern_name() */
+    char *var_name;
     int is_ptr;
     int is_func;
     int is_global;
@@ -166,16 +269,29 @@ struct var {
     int offset;   /* offset from stack or frame, index 0 is reserved */
     int init_val; /* for global initialization */
     int liveness; /* live range */
-    int in_loop;
+    int live_id;  /* dense index in the liveness sets, or -1 */
+    int in_loop; /* loop depth of its definition, see licm() */
     struct var *base;
     int subscript;
-    struct var *subscripts[64];
+    struct var **subscripts; /* SSA versions, indexed by their subscript */
     int subscripts_idx;
+    int subscripts_cap;
     rename_t rename;
     ref_block_list_t ref_block_list; /* blocks which kill variable */
     int consumed;
     int is_ternary_ret;
     int is_const; /* whether a constant representaion or not */
+    struct insn *def; /* defining instruction, valid when def_cnt is 1 */
+    int def_cnt;
+    use_t *uses;
+    int is_addr_taken; /* kept in memory, never propagated */
+    lattice_t lattice;
+    int lattice_val;
+    int vn; /* value number, 0 until numbered */
+    /* its copy while unrolling a loop or inlining a call, or the phi variable
+     * it is merged into out of SSA
+     */
+    struct var *copy;
 };
 
 typedef struct var var_t;
@@ -183,10 +299,10 @@ typedef struct var var_t;
 typedef struct {
     char name[MAX_VAR_LEN];
     int is_variadic;
-    int start_source_idx;
+    int start_token_idx; /* first token of the macro body */
     var_t param_defs[MAX_PARAMS];
     int num_param_defs;
-    int params[MAX_PARAMS];
+    int params[MAX_PARAMS]; /* first token of each argument at call site */
     int num_params;
     int disabled;
 } macro_t;
@@ -205,13 +321,15 @@ typedef struct {
 
 /* block definition */
 struct block {
-    var_t locals[MAX_LOCALS];
+    var_t **locals; /* grows on demand, the variables themselves never move */
+    int locals_capacity;
     int next_local;
     struct block *parent;
     func_t *func;
     macro_t *macro;
     int locals_size;
     int index;
+    int indexed_locals; /* locals already entered into the symbol table */
 };
 
 typedef struct block block_t;
@@ -219,7 +337,7 @@ typedef struct block block_t;
 /* phase-1 IR definition */
 typedef struct {
     opcode_t op;
-    char func_name[MAX_VAR_LEN];
+    char *func_name;
     int param_num;
     int size;
     var_t *dest;
@@ -234,6 +352,7 @@ typedef struct {
 } label_lut_t;
 
 typedef struct basic_block basic_block_t;
+typedef struct loop loop_t;
 
 /* phase-2 IR definition */
 struct ph2_ir {
@@ -241,12 +360,13 @@ struct ph2_ir {
     int src0;
     int src1;
     int dest;
-    char func_name[MAX_VAR_LEN];
+    char *func_name;
     basic_block_t *next_bb;
     basic_block_t *then_bb;
     basic_block_t *else_bb;
     struct ph2_ir *next;
     int is_branch_detached;
+    int is_src0_live; /* a move whose source is read again, see insn_fusion() */
 };
 
 typedef struct ph2_ir ph2_ir_t;
@@ -285,10 +405,78 @@ typedef struct {
     int value;
 } constant_t;
 
+/* interned identifier */
+struct ident {
+    char *name;
+    int hash;
+    int id;
+    int next; /* id of the next one of the same hash bucket, or -1 */
+    int defined;   /* a `#define` line of the loaded sources names it */
+    int undefined; /* an `#undef` line of the loaded sources names it */
+};
+
+typedef struct ident ident_t;
+
+/* source file loaded into SOURCE */
 typedef struct {
-    int index;
-    int next[128];
-} trie_t;
+    char path[MAX_LINE_LEN];
+    int start; /* offset of its first character in SOURCE */
+    int end;   /* offset of its terminating NUL in SOURCE */
+    int token_start; /* first token, or -1 before tokenization */
+    int token_end;   /* the token after it and its own inclusions */
+    int span_start;  /* first span of SOURCE_SPANS */
+    int span_end;    /* the span after it and its own inclusions */
+    char guard[MAX_VAR_LEN]; /* macro of its include guard, if any */
+    int once;                /* it has `#pragma once` */
+    int unconditional; /* no inclusion leading to it is within a condition */
+    FILE *pch;      /* precompiled header of the same text, see pch_open() */
+    int pch_tokens; /* the number of tokens it has been written from */
+} source_file_t;
+
+/* A run of SOURCE which is tokenized as a whole. Each file is loaded once
+ * after its parent, and the runs restore the textual order of inclusions.
+ */
+typedef struct {
+    int start;
+    int file; /* index in SOURCE_FILES, or -1 for the inlined libc */
+} source_span_t;
+
+/* A token of the pre-tokenized source. Identifiers, keywords and directives
+ * carry their interned id, and every token keeps its literal text and the
+ * offset in SOURCE where it begins.
+ */
+struct lexeme {
+    token_t kind;
+    int ident; /* interned id, or -1 for literals and punctuators */
+    char *value;
+    int offset;
+    int bol; /* first token of a line */
+};
+
+typedef struct lexeme lexeme_t;
+
+/* namespaces of the hashed symbol table */
+typedef enum {
+    SYM_LOCAL, /* variables of a block, scoped by the block */
+    SYM_TYPE,  /* type names and structure tags */
+    SYM_ALIAS,
+    SYM_MACRO,
+    SYM_CONSTANT,
+    SYM_FUNC
+} sym_kind_t;
+
+/* A symbol maps an interned identifier, within a namespace and scope, to the
+ * slot of the named object in its owning table.
+ */
+struct symbol_entry {
+    sym_kind_t kind;
+    int ident;
+    int scope; /* index of the owning block, or -1 outside SYM_LOCAL */
+    int slot;
+    struct symbol_entry *next;
+};
+
+typedef struct symbol_entry symbol_entry_t;
 
 struct phi_operand {
     var_t *var;
@@ -308,7 +496,11 @@ struct insn {
     var_t *rs2;
     int sz;
     phi_operand_t *phi_ops;
-    char str[64];
+    char *str; /* name of the called function */
+    basic_block_t *belong_to;
+    struct insn *vn_next; /* next expression in the same GVN bucket */
+    int is_live;          /* marked by dead code elimination */
+    int is_invariant;     /* marked by loop-invariant code motion */
 };
 
 typedef struct insn insn_t;
@@ -346,39 +538,66 @@ typedef struct {
 struct basic_block {
     insn_list_t insn_list;
     ph2_ir_list_t ph2_ir_list;
-    bb_connection_t prev[MAX_BB_PRED];
+    bb_connection_t *prev; /* predecessors, densely packed */
+    int prev_idx;
+    int prev_cap;
     struct basic_block *next;  /* normal BB */
     struct basic_block *then_; /* conditional BB */
     struct basic_block *else_;
     struct basic_block *idom;
     struct basic_block *rpo_next;
     struct basic_block *rpo_r_next;
-    var_t *live_gen[MAX_ANALYSIS_STACK_SIZE];
-    int live_gen_idx;
-    var_t *live_kill[MAX_ANALYSIS_STACK_SIZE];
-    int live_kill_idx;
-    var_t *live_in[MAX_ANALYSIS_STACK_SIZE];
-    int live_in_idx;
-    var_t *live_out[MAX_ANALYSIS_STACK_SIZE];
-    int live_out_idx;
+    int *live_gen; /* bitsets of the values of the function, by live_id */
+    int *live_kill;
+    int *live_in;
+    int *live_out;
+    int live_queued; /* in the worklist of the liveness solver */
+    int executable;  /* reached in constant propagation or from the entry */
+    int exec_edges;  /* executable outgoing edges, by bb_connection_type_t */
     int rpo;
     int rpo_r;
-    struct basic_block *DF[64];
+    struct basic_block **DF; /* dominance frontier */
     int df_idx;
+    int df_cap;
     int visited;
-    struct basic_block *dom_next[64];
+    struct basic_block **dom_next; /* children in the dominator tree */
+    int dom_next_idx;
+    int dom_next_cap;
     struct basic_block *dom_prev;
+    loop_t *loop; /* innermost loop containing the block, if any */
     fn_t *belong_to;
     block_t *scope;
     symbol_list_t symbol_list; /* variable declaration */
     int elf_offset;
 };
 
+/* natural loop, a node of the loop nesting forest, see build_loops() */
+struct loop {
+    basic_block_t *header;
+    basic_block_t **blocks; /* the header included */
+    int blocks_idx;
+    int blocks_cap;
+    int depth; /* 1 for the outermost loops */
+    struct loop *parent;
+    struct loop *next; /* in fn->loops, inner loops first */
+};
+
 struct ref_block {
     basic_block_t *bb;
     struct ref_block *next;
 };
 
+/* function of the prebuilt libc image */
+typedef struct {
+    char name[MAX_VAR_LEN];
+    int offset; /* from the start of the image code */
+    int size;
+    int reloc_start;
+    int reloc_count;
+    fn_t *fn; /* parsed counterpart, detached from FUNC_LIST */
+    int used;
+} libc_symbol_t;
+
 /* TODO: integrate func_t into fn_t */
 struct fn {
     basic_block_t *bbs;
@@ -386,7 +605,11 @@ struct fn {
     symbol_list_t global_sym_list;
     int bb_cnt;
     int visited;
+    int live_vars; /* number of values in its liveness sets */
+    loop_t *loops;
+    int calls; /* calls and other references to it, see inline_calls() */
     func_t *func;
+    libc_symbol_t *prebuilt; /* code taken from the libc image, if any */
     struct fn *next;
 };
 
@@ -402,7 +625,70 @@ typedef struct {
     void (*postorder_cb)(fn_t *, basic_block_t *);
 } bb_traversal_args_t;
 
+/* worklists of the sparse conditional constant propagation */
+typedef struct {
+    basic_block_t **blocks; /* newly executable blocks */
+    int blocks_idx;
+    int blocks_cap;
+    var_t **vars; /* variables whose lattice value dropped */
+    int vars_idx;
+    int vars_cap;
+} sccp_t;
+
+/* expressions available in global value numbering */
+typedef struct {
+    insn_t **buckets; /* GVN_BUCKETS chains, innermost definition first */
+    int vn_cnt;
+} gvn_t;
+
+/* basic induction variable of a loop, a phi of its header stepping by a
+ * constant on the back edge, see ivsr()
+ */
+typedef struct {
+    var_t *var;
+    var_t *init; /* the value entering the loop */
+    insn_t *inc; /* the step, read back by the phi through copies */
+    basic_block_t *latch;
+    int step;
+    var_t *derived; /* the reduced var * scale + offset, if any */
+    int scale;
+    var_t *offset;
+} induction_t;
+
 typedef struct {
     var_t *var;
     int polluted;
 } regfile_t;
+
+/* A chunk of memory handed out by bump allocation */
+struct arena_block {
+    char *memory;
+    int capacity;
+    int offset;
+    struct arena_block *next;
+};
+
+typedef struct arena_block arena_block_t;
+
+/* Objects of the same lifetime are allocated from an arena and all released
+ * at once when the phase using them is over.
+ */
+typedef struct {
+    arena_block_t *head;
+    int block_size;
+} arena_t;
+
+/* A position-dependent instruction of the image. It is emitted again from
+ * its second phase IR once the image functions have their final offsets.
+ */
+typedef struct {
+    int offset; /* from the start of the image code */
+    opcode_t op;
+    int src0;
+    int src1;
+    int dest;
+    char func_name[MAX_VAR_LEN];
+    int then_offset; /* branch targets, from the start of the image code */
+    int else_offset;
+    int is_branch_detached;
+} libc_reloc_t;
@@ -66,6 +66,8 @@ void elf_write_symbol_int(int val)
 
 void elf_write_code_int(int val)
 {
+    if (elf_code_idx + 4 > MAX_CODE)
+        error("Code segment is too large");
     elf_code_idx = elf_write_int(elf_code, elf_code_idx, val);
 }
 
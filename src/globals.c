@@ -7,7 +7,8 @@
 
 /* Global objects */
 
-block_t *BLOCKS;
+/* the first block is the global scope */
+block_t *GLOBAL_BLOCK;
 int blocks_idx = 0;
 
 macro_t *MACROS;
@@ -17,20 +18,12 @@ int macros_idx = 0;
 func_t *FUNCS;
 int funcs_idx = 1;
 
-/* FUNC_TRIES is used to improve the performance of the find_func function.
- * Instead of searching through all functions and comparing their names, we can
- * utilize the trie data structure to search for existing functions efficiently.
- * The index starts from 1 because the first trie node represents an empty input
- * string, and it is not possible to record a function with an empty name.
- */
-trie_t *FUNC_TRIES;
-int func_tries_idx = 1;
-
 type_t *TYPES;
 int types_idx = 0;
 
 ph1_ir_t *GLOBAL_IR;
 int global_ir_idx = 0;
+int global_ir_cap = 0;
 
 ph1_ir_t *PH1_IR;
 int ph1_ir_idx = 0;
@@ -54,8 +47,42 @@ int aliases_idx = 0;
 constant_t *CONSTANTS;
 int constants_idx = 0;
 
+/* Interned identifiers: each distinct name is stored once in NAME_ARENA and
+ * identified by its index in IDENTS. The symbol tables are keyed on that id,
+ * so a lookup hashes the name once instead of comparing it against every
+ * entry of a table.
+ */
+ident_t *IDENTS;
+int idents_idx = 0;
+int idents_cap = 0;
+int *IDENT_BUCKETS; /* id of the first identifier of each bucket, or -1 */
+
+/* Variables, types, aliases, macros, enumerators and functions share a single
+ * hash table, keyed by namespace, identifier and scope.
+ */
+symbol_entry_t *SYMBOLS;
+int symbols_idx = 0;
+symbol_entry_t **SYMBOL_BUCKETS;
+
+/* All source text lives in SOURCE, which grows as files are loaded */
 char *SOURCE;
 int source_idx = 0;
+int source_size = 0; /* length of SOURCE once loaded */
+int source_capacity = 0;
+
+source_file_t *SOURCE_FILES;
+int source_files_idx = 0;
+int source_files_cap = 0;
+source_span_t *SOURCE_SPANS;
+int source_spans_idx = 0;
+int source_spans_cap = 0;
+
+/* The source is tokenized once before parsing. The text of literals is kept
+ * in NAME_ARENA, identifiers point to their interned name.
+ */
+lexeme_t *TOKENS;
+int tokens_idx = 0;
+int tokens_cap = 0;
 
 /* ELF sections */
 
@@ -72,67 +99,240 @@ char *elf_symtab;
 char *elf_strtab;
 char *elf_section;
 
+/* prebuilt libc image, either being built or linked into the output */
+libc_symbol_t *LIBC_SYMBOLS;
+int libc_symbols_idx = 0;
+libc_reloc_t *LIBC_RELOCS;
+int libc_relocs_idx = 0;
+char *libc_image_code;
+int libc_image_size = 0;
+FILE *libc_image_fp; /* opened image, until libc is restored from it */
+
+/* The CFG and the instructions of both IR phases are allocated from arenas.
+ * INSN_ARENA holds the first phase instructions, the phi operands and the
+ * symbol and reference lists, which are all dead after register allocation.
+ * BB_ARENA holds functions, basic blocks and the second phase IR, which are
+ * needed until the code is generated.
+ */
+arena_t *INSN_ARENA;
+arena_t *BB_ARENA;
+
+/* interned identifiers, literals and generated names of temporaries and
+ * labels
+ */
+arena_t *NAME_ARENA;
+
+/* scopes along with their local variables */
+arena_t *BLOCK_ARENA;
+
+void error(char *msg);
+void *arena_alloc(arena_t *arena, int size);
+
+/* Make room for @len more characters and a terminating NUL after source_idx */
+void source_reserve(int len)
+{
+    char *grown;
+
+    if (source_idx + len < source_capacity)
+        return;
+
+    while (source_idx + len >= source_capacity)
+        source_capacity += source_capacity;
+    grown = malloc(source_capacity);
+    memcpy(grown, SOURCE, source_idx);
+    free(SOURCE);
+    SOURCE = grown;
+}
+
+/* Make room in @table, which holds @idx entries of @size bytes, for one more,
+ * returns the table, which may have moved.
+ */
+void *table_reserve(void *table, int idx, int *cap, int size)
+{
+    char *grown;
+
+    if (idx < cap[0])
+        return table;
+
+    cap[0] = cap[0] ? cap[0] * 2 : 64;
+    grown = malloc(cap[0] * size);
+    memcpy(grown, table, idx * size);
+    free(table);
+    return grown;
+}
+
+void source_append(char *text, int len)
+{
+    source_reserve(len);
+    memcpy(SOURCE + source_idx, text, len);
+    source_idx += len;
+}
+
+int add_source_file(char *path)
+{
+    source_file_t *file;
+
+    SOURCE_FILES = table_reserve(SOURCE_FILES, source_files_idx,
+                                 &source_files_cap, sizeof(source_file_t));
+    file = &SOURCE_FILES[source_files_idx];
+    strcpy(file->path, path);
+    file->start = source_idx;
+    file->end = source_idx;
+    file->token_start = -1;
+    file->token_end = -1;
+    file->span_start = source_spans_idx;
+    file->span_end = source_spans_idx;
+    file->guard[0] = 0;
+    file->once = 0;
+    file->unconditional = 0;
+    file->pch = NULL;
+    file->pch_tokens = 0;
+    source_files_idx++;
+    return source_files_idx - 1;
+}
+
+void add_source_span(int start, int file)
+{
+    SOURCE_SPANS = table_reserve(SOURCE_SPANS, source_spans_idx,
+                                 &source_spans_cap, sizeof(source_span_t));
+    SOURCE_SPANS[source_spans_idx].start = start;
+    SOURCE_SPANS[source_spans_idx].file = file;
+    source_spans_idx++;
+}
+
+int hash_name(char *name)
+{
+    int h = 0, i;
+    for (i = 0; name[i]; i++)
+        h = (h * 33 + name[i]) & 0xFFFFFF;
+    return h;
+}
+
 /**
- * insert_trie() - Inserts a new element into the trie structure.
- * @trie: A pointer to the trie where the name will be inserted.
- * @name: The name to be inserted into the trie.
- * @funcs_index: The index of the pointer to the func_t. The index is
- *               recorded in a 1-indexed format. Because the first element of
- *               `FUNCS` has been reserved, there's no need to shift it.
- * Return: The index of the pointer to the func_t.
+ * find_ident() - Find the id of an interned identifier.
+ * @name: The name to be searched.
  *
- * If the function has been inserted, the return value is the index of the
- * function in FUNCS. Otherwise, the return value is the value of the parameter
- * @funcs_index.
+ * Return: The id of the identifier, or -1 if the name was never interned, in
+ * which case no symbol can be recorded under it.
  */
-int insert_trie(trie_t *trie, char *name, int funcs_index)
+int find_ident(char *name)
 {
-    char first_char = *name;
-    int fc = first_char;
-    int i;
-    if (!fc) {
-        if (!trie->index)
-            trie->index = funcs_index;
-        return trie->index;
+    int hash = hash_name(name);
+    int id = IDENT_BUCKETS[hash & (MAX_IDENT_BUCKETS - 1)];
+
+    for (; id >= 0; id = IDENTS[id].next) {
+        if (IDENTS[id].hash == hash && !strcmp(IDENTS[id].name, name))
+            return id;
     }
-    if (!trie->next[fc]) {
-        /* FIXME: The func_tries_idx variable may exceed the maximum number,
-         * which can lead to a segmentation fault. This issue is affected by the
-         * number of functions and the length of their names. The proper way to
-         * handle this is to dynamically allocate a new element.
-         */
-        trie->next[fc] = func_tries_idx++;
-        for (i = 0; i < 128; i++)
-            FUNC_TRIES[trie->next[fc]].next[i] = 0;
-        FUNC_TRIES[trie->next[fc]].index = 0;
+    return -1;
+}
+
+/**
+ * intern() - Intern an identifier.
+ * @name: The name to be interned.
+ *
+ * Return: The id of the identifier, which is allocated on first use.
+ */
+int intern(char *name)
+{
+    int hash = hash_name(name);
+    int bucket = hash & (MAX_IDENT_BUCKETS - 1);
+    int id;
+    ident_t *ident;
+
+    for (id = IDENT_BUCKETS[bucket]; id >= 0; id = IDENTS[id].next) {
+        if (IDENTS[id].hash == hash && !strcmp(IDENTS[id].name, name))
+            return id;
     }
-    return insert_trie(&FUNC_TRIES[trie->next[fc]], name + 1, funcs_index);
+
+    IDENTS = table_reserve(IDENTS, idents_idx, &idents_cap, sizeof(ident_t));
+    ident = &IDENTS[idents_idx];
+    ident->id = idents_idx++;
+    ident->hash = hash;
+    ident->name = arena_alloc(NAME_ARENA, strlen(name) + 1);
+    strcpy(ident->name, name);
+    ident->next = IDENT_BUCKETS[bucket];
+    ident->defined = 0;
+    ident->undefined = 0;
+    IDENT_BUCKETS[bucket] = ident->id;
+    return ident->id;
 }
 
 /**
- * find_trie() - search the index of the function name in the trie
- * @trie: A pointer to the trie where the name will be searched.
- * @name: The name to be searched.
+ * intern_name() - Store a name of variable or type once.
+ * @name: The name, which may live in a temporary buffer.
  *
- * Return: The index of the pointer to the func_t.
+ * Names never change once given, so variables share a single copy of them.
+ * Identifiers of the source are interned. Generated names, which start with a
+ * dot, are unique and simply copied into NAME_ARENA.
  *
- * 0 - the name not found.
- * otherwise - the index of the founded index in the trie array.
+ * Return: The stored copy of @name.
  */
-int find_trie(trie_t *trie, char *name)
+char *intern_name(char *name)
 {
-    char first_char = *name;
-    int fc = first_char;
-    if (!fc)
-        return trie->index;
-    if (!trie->next[fc])
-        return 0;
-    return find_trie(&FUNC_TRIES[trie->next[fc]], name + 1);
+    char *copy;
+    int id;
+
+    /* intern() may move IDENTS, so it is called before indexing */
+    if (name[0] != '.') {
+        id = intern(name);
+        return IDENTS[id].name;
+    }
+
+    copy = arena_alloc(NAME_ARENA, strlen(name) + 1);
+    strcpy(copy, name);
+    return copy;
+}
+
+int symbol_bucket(sym_kind_t kind, int ident, int scope)
+{
+    return (ident * 8 + kind + (scope + 1) * 1031) & (MAX_SYMBOL_BUCKETS - 1);
+}
+
+symbol_entry_t *symbol_chain(sym_kind_t kind, int ident, int scope)
+{
+    return SYMBOL_BUCKETS[symbol_bucket(kind, ident, scope)];
+}
+
+int symbol_match(symbol_entry_t *sym, sym_kind_t kind, int ident, int scope)
+{
+    return sym->kind == kind && sym->ident == ident && sym->scope == scope;
+}
+
+/**
+ * add_symbol_entry() - Record a named object in the symbol table.
+ * @kind: The namespace of the name.
+ * @name: The name of the object.
+ * @scope: The index of the owning block for SYM_LOCAL, otherwise -1.
+ * @slot: The index of the object in its owning table.
+ *
+ * Several entries may share a name; lookups prefer the lowest slot, which
+ * matches the first-declared-wins order of the original linear scans.
+ */
+void add_symbol_entry(sym_kind_t kind, char *name, int scope, int slot)
+{
+    int ident = intern(name);
+    int bucket = symbol_bucket(kind, ident, scope);
+    symbol_entry_t *sym;
+
+    if (symbols_idx >= MAX_SYMBOLS)
+        error("Too many symbols");
+
+    sym = &SYMBOLS[symbols_idx++];
+    sym->kind = kind;
+    sym->ident = ident;
+    sym->scope = scope;
+    sym->slot = slot;
+    sym->next = SYMBOL_BUCKETS[bucket];
+    SYMBOL_BUCKETS[bucket] = sym;
 }
 
 /* options */
 
 int dump_ir = 0;
+int build_libc_image = 0;
+int use_pch = 0;
+int emit_pch = 0;
 
 /**
  * find_type() - Find the type by the given name.
@@ -146,47 +346,71 @@ int dump_ir = 0;
  */
 type_t *find_type(char *type_name, int flag)
 {
-    int i;
-    for (i = 0; i < types_idx; i++) {
-        if (TYPES[i].base_type == TYPE_struct) {
+    int ident = find_ident(type_name), slot = -1;
+    symbol_entry_t *sym;
+    type_t *type;
+
+    if (ident < 0)
+        return NULL;
+
+    for (sym = symbol_chain(SYM_TYPE, ident, -1); sym; sym = sym->next) {
+        if (!symbol_match(sym, SYM_TYPE, ident, -1))
+            continue;
+        if (slot >= 0 && sym->slot > slot)
+            continue;
+        type = &TYPES[sym->slot];
+        /* the type may have been renamed after it was indexed */
+        if (strcmp(type->type_name, type_name))
+            continue;
+        if (type->base_type == TYPE_struct) {
             if (flag == 1)
                 continue;
-            if (!strcmp(TYPES[i].type_name, type_name))
-                return &TYPES[i];
-        } else {
-            if (flag == 2)
-                continue;
-            if (!strcmp(TYPES[i].type_name, type_name)) {
-                /*
-                 * If it is a forwardly declared alias of a structure, return
-                 * the base structure type.
-                 */
-                if (TYPES[i].base_type == TYPE_typedef && TYPES[i].size == 0)
-                    return TYPES[i].base_struct;
-                return &TYPES[i];
-            }
-        }
+        } else if (flag == 2)
+            continue;
+        slot = sym->slot;
     }
-    return NULL;
+    if (slot < 0)
+        return NULL;
+
+    type = &TYPES[slot];
+    /*
+     * If it is a forwardly declared alias of a structure, return the base
+     * structure type.
+     */
+    if (type->base_type == TYPE_typedef && type->size == 0)
+        return type->base_struct;
+    return type;
 }
 
 ph1_ir_t *add_global_ir(opcode_t op)
 {
-    ph1_ir_t *ir = &GLOBAL_IR[global_ir_idx++];
+    ph1_ir_t *ir;
+
+    GLOBAL_IR = table_reserve(GLOBAL_IR, global_ir_idx, &global_ir_cap,
+                              sizeof(ph1_ir_t));
+    ir = &GLOBAL_IR[global_ir_idx++];
     ir->op = op;
     return ir;
 }
 
 ph1_ir_t *add_ph1_ir(opcode_t op)
 {
-    ph1_ir_t *ph1_ir = &PH1_IR[ph1_ir_idx++];
+    ph1_ir_t *ph1_ir;
+
+    if (ph1_ir_idx == MAX_IR_INSTR)
+        error("Too many IR instructions");
+    ph1_ir = &PH1_IR[ph1_ir_idx++];
     ph1_ir->op = op;
     return ph1_ir;
 }
 
 ph2_ir_t *add_ph2_ir(opcode_t op)
 {
-    ph2_ir_t *ph2_ir = &PH2_IR[ph2_ir_idx++];
+    ph2_ir_t *ph2_ir;
+
+    if (ph2_ir_idx == MAX_IR_INSTR)
+        error("Too many IR instructions");
+    ph2_ir = &PH2_IR[ph2_ir_idx++];
     ph2_ir->op = op;
     return ph2_ir;
 }
@@ -217,48 +441,70 @@ int find_label_offset(char name[])
 
 block_t *add_block(block_t *parent, func_t *func, macro_t *macro)
 {
-    block_t *blk = &BLOCKS[blocks_idx];
+    block_t *blk = arena_alloc(BLOCK_ARENA, sizeof(block_t));
+    if (!blocks_idx)
+        GLOBAL_BLOCK = blk;
     blk->index = blocks_idx++;
     blk->parent = parent;
     blk->func = func;
     blk->macro = macro;
     blk->next_local = 0;
+    blk->indexed_locals = 0;
     return blk;
 }
 
 void add_alias(char *alias, char *value)
 {
-    alias_t *al = &ALIASES[aliases_idx++];
+    alias_t *al = &ALIASES[aliases_idx];
+    add_symbol_entry(SYM_ALIAS, alias, -1, aliases_idx++);
     strcpy(al->alias, alias);
     strcpy(al->value, value);
     al->disabled = 0;
 }
 
-char *find_alias(char alias[])
+/* Return the earliest alias of the given name which is still defined. */
+alias_t *find_alias_entry(char *alias)
 {
-    int i;
-    for (i = 0; i < aliases_idx; i++) {
-        if (!ALIASES[i].disabled && !strcmp(alias, ALIASES[i].alias))
-            return ALIASES[i].value;
+    int ident = find_ident(alias), slot = -1;
+    symbol_entry_t *sym;
+
+    if (ident < 0)
+        return NULL;
+
+    for (sym = symbol_chain(SYM_ALIAS, ident, -1); sym; sym = sym->next) {
+        if (!symbol_match(sym, SYM_ALIAS, ident, -1))
+            continue;
+        if (ALIASES[sym->slot].disabled)
+            continue;
+        if (slot < 0 || sym->slot < slot)
+            slot = sym->slot;
     }
+    if (slot < 0)
+        return NULL;
+    return &ALIASES[slot];
+}
+
+char *find_alias(char alias[])
+{
+    alias_t *al = find_alias_entry(alias);
+    if (al)
+        return al->value;
     return NULL;
 }
 
 int remove_alias(char *alias)
 {
-    int i;
-    for (i = 0; i < aliases_idx; i++) {
-        if (!ALIASES[i].disabled && !strcmp(alias, ALIASES[i].alias)) {
-            ALIASES[i].disabled = 1;
-            return 1;
-        }
-    }
-    return 0;
+    alias_t *al = find_alias_entry(alias);
+    if (!al)
+        return 0;
+    al->disabled = 1;
+    return 1;
 }
 
 macro_t *add_macro(char *name)
 {
-    macro_t *ma = &MACROS[macros_idx++];
+    macro_t *ma = &MACROS[macros_idx];
+    add_symbol_entry(SYM_MACRO, name, -1, macros_idx++);
     strcpy(ma->name, name);
     ma->disabled = 0;
     return ma;
@@ -266,28 +512,35 @@ macro_t *add_macro(char *name)
 
 macro_t *find_macro(char *name)
 {
-    int i;
-    for (i = 0; i < macros_idx; i++) {
-        if (!MACROS[i].disabled && !strcmp(name, MACROS[i].name))
-            return &MACROS[i];
+    int ident = find_ident(name), slot = -1;
+    symbol_entry_t *sym;
+
+    if (ident < 0)
+        return NULL;
+
+    for (sym = symbol_chain(SYM_MACRO, ident, -1); sym; sym = sym->next) {
+        if (!symbol_match(sym, SYM_MACRO, ident, -1))
+            continue;
+        if (MACROS[sym->slot].disabled)
+            continue;
+        if (slot < 0 || sym->slot < slot)
+            slot = sym->slot;
     }
-    return NULL;
+    if (slot < 0)
+        return NULL;
+    return &MACROS[slot];
 }
 
 int remove_macro(char *name)
 {
-    int i;
-    for (i = 0; i < macros_idx; i++) {
-        if (!MACROS[i].disabled && !strcmp(name, MACROS[i].name)) {
-            MACROS[i].disabled = 1;
-            return 1;
-        }
-    }
-    return 0;
+    macro_t *macro = find_macro(name);
+    if (!macro)
+        return 0;
+    macro->disabled = 1;
+    return 1;
 }
 
-void error(char *msg);
-int find_macro_param_src_idx(char *name, block_t *parent)
+int find_macro_param_token_idx(char *name, block_t *parent)
 {
     int i;
     macro_t *macro = parent->macro;
@@ -304,15 +557,16 @@ int find_macro_param_src_idx(char *name, block_t *parent)
     return 0;
 }
 
+func_t *find_func(char func_name[]);
+
 func_t *add_func(char *name)
 {
-    func_t *fn;
-    int index = insert_trie(FUNC_TRIES, name, funcs_idx);
-    if (index == funcs_idx) {
-        fn = &FUNCS[funcs_idx++];
-        strcpy(fn->return_def.var_name, name);
+    func_t *fn = find_func(name);
+    if (!fn) {
+        fn = &FUNCS[funcs_idx];
+        add_symbol_entry(SYM_FUNC, name, -1, funcs_idx++);
+        fn->return_def.var_name = intern_name(name);
     }
-    fn = &FUNCS[index];
     fn->stack_size = 4; /*starting point of stack */
     return fn;
 }
@@ -322,35 +576,63 @@ type_t *add_type()
     return &TYPES[types_idx++];
 }
 
+/* Index the current name of @type; called whenever a type gets its name. */
+void index_type(type_t *type)
+{
+    /* self-hosted, the difference is in bytes rather than in elements */
+    int slot = type - TYPES;
+    if (&TYPES[slot] != type)
+        slot = slot / sizeof(type_t);
+    add_symbol_entry(SYM_TYPE, type->type_name, -1, slot);
+}
+
 type_t *add_named_type(char *name)
 {
     type_t *type = add_type();
     strcpy(type->type_name, name);
+    index_type(type);
     return type;
 }
 
 void add_constant(char alias[], int value)
 {
-    constant_t *constant = &CONSTANTS[constants_idx++];
+    constant_t *constant = &CONSTANTS[constants_idx];
+    add_symbol_entry(SYM_CONSTANT, alias, -1, constants_idx++);
     strcpy(constant->alias, alias);
     constant->value = value;
 }
 
 constant_t *find_constant(char alias[])
 {
-    int i;
-    for (i = 0; i < constants_idx; i++) {
-        if (!strcmp(CONSTANTS[i].alias, alias))
-            return &CONSTANTS[i];
+    int ident = find_ident(alias), slot = -1;
+    symbol_entry_t *sym;
+
+    if (ident < 0)
+        return NULL;
+
+    for (sym = symbol_chain(SYM_CONSTANT, ident, -1); sym; sym = sym->next) {
+        if (!symbol_match(sym, SYM_CONSTANT, ident, -1))
+            continue;
+        if (slot < 0 || sym->slot < slot)
+            slot = sym->slot;
     }
-    return NULL;
+    if (slot < 0)
+        return NULL;
+    return &CONSTANTS[slot];
 }
 
 func_t *find_func(char func_name[])
 {
-    int index = find_trie(FUNC_TRIES, func_name);
-    if (index)
-        return &FUNCS[index];
+    int ident = find_ident(func_name);
+    symbol_entry_t *sym;
+
+    if (ident < 0)
+        return NULL;
+
+    for (sym = symbol_chain(SYM_FUNC, ident, -1); sym; sym = sym->next) {
+        if (symbol_match(sym, SYM_FUNC, ident, -1))
+            return &FUNCS[sym->slot];
+    }
     return NULL;
 }
 
@@ -371,16 +653,65 @@ var_t *find_member(char token[], type_t *type)
     return NULL;
 }
 
+/* Enter the locals declared since the previous lookup into the symbol table.
+ * Variables are named right after require_var() and before any lookup, so
+ * indexing them lazily sees their final names.
+ */
+void index_locals(block_t *block)
+{
+    var_t **locals = block->locals;
+
+    for (; block->indexed_locals < block->next_local; block->indexed_locals++) {
+        var_t *var = locals[block->indexed_locals];
+        char *name = var->var_name;
+
+        /* temporaries and labels are never looked up by name */
+        if (name[0] == '.' || !name[0])
+            continue;
+        add_symbol_entry(SYM_LOCAL, var->var_name, block->index,
+                         block->indexed_locals);
+    }
+}
+
+var_t *find_block_var(char *token, block_t *block)
+{
+    var_t **locals = block->locals;
+    int ident, slot = -1;
+    symbol_entry_t *sym;
+
+    index_locals(block);
+    ident = find_ident(token);
+    if (ident < 0)
+        return NULL;
+
+    for (sym = symbol_chain(SYM_LOCAL, ident, block->index); sym;
+         sym = sym->next) {
+        if (!symbol_match(sym, SYM_LOCAL, ident, block->index))
+            continue;
+        if (sym->slot >= block->next_local)
+            continue;
+        if (slot >= 0 && sym->slot > slot)
+            continue;
+        /* the slot may have been given back and reused by another variable */
+        if (strcmp(locals[sym->slot]->var_name, token))
+            continue;
+        slot = sym->slot;
+    }
+    if (slot < 0)
+        return NULL;
+    return locals[slot];
+}
+
 var_t *find_local_var(char *token, block_t *block)
 {
     int i;
     func_t *fn = block->func;
+    var_t *var;
 
     for (; block; block = block->parent) {
-        for (i = 0; i < block->next_local; i++) {
-            if (!strcmp(block->locals[i].var_name, token))
-                return &block->locals[i];
-        }
+        var = find_block_var(token, block);
+        if (var)
+            return var;
     }
 
     if (fn) {
@@ -394,14 +725,7 @@ var_t *find_local_var(char *token, block_t *block)
 
 var_t *find_global_var(char *token)
 {
-    int i;
-    block_t *block = &BLOCKS[0];
-
-    for (i = 0; i < block->next_local; i++) {
-        if (!strcmp(block->locals[i].var_name, token))
-            return &block->locals[i];
-    }
-    return NULL;
+    return find_block_var(token, GLOBAL_BLOCK);
 }
 
 var_t *find_var(char *token, block_t *parent)
@@ -431,10 +755,65 @@ int size_var(var_t *var)
     return size;
 }
 
+arena_t *arena_init(int block_size)
+{
+    arena_t *arena = malloc(sizeof(arena_t));
+    arena->head = NULL;
+    arena->block_size = block_size;
+    return arena;
+}
+
+/* Returns @size zeroed bytes, which live until the arena is released */
+void *arena_alloc(arena_t *arena, int size)
+{
+    arena_block_t *block = arena->head;
+    char *ptr;
+
+    /* keep the objects aligned for the host */
+    size = (size + HOST_PTR_SIZE - 1) / HOST_PTR_SIZE * HOST_PTR_SIZE;
+
+    if (!block || block->offset + size > block->capacity) {
+        block = malloc(sizeof(arena_block_t));
+        block->capacity = arena->block_size;
+        if (size > block->capacity)
+            block->capacity = size;
+        block->memory = calloc(1, block->capacity);
+        if (!block->memory)
+            error("Arena is out of memory");
+        block->offset = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    ptr = block->memory + block->offset;
+    block->offset += size;
+    return ptr;
+}
+
+/* Release every object allocated from @arena, which remains usable */
+void arena_release(arena_t *arena)
+{
+    arena_block_t *block = arena->head, *next;
+
+    while (block) {
+        next = block->next;
+        free(block->memory);
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+void arena_free(arena_t *arena)
+{
+    arena_release(arena);
+    free(arena);
+}
+
 /* TODO: Integrate with `func_t` */
 fn_t *add_fn()
 {
-    fn_t *n = calloc(1, sizeof(fn_t));
+    fn_t *n = arena_alloc(BB_ARENA, sizeof(fn_t));
 
     if (!FUNC_LIST.head) {
         FUNC_LIST.head = n;
@@ -449,13 +828,8 @@ fn_t *add_fn()
 /* Create a basic block and set the scope of variables to `parent` block */
 basic_block_t *bb_create(block_t *parent)
 {
-    basic_block_t *bb = calloc(1, sizeof(basic_block_t));
+    basic_block_t *bb = arena_alloc(BB_ARENA, sizeof(basic_block_t));
 
-    int i;
-    for (i = 0; i < MAX_BB_PRED; i++) {
-        bb->prev[i].bb = NULL;
-        bb->prev[i].type = NEXT;
-    }
     bb->scope = parent;
     bb->belong_to = parent->func->fn;
     return bb;
@@ -471,17 +845,21 @@ void bb_connect(basic_block_t *pred,
     if (!succ)
         abort();
 
-    int i = 0;
-    while (succ->prev[i].bb)
-        i++;
-
-    if (i > MAX_BB_PRED - 1) {
-        printf("Error: too many predecessors\n");
-        abort();
+    bb_connection_t *prev = succ->prev, *old_prev = succ->prev;
+    int i;
+    if (succ->prev_idx == succ->prev_cap) {
+        succ->prev_cap = succ->prev_cap ? succ->prev_cap * 2 : 2;
+        prev = arena_alloc(BB_ARENA, succ->prev_cap * sizeof(bb_connection_t));
+        for (i = 0; i < succ->prev_idx; i++) {
+            prev[i].bb = old_prev[i].bb;
+            prev[i].type = old_prev[i].type;
+        }
+        succ->prev = prev;
     }
 
-    succ->prev[i].bb = pred;
-    succ->prev[i].type = type;
+    prev[succ->prev_idx].bb = pred;
+    prev[succ->prev_idx].type = type;
+    succ->prev_idx++;
 
     switch (type) {
     case NEXT:
@@ -501,10 +879,11 @@ void bb_connect(basic_block_t *pred,
 /* The pred-succ pair must have only one connection */
 void bb_disconnect(basic_block_t *pred, basic_block_t *succ)
 {
+    bb_connection_t *prev = succ->prev;
     int i;
-    for (i = 0; i < MAX_BB_PRED; i++) {
-        if (succ->prev[i].bb == pred) {
-            switch (succ->prev[i].type) {
+    for (i = 0; i < succ->prev_idx; i++) {
+        if (prev[i].bb == pred) {
+            switch (prev[i].type) {
             case NEXT:
                 pred->next = NULL;
                 break;
@@ -518,7 +897,12 @@ void bb_disconnect(basic_block_t *pred, basic_block_t *succ)
                 abort();
             }
 
-            succ->prev[i].bb = NULL;
+            /* keep the remaining predecessors packed and in order */
+            succ->prev_idx--;
+            for (; i < succ->prev_idx; i++) {
+                prev[i].bb = prev[i + 1].bb;
+                prev[i].type = prev[i + 1].type;
+            }
             break;
         }
     }
@@ -533,7 +917,7 @@ void add_symbol(basic_block_t *bb, var_t *var)
             return;
     }
 
-    sym = calloc(1, sizeof(symbol_t));
+    sym = arena_alloc(INSN_ARENA, sizeof(symbol_t));
     sym->var = var;
 
     if (!bb->symbol_list.head) {
@@ -561,15 +945,14 @@ void add_insn(block_t *block,
 
     bb->scope = block;
 
-    insn_t *n = calloc(1, sizeof(insn_t));
+    insn_t *n = arena_alloc(INSN_ARENA, sizeof(insn_t));
     n->opcode = op;
     n->rd = rd;
     n->rs1 = rs1;
     n->rs2 = rs2;
     n->sz = sz;
 
-    if (str)
-        strcpy(n->str, str);
+    n->str = str;
 
     if (!bb->insn_list.head)
         bb->insn_list.head = n;
@@ -585,20 +968,25 @@ void add_insn(block_t *block,
  */
 void global_init()
 {
+    int i;
+
     elf_code_start = ELF_START + elf_header_len;
 
-    BLOCKS = malloc(MAX_BLOCKS * sizeof(block_t));
     MACROS = malloc(MAX_ALIASES * sizeof(macro_t));
     FUNCS = malloc(MAX_FUNCS * sizeof(func_t));
-    FUNC_TRIES = malloc(MAX_FUNC_TRIES * sizeof(trie_t));
     TYPES = malloc(MAX_TYPES * sizeof(type_t));
-    GLOBAL_IR = malloc(MAX_GLOBAL_IR * sizeof(ph1_ir_t));
     PH1_IR = malloc(MAX_IR_INSTR * sizeof(ph1_ir_t));
     PH2_IR = malloc(MAX_IR_INSTR * sizeof(ph2_ir_t));
     LABEL_LUT = malloc(MAX_LABEL * sizeof(label_lut_t));
-    SOURCE = malloc(MAX_SOURCE);
+    SOURCE = malloc(SOURCE_CHUNK);
+    source_capacity = SOURCE_CHUNK;
     ALIASES = malloc(MAX_ALIASES * sizeof(alias_t));
     CONSTANTS = malloc(MAX_CONSTANTS * sizeof(constant_t));
+    IDENT_BUCKETS = malloc(MAX_IDENT_BUCKETS * sizeof(int));
+    for (i = 0; i < MAX_IDENT_BUCKETS; i++)
+        IDENT_BUCKETS[i] = -1;
+    SYMBOLS = malloc(MAX_SYMBOLS * sizeof(symbol_entry_t));
+    SYMBOL_BUCKETS = calloc(MAX_SYMBOL_BUCKETS, HOST_PTR_SIZE);
 
     elf_code = malloc(MAX_CODE);
     elf_data = malloc(MAX_DATA);
@@ -607,24 +995,40 @@ void global_init()
     elf_strtab = malloc(MAX_STRTAB);
     elf_section = malloc(MAX_SECTION);
 
-    /* set starting point of global stack manually */
+    LIBC_SYMBOLS = malloc(MAX_FUNCS * sizeof(libc_symbol_t));
+    LIBC_RELOCS = malloc(MAX_LIBC_RELOCS * sizeof(libc_reloc_t));
+
+    INSN_ARENA = arena_init(ARENA_BLOCK_SIZE);
+    BB_ARENA = arena_init(ARENA_BLOCK_SIZE);
+    NAME_ARENA = arena_init(ARENA_BLOCK_SIZE);
+    BLOCK_ARENA = arena_init(ARENA_BLOCK_SIZE);
+    libc_image_code = NULL;
+    libc_image_fp = NULL;
+
+    /* set starting point of global stack manually, which has no name */
     FUNCS[0].stack_size = 4;
+    FUNCS[0].return_def.var_name = NULL;
 }
 
 void global_release()
 {
-    free(BLOCKS);
     free(MACROS);
     free(FUNCS);
-    free(FUNC_TRIES);
     free(TYPES);
     free(GLOBAL_IR);
     free(PH1_IR);
     free(PH2_IR);
     free(LABEL_LUT);
     free(SOURCE);
+    free(SOURCE_FILES);
+    free(SOURCE_SPANS);
     free(ALIASES);
     free(CONSTANTS);
+    free(IDENTS);
+    free(IDENT_BUCKETS);
+    free(SYMBOLS);
+    free(SYMBOL_BUCKETS);
+    free(TOKENS);
 
     free(elf_code);
     free(elf_data);
@@ -632,35 +1036,95 @@ void global_release()
     free(elf_symtab);
     free(elf_strtab);
     free(elf_section);
+
+    free(LIBC_SYMBOLS);
+    free(LIBC_RELOCS);
+    free(libc_image_code);
+
+    arena_free(INSN_ARENA);
+    arena_free(BB_ARENA);
+    arena_free(NAME_ARENA);
+    arena_free(BLOCK_ARENA);
+}
+
+/* Binary files written by shecc itself hold little-endian words and names of
+ * fixed length.
+ */
+void file_write_int(FILE *fp, int val)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+        fputc((val >> (i * 8)) & 0xFF, fp);
+}
+
+/* write @str padded with zeros to @len characters */
+void file_write_str(FILE *fp, char *str, int len)
+{
+    int i, c = 1;
+    for (i = 0; i < len; i++) {
+        if (c)
+            c = str[i];
+        fputc(c, fp);
+    }
+}
+
+int file_read_int(FILE *fp)
+{
+    int val = 0, i;
+    for (i = 0; i < 4; i++)
+        val |= (fgetc(fp) & 0xFF) << (i * 8);
+    return val;
+}
+
+void file_read_str(FILE *fp, char *str, int len)
+{
+    fread(str, 1, len, fp);
+    str[len - 1] = 0;
 }
 
 void error(char *msg)
 {
     /* Construct error source diagnostics, enabling precise identification of
      * syntax and logic issues within the code. */
-    int offset, start_idx, i = 0;
+    int offset, start_idx, i = 0, line = 1, file;
     char diagnostic[512 /* MAX_LINE_LEN * 2 */];
 
-    for (offset = source_idx; offset >= 0 && SOURCE[offset] != '\n'; offset--)
+    for (offset = source_idx - 1;
+         offset >= 0 && SOURCE[offset] != '\n' && SOURCE[offset]; offset--)
         ;
 
     start_idx = offset + 1;
 
-    for (offset = 0; offset < MAX_SOURCE && SOURCE[start_idx + offset] != '\n';
+    for (offset = 0; SOURCE[start_idx + offset] != '\n' &&
+                     SOURCE[start_idx + offset] && offset < MAX_LINE_LEN;
          offset++) {
         diagnostic[i++] = SOURCE[start_idx + offset];
     }
     diagnostic[i++] = '\n';
 
-    for (offset = start_idx; offset < source_idx; offset++) {
+    for (offset = start_idx; offset < source_idx && i < MAX_LINE_LEN * 2 - 20;
+         offset++) {
         diagnostic[i++] = ' ';
     }
 
     strcpy(diagnostic + i, "^ Error occurs here");
 
-    /* TODO: figure out the corresponding C source file path and report line
-     * number */
-    printf("Error %s at source location %d\n%s\n", msg, source_idx, diagnostic);
+    /* locate the file and line number through the file table */
+    for (file = 0; file < source_files_idx; file++) {
+        if (source_idx >= SOURCE_FILES[file].start &&
+            source_idx <= SOURCE_FILES[file].end)
+            break;
+    }
+    if (file < source_files_idx) {
+        for (offset = SOURCE_FILES[file].start; offset < source_idx; offset++) {
+            if (SOURCE[offset] == '\n')
+                line++;
+        }
+        printf("Error %s at %s:%d\n%s\n", msg, SOURCE_FILES[file].path, line,
+               diagnostic);
+    } else
+        printf("Error %s at source location %d\n%s\n", msg, source_idx,
+               diagnostic);
     abort();
 }
 
@@ -5,96 +5,53 @@
  * file "LICENSE" for information on usage and redistribution of this file.
  */
 
-/* lexer tokens */
-typedef enum {
-    T_start, /* FIXME: it was intended to start the state machine. */
-    T_numeric,
-    T_identifier,
-    T_comma,  /* , */
-    T_string, /* null-terminated string */
-    T_char,
-    T_open_bracket,  /* ( */
-    T_close_bracket, /* ) */
-    T_open_curly,    /* { */
-    T_close_curly,   /* } */
-    T_open_square,   /* [ */
-    T_close_square,  /* ] */
-    T_asterisk,      /* '*' */
-    T_divide,        /* / */
-    T_mod,           /* % */
-    T_bit_or,        /* | */
-    T_bit_xor,       /* ^ */
-    T_bit_not,       /* ~ */
-    T_log_and,       /* && */
-    T_log_or,        /* || */
-    T_log_not,       /* ! */
-    T_lt,            /* < */
-    T_gt,            /* > */
-    T_le,            /* <= */
-    T_ge,            /* >= */
-    T_lshift,        /* << */
-    T_rshift,        /* >> */
-    T_dot,           /* . */
-    T_arrow,         /* -> */
-    T_plus,          /* + */
-    T_minus,         /* - */
-    T_minuseq,       /* -= */
-    T_pluseq,        /* += */
-    T_oreq,          /* |= */
-    T_andeq,         /* &= */
-    T_eq,            /* == */
-    T_noteq,         /* != */
-    T_assign,        /* = */
-    T_increment,     /* ++ */
-    T_decrement,     /* -- */
-    T_question,      /* ? */
-    T_colon,         /* : */
-    T_semicolon,     /* ; */
-    T_eof,           /* end-of-file (EOF) */
-    T_ampersand,     /* & */
-    T_return,
-    T_if,
-    T_else,
-    T_while,
-    T_for,
-    T_do,
-    T_typedef,
-    T_enum,
-    T_struct,
-    T_sizeof,
-    T_elipsis, /* ... */
-    T_switch,
-    T_case,
-    T_break,
-    T_default,
-    T_continue,
-    /* C pre-processor directives */
-    T_cppd_include,
-    T_cppd_define,
-    T_cppd_undef,
-    T_cppd_error,
-    T_cppd_if,
-    T_cppd_elif,
-    T_cppd_else,
-    T_cppd_endif,
-    T_cppd_ifdef
-} token_t;
-
 char token_str[MAX_TOKEN_LEN];
 token_t next_token;
 char next_char;
-int skip_newline = 1;
+
+/* Whether the scanner has skipped a newline since the last token */
+int scan_bol = 1;
+
+/* Index of the next token to be read from TOKENS */
+int token_idx;
+
+/* The next token is the first one of a header which has not been scanned, see
+ * lex_token_internal().
+ */
+int token_pending;
 
 int preproc_match;
 
-/* Point to the first character after where the macro has been called. It is
+/* Point to the first token after where the macro has been called. It is
  * needed when returning from the macro body.
  */
 int macro_return_idx;
 
+/* character classes */
+#define CC_SPACE 1   /* ' ' and '\t' */
+#define CC_NEWLINE 2 /* '\r' and '\n' */
+#define CC_DIGIT 4
+#define CC_ALPHA 8 /* letters and '_' */
+#define CC_HEX 16  /* hexadecimal digits and 'x' */
+
+char CHAR_CLASS[256];
+
+/* Keywords and directives are placed by a perfect hash: no two of them share
+ * a bucket, so a lookup takes a single string comparison.
+ */
+#define KEYWORD_BUCKETS 64
+
+char *KEYWORD_NAMES[KEYWORD_BUCKETS];
+token_t KEYWORD_TOKENS[KEYWORD_BUCKETS];
+
+int char_class(char c)
+{
+    return CHAR_CLASS[c & 255];
+}
+
 int is_whitespace(char c)
 {
-    return c == ' ' || c == '\t';
+    return char_class(c) & CC_SPACE;
 }
 
 char peek_char(int offset);
@@ -107,27 +64,170 @@ int is_linebreak(char c)
 
 int is_newline(char c)
 {
-    return c == '\r' || c == '\n';
+    return char_class(c) & CC_NEWLINE;
 }
 
 /* is it alphabet, number or '_'? */
 int is_alnum(char c)
 {
-    return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
-            (c >= '0' && c <= '9') || (c == '_'));
+    return char_class(c) & (CC_ALPHA | CC_DIGIT);
 }
 
 int is_digit(char c)
 {
-    return c >= '0' && c <= '9';
+    return char_class(c) & CC_DIGIT;
 }
 
 int is_hex(char c)
 {
-    return ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || c == 'x' ||
-            (c >= 'A' && c <= 'F'));
+    return char_class(c) & CC_HEX;
+}
+
+void set_char_class(char first, char last, int cc)
+{
+    int c;
+
+    for (c = first; c <= last; c++)
+        CHAR_CLASS[c] |= cc;
+}
+
+int keyword_hash(char *name)
+{
+    int len = strlen(name);
+    int h = len + name[0] + name[1] * 13 + name[len - 1] * 17;
+
+    return h & (KEYWORD_BUCKETS - 1);
+}
+
+void add_keyword(char *name, token_t token)
+{
+    int h = keyword_hash(name);
+
+    if (KEYWORD_NAMES[h])
+        error("Keyword hash collision");
+    KEYWORD_NAMES[h] = name;
+    KEYWORD_TOKENS[h] = token;
+}
+
+/* Returns the token of a keyword or directive, or T_identifier otherwise */
+token_t find_keyword(char *name)
+{
+    int h = keyword_hash(name);
+
+    if (KEYWORD_NAMES[h] && !strcmp(KEYWORD_NAMES[h], name))
+        return KEYWORD_TOKENS[h];
+    return T_identifier;
+}
+
+void lexer_init()
+{
+    int i;
+
+    for (i = 0; i < 256; i++)
+        CHAR_CLASS[i] = 0;
+    set_char_class(' ', ' ', CC_SPACE);
+    set_char_class('\t', '\t', CC_SPACE);
+    set_char_class('\r', '\r', CC_NEWLINE);
+    set_char_class('\n', '\n', CC_NEWLINE);
+    set_char_class('0', '9', CC_DIGIT | CC_HEX);
+    set_char_class('a', 'z', CC_ALPHA);
+    set_char_class('A', 'Z', CC_ALPHA);
+    set_char_class('_', '_', CC_ALPHA);
+    set_char_class('a', 'f', CC_HEX);
+    set_char_class('A', 'F', CC_HEX);
+    set_char_class('x', 'x', CC_HEX);
+
+    for (i = 0; i < KEYWORD_BUCKETS; i++)
+        KEYWORD_NAMES[i] = NULL;
+    add_keyword("if", T_if);
+    add_keyword("while", T_while);
+    add_keyword("for", T_for);
+    add_keyword("do", T_do);
+    add_keyword("else", T_else);
+    add_keyword("return", T_return);
+    add_keyword("typedef", T_typedef);
+    add_keyword("enum", T_enum);
+    add_keyword("struct", T_struct);
+    add_keyword("sizeof", T_sizeof);
+    add_keyword("switch", T_switch);
+    add_keyword("case", T_case);
+    add_keyword("break", T_break);
+    add_keyword("default", T_default);
+    add_keyword("continue", T_continue);
+    add_keyword("#include", T_cppd_include);
+    add_keyword("#define", T_cppd_define);
+    add_keyword("#undef", T_cppd_undef);
+    add_keyword("#error", T_cppd_error);
+    add_keyword("#if", T_cppd_if);
+    add_keyword("#elif", T_cppd_elif);
+    add_keyword("#ifdef", T_cppd_ifdef);
+    add_keyword("#ifndef", T_cppd_ifndef);
+    add_keyword("#pragma", T_cppd_pragma);
+    add_keyword("#else", T_cppd_else);
+    add_keyword("#endif", T_cppd_endif);
+}
+
+#ifdef __SHECC__
+/* Returns the index where the run of identifier characters from @idx ends */
+int scan_ident_run(int idx)
+{
+    while (is_alnum(SOURCE[idx]))
+        idx++;
+    return idx;
 }
 
+/* Returns the index where the run of spaces and tabs from @idx ends */
+int scan_space_run(int idx)
+{
+    while (is_whitespace(SOURCE[idx]))
+        idx++;
+    return idx;
+}
+#else
+/* The host compiler scans 16 characters at a time with generic vectors. The
+ * remainder of a run is finished by the scalar loop.
+ */
+typedef signed char lex_vec_t __attribute__((vector_size(16)));
+
+int lex_vec_all(lex_vec_t mask)
+{
+    unsigned int w[4];
+
+    memcpy(w, &mask, sizeof(w));
+    return (w[0] & w[1] & w[2] & w[3]) == 0xFFFFFFFF;
+}
+
+int scan_ident_run(int idx)
+{
+    lex_vec_t v, lower;
+
+    for (; idx + 16 <= source_size; idx += 16) {
+        memcpy(&v, SOURCE + idx, sizeof(v));
+        lower = v | 0x20;
+        if (!lex_vec_all(((lower >= 'a') & (lower <= 'z')) |
+                         ((v >= '0') & (v <= '9')) | (v == '_')))
+            break;
+    }
+    while (is_alnum(SOURCE[idx]))
+        idx++;
+    return idx;
+}
+
+int scan_space_run(int idx)
+{
+    lex_vec_t v;
+
+    for (; idx + 16 <= source_size; idx += 16) {
+        memcpy(&v, SOURCE + idx, sizeof(v));
+        if (!lex_vec_all((v == ' ') | (v == '\t')))
+            break;
+    }
+    while (is_whitespace(SOURCE[idx]))
+        idx++;
+    return idx;
+}
+#endif
+
 int is_numeric(char buffer[])
 {
     int i, hex = 0, size = strlen(buffer);
@@ -144,6 +244,7 @@ int is_numeric(char buffer[])
     return 1;
 }
 
+/* Skip whitespace, newlines and C-style comments */
 void skip_whitespace()
 {
     while (1) {
@@ -152,8 +253,25 @@ void skip_whitespace()
             next_char = SOURCE[source_idx];
             continue;
         }
-        if (is_whitespace(next_char) ||
-            (skip_newline && is_newline(next_char))) {
+        if (next_char == '/' && peek_char(1) == '*') {
+            source_idx += 2;
+            while (SOURCE[source_idx] != '*' || SOURCE[source_idx + 1] != '/') {
+                if (!SOURCE[source_idx])
+                    error("Unterminated comment");
+                source_idx++;
+            }
+            source_idx += 2;
+            next_char = SOURCE[source_idx];
+            continue;
+        }
+        if (is_whitespace(next_char)) {
+            source_idx = scan_space_run(source_idx);
+            next_char = SOURCE[source_idx];
+            continue;
+        }
+        if (is_newline(next_char)) {
+            if (next_char == '\n')
+                scan_bol = 1;
             next_char = SOURCE[++source_idx];
             continue;
         }
@@ -174,67 +292,44 @@ char peek_char(int offset)
     return SOURCE[source_idx + offset];
 }
 
-/* Lex next token and returns its token type. Parameter `aliasing` is used for
- * disable preprocessor aliasing on identifier tokens.
+/* Read the characters from `next_char` up to the end of the identifier run
+ * beginning at @start into `token_str`.
  */
-token_t lex_token_internal(int aliasing)
+void read_word(int start)
+{
+    int len = scan_ident_run(start) - source_idx;
+
+    if (len >= MAX_TOKEN_LEN)
+        error("Token is too long");
+    strncpy(token_str, SOURCE + source_idx, len);
+    token_str[len] = 0;
+    source_idx += len;
+    next_char = SOURCE[source_idx];
+    skip_whitespace();
+}
+
+/* Scan the token at `next_char` into `token_str` and returns its token type.
+ * Whitespace and comments after the token are skipped as well.
+ */
+token_t scan_token()
 {
     token_str[0] = 0;
 
     /* partial preprocessor */
     if (next_char == '#') {
-        int i = 0;
+        token_t kind;
 
-        do {
-            token_str[i++] = next_char;
-        } while (is_alnum(read_char(0)));
-        token_str[i] = 0;
-        skip_whitespace();
+        read_word(source_idx + 1);
+        kind = find_keyword(token_str);
+        if (kind == T_identifier)
+            error("Unknown directive");
+        return kind;
+    }
 
-        if (!strcmp(token_str, "#include"))
-            return T_cppd_include;
-        if (!strcmp(token_str, "#define"))
-            return T_cppd_define;
-        if (!strcmp(token_str, "#undef"))
-            return T_cppd_undef;
-        if (!strcmp(token_str, "#error"))
-            return T_cppd_error;
-        if (!strcmp(token_str, "#if"))
-            return T_cppd_if;
-        if (!strcmp(token_str, "#elif"))
-            return T_cppd_elif;
-        if (!strcmp(token_str, "#ifdef"))
-            return T_cppd_ifdef;
-        if (!strcmp(token_str, "#else"))
-            return T_cppd_else;
-        if (!strcmp(token_str, "#endif"))
-            return T_cppd_endif;
-        error("Unknown directive");
-    }
-
-    /* C-style comments */
+    /* comments have been skipped, so it must be a divide */
     if (next_char == '/') {
-        read_char(0);
-        if (next_char == '*') {
-            /* in a comment, skip until end */
-            do {
-                read_char(0);
-                if (next_char == '*') {
-                    read_char(0);
-                    if (next_char == '/') {
-                        read_char(1);
-                        return lex_token_internal(aliasing);
-                    }
-                }
-            } while (next_char);
-        } else {
-            /* single '/', predict divide */
-            if (next_char == ' ')
-                read_char(1);
-            return T_divide;
-        }
-        /* TODO: check invalid cases */
-        error("Unexpected '/'");
+        read_char(1);
+        return T_divide;
     }
 
     if (is_digit(next_char)) {
@@ -476,76 +571,148 @@ token_t lex_token_internal(int aliasing)
     }
 
     if (is_alnum(next_char)) {
-        char *alias;
-        int i = 0;
-        do {
-            token_str[i++] = next_char;
-        } while (is_alnum(read_char(0)));
-        token_str[i] = 0;
+        read_word(source_idx);
+        return find_keyword(token_str);
+    }
+
+    if (next_char == 0)
+        return T_eof;
+
+    error("Unrecognized input");
+
+    /* Unreachable, but we need an explicit return for non-void method. */
+    return T_eof;
+}
+
+/* Store the token whose text is in token_str as TOKENS[@idx] */
+void set_token(int idx, token_t kind, int offset, int bol)
+{
+    lexeme_t *lx = &TOKENS[idx];
+
+    lx->kind = kind;
+    lx->ident = -1;
+    lx->value = "";
+    lx->offset = offset;
+    lx->bol = bol;
+
+    if (kind == T_numeric || kind == T_string || kind == T_char) {
+        lx->value = arena_alloc(NAME_ARENA, strlen(token_str) + 1);
+        strcpy(lx->value, token_str);
+    } else if (token_str[0]) {
+        lx->ident = intern(token_str);
+        lx->value = IDENTS[lx->ident].name;
+    }
+}
+
+void add_token(token_t kind, int offset, int bol)
+{
+    TOKENS = table_reserve(TOKENS, tokens_idx, &tokens_cap, sizeof(lexeme_t));
+    set_token(tokens_idx++, kind, offset, bol);
+}
+
+/* Tokenize SOURCE_SPANS[@first] to SOURCE_SPANS[@last - 1] from tokens_idx */
+void tokenize_spans(int first, int last)
+{
+    int i, n;
+
+    for (i = first; i < last; i++) {
+        int file = SOURCE_SPANS[i].file;
+
+        /* A header which may be restored from its precompiled one is only
+         * given room for its tokens. The first one stands for all of them
+         * until either happens, see pch_global_statement().
+         */
+        if (file >= 0 && SOURCE_FILES[file].pch &&
+            i == SOURCE_FILES[file].span_start) {
+            SOURCE_FILES[file].token_start = tokens_idx;
+            token_str[0] = 0;
+            for (n = 0; n < SOURCE_FILES[file].pch_tokens; n++)
+                add_token(T_start, SOURCE_SPANS[i].start, 1);
+            SOURCE_FILES[file].token_end = tokens_idx;
+            i = SOURCE_FILES[file].span_end - 1;
+            continue;
+        }
+
+        source_idx = SOURCE_SPANS[i].start;
+        next_char = SOURCE[source_idx];
+        scan_bol = 1;
         skip_whitespace();
 
-        if (!strcmp(token_str, "if"))
-            return T_if;
-        if (!strcmp(token_str, "while"))
-            return T_while;
-        if (!strcmp(token_str, "for"))
-            return T_for;
-        if (!strcmp(token_str, "do"))
-            return T_do;
-        if (!strcmp(token_str, "else"))
-            return T_else;
-        if (!strcmp(token_str, "return"))
-            return T_return;
-        if (!strcmp(token_str, "typedef"))
-            return T_typedef;
-        if (!strcmp(token_str, "enum"))
-            return T_enum;
-        if (!strcmp(token_str, "struct"))
-            return T_struct;
-        if (!strcmp(token_str, "sizeof"))
-            return T_sizeof;
-        if (!strcmp(token_str, "switch"))
-            return T_switch;
-        if (!strcmp(token_str, "case"))
-            return T_case;
-        if (!strcmp(token_str, "break"))
-            return T_break;
-        if (!strcmp(token_str, "default"))
-            return T_default;
-        if (!strcmp(token_str, "continue"))
-            return T_continue;
-
-        if (aliasing) {
-            alias = find_alias(token_str);
-            if (alias) {
-                token_t t = is_numeric(alias) ? T_numeric : T_string;
-                strcpy(token_str, alias);
-                return t;
-            }
+        if (file >= 0 && SOURCE_FILES[file].token_start < 0)
+            SOURCE_FILES[file].token_start = tokens_idx;
+
+        while (next_char) {
+            int offset = source_idx, bol = scan_bol;
+
+            scan_bol = 0;
+            add_token(scan_token(), offset, bol);
         }
 
-        return T_identifier;
+        /* the last span of a file follows those of its inclusions */
+        if (file >= 0)
+            SOURCE_FILES[file].token_end = tokens_idx;
     }
+}
+
+/* Tokenize the whole SOURCE into TOKENS, span by span in the order of the
+ * inclusions. Each token is scanned only once, the parser and the macro
+ * expansion then walk the array.
+ */
+void tokenize()
+{
+    source_size = source_idx;
+    tokenize_spans(0, source_spans_idx);
+
+    token_str[0] = 0;
+    add_token(T_eof, source_size - 1, 1);
+}
+
+void pch_scan_pending();
+
+/* Lex next token and returns its token type. Parameter `aliasing` is used for
+ * disable preprocessor aliasing on identifier tokens.
+ */
+token_t lex_token_internal(int aliasing)
+{
+    lexeme_t *lx;
 
-    /* This only happens when parsing a macro. Move to the token after the
-     * macro definition or return to where the macro has been called.
+    /* The line of a macro body ends the expansion. Return to where the macro
+     * has been called.
      */
-    if (next_char == '\n') {
-        if (macro_return_idx) {
-            source_idx = macro_return_idx;
-            next_char = SOURCE[source_idx];
-        } else
-            next_char = read_char(1);
-        return lex_token_internal(aliasing);
+    if (macro_return_idx && TOKENS[token_idx].bol)
+        token_idx = macro_return_idx;
+
+    /* The first token of an unscanned header is read as T_start once, so that
+     * pch_global_statement() may restore the header. Reading on scans it.
+     */
+    while (TOKENS[token_idx].kind == T_start && token_idx) {
+        if (!token_pending) {
+            token_pending = 1;
+            source_idx = TOKENS[token_idx].offset;
+            token_str[0] = 0;
+            return T_start;
+        }
+        pch_scan_pending();
     }
 
-    if (next_char == 0)
-        return T_eof;
+    lx = &TOKENS[token_idx];
+    if (lx->kind != T_eof)
+        token_idx++;
 
-    error("Unrecognized input");
+    /* keep the location for diagnostics */
+    source_idx = lx->offset;
+    strcpy(token_str, lx->value);
 
-    /* Unreachable, but we need an explicit return for non-void method. */
-    return T_eof;
+    if (aliasing && lx->kind == T_identifier) {
+        char *alias = find_alias(token_str);
+        if (alias) {
+            token_t t = is_numeric(alias) ? T_numeric : T_string;
+            strcpy(token_str, alias);
+            return t;
+        }
+    }
+
+    return lx->kind;
 }
 
 /* Lex next token and returns its token type. To disable aliasing on next
@@ -558,16 +725,17 @@ token_t lex_token()
 /* Skip the content. We only need the index where the macro body begins. */
 void skip_macro_body()
 {
-    while (!is_newline(next_char))
-        next_token = lex_token();
+    while (!TOKENS[token_idx].bol && TOKENS[token_idx].kind != T_eof)
+        token_idx++;
 
-    skip_newline = 1;
     next_token = lex_token();
 }
 
 /* Accepts next token if token types are matched. */
 int lex_accept_internal(token_t token, int aliasing)
 {
+    if (token_pending)
+        next_token = lex_token();
     if (next_token == token) {
         next_token = lex_token_internal(aliasing);
         return 1;
@@ -589,6 +757,8 @@ int lex_accept(token_t token)
  */
 int lex_peek(token_t token, char *value)
 {
+    if (token_pending)
+        next_token = lex_token();
     if (next_token == token) {
         if (!value)
             return 1;
@@ -603,6 +773,8 @@ int lex_peek(token_t token, char *value)
  */
 void lex_ident_internal(token_t token, char *value, int aliasing)
 {
+    if (token_pending)
+        next_token = lex_token();
     if (next_token != token)
         error("Unexpected token");
     strcpy(value, token_str);
@@ -621,6 +793,8 @@ void lex_ident(token_t token, char *value)
 /* Strictly match next token with given token type. */
 void lex_expect_internal(token_t token, int aliasing)
 {
+    if (token_pending)
+        next_token = lex_token();
     if (next_token != token)
         error("Unexpected token");
     next_token = lex_token_internal(aliasing);
@@ -0,0 +1,396 @@
+/*
+ * shecc - Self-Hosting and Educational C Compiler.
+ *
+ * shecc is freely redistributable under the BSD 2 clause license. See the
+ * file "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/* Prebuilt libc image.
+ *
+ * `--build-libc-image` compiles the embedded libc alone, and saves what parsing
+ * it leaves behind, i.e. its types, aliases, prototypes, global variables and
+ * string literals, along with the machine code of its functions. Given such an
+ * image, the embedded libc is neither lexed nor parsed. Its definitions are
+ * restored right after the built-in ones, where parsing would have placed
+ * them, and only the functions reachable from the program are placed after the
+ * compiled ones.
+ *
+ * The image is a sequence of little-endian words:
+ *   magic, ELF machine, libc size, libc hash, the state libc starts from,
+ *   its definitions (see pch_write_defs()), global variables, data,
+ *   code size, number of symbols, number of relocations,
+ *   symbols, relocations and finally the code bytes.
+ */
+
+#define LIBC_IMAGE_MAGIC 0x434c4853 /* "SHLC" */
+
+void emit_ph2_ir(ph2_ir_t *ph2_ir);
+var_t *require_var(block_t *blk);
+
+/* generated along with the embedded libc, see tools/inliner.c */
+int libc_size();
+int libc_hash();
+
+/* Only these instructions depend on where the function or the data ends up */
+int is_relocatable_insn(ph2_ir_t *ph2_ir)
+{
+    switch (ph2_ir->op) {
+    case OP_call:
+    case OP_tail_call:
+    case OP_address_of_func:
+    case OP_load_data_address:
+    case OP_branch:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Called for each flattened instruction right before it is emitted */
+void libc_image_record(ph2_ir_t *ph2_ir)
+{
+    libc_reloc_t *reloc;
+
+    if (!build_libc_image || !is_relocatable_insn(ph2_ir))
+        return;
+    if (libc_relocs_idx >= MAX_LIBC_RELOCS)
+        error("Too many relocations in libc image");
+
+    reloc = &LIBC_RELOCS[libc_relocs_idx++];
+    reloc->offset = elf_code_idx;
+    reloc->op = ph2_ir->op;
+    reloc->src0 = ph2_ir->src0;
+    reloc->src1 = ph2_ir->src1;
+    reloc->dest = ph2_ir->dest;
+    reloc->func_name[0] = 0;
+    if (ph2_ir->func_name)
+        strcpy(reloc->func_name, ph2_ir->func_name);
+    reloc->is_branch_detached = ph2_ir->is_branch_detached;
+    reloc->then_offset = 0;
+    reloc->else_offset = 0;
+    if (ph2_ir->op == OP_branch) {
+        reloc->then_offset = ph2_ir->then_bb->elf_offset;
+        reloc->else_offset = ph2_ir->else_bb->elf_offset;
+    }
+}
+
+/* Open the image in @file, if any, and return 1 if it has been built from the
+ * embedded libc for this target. libc is then restored from it by
+ * libc_image_start() instead of being parsed. Any other image is silently
+ * ignored, and libc is compiled as usual.
+ */
+int libc_image_open(char *file)
+{
+    FILE *fp;
+
+    if (!file)
+        return 0;
+    fp = fopen(file, "rb");
+    if (!fp)
+        return 0;
+    if (file_read_int(fp) != LIBC_IMAGE_MAGIC ||
+        file_read_int(fp) != ELF_MACHINE || file_read_int(fp) != libc_size() ||
+        file_read_int(fp) != libc_hash()) {
+        fclose(fp);
+        return 0;
+    }
+    libc_image_fp = fp;
+    return 1;
+}
+
+/* Restore libc from the opened image, right after the built-in definitions */
+void libc_image_restore()
+{
+    FILE *fp = libc_image_fp;
+    libc_symbol_t *sym;
+    libc_reloc_t *reloc;
+    func_t *func;
+    fn_t *fn;
+    var_t *var;
+    int num_syms, num_relocs, n, i;
+
+    if (file_read_int(fp) != types_idx || file_read_int(fp) != aliases_idx ||
+        file_read_int(fp) != macros_idx ||
+        file_read_int(fp) != constants_idx ||
+        file_read_int(fp) != funcs_idx || file_read_int(fp) != symbols_idx ||
+        file_read_int(fp) != GLOBAL_BLOCK->next_local ||
+        file_read_int(fp) != elf_data_idx)
+        error("Prebuilt libc image does not match the compiler");
+    pch_read_defs(fp, 0);
+
+    /* global variables, allocated in the same order as when parsed */
+    n = file_read_int(fp);
+    for (i = 0; i < n; i++) {
+        var = require_var(GLOBAL_BLOCK);
+        pch_read_var(fp, var);
+        var->is_global = 1;
+        add_insn(GLOBAL_BLOCK, GLOBAL_FUNC.fn->bbs, OP_allocat, var, NULL,
+                 NULL, 0, NULL);
+    }
+
+    /* string literals */
+    n = file_read_int(fp);
+    elf_data_idx += fread(elf_data + elf_data_idx, 1, n, fp);
+
+    libc_image_size = file_read_int(fp);
+    num_syms = file_read_int(fp);
+    num_relocs = file_read_int(fp);
+    if (num_syms > MAX_FUNCS || num_relocs > MAX_LIBC_RELOCS)
+        error("Too many functions in libc image");
+
+    /* The first definition of a name comes from libc, and a later one from
+     * the program overrides it.
+     */
+    for (i = 0; i < num_syms; i++) {
+        sym = &LIBC_SYMBOLS[i];
+        file_read_str(fp, sym->name, MAX_VAR_LEN);
+        sym->offset = file_read_int(fp);
+        sym->size = file_read_int(fp);
+        sym->reloc_start = file_read_int(fp);
+        sym->reloc_count = file_read_int(fp);
+        sym->used = 0;
+
+        func = find_func(sym->name);
+        if (!func)
+            error("Prebuilt libc image does not match the compiler");
+        fn = arena_alloc(BB_ARENA, sizeof(fn_t));
+        fn->bbs = arena_alloc(BB_ARENA, sizeof(basic_block_t));
+        fn->bbs->belong_to = fn;
+        fn->func = func;
+        fn->prebuilt = sym;
+        func->fn = fn;
+        sym->fn = fn;
+    }
+    for (i = 0; i < num_relocs; i++) {
+        reloc = &LIBC_RELOCS[i];
+        reloc->offset = file_read_int(fp);
+        reloc->op = file_read_int(fp);
+        reloc->src0 = file_read_int(fp);
+        reloc->src1 = file_read_int(fp);
+        reloc->dest = file_read_int(fp);
+        file_read_str(fp, reloc->func_name, MAX_VAR_LEN);
+        reloc->then_offset = file_read_int(fp);
+        reloc->else_offset = file_read_int(fp);
+        reloc->is_branch_detached = file_read_int(fp);
+    }
+    libc_image_code = malloc(libc_image_size);
+    i = fread(libc_image_code, 1, libc_image_size, fp);
+    fclose(fp);
+    libc_image_fp = NULL;
+    if (i != libc_image_size)
+        error("Truncated libc image");
+    libc_symbols_idx = num_syms;
+    libc_relocs_idx = num_relocs;
+}
+
+/* Called once the built-in definitions are in place, where the embedded libc
+ * starts. It records the state the image is built from, or restores libc from
+ * the image opened by libc_image_open().
+ */
+void libc_image_start()
+{
+    if (build_libc_image)
+        pch_snapshot(0);
+    else if (libc_image_fp)
+        libc_image_restore();
+}
+
+/* Write what compiling the embedded libc alone has left into @file */
+void libc_image_write(char *file)
+{
+    FILE *fp;
+    fn_t *fn;
+    libc_symbol_t *sym;
+    libc_reloc_t *reloc;
+    var_t **globals = GLOBAL_BLOCK->locals;
+    int base, end, i, r = 0;
+
+    if (!FUNC_LIST.head)
+        error("No libc function to build the image from");
+    /* macro bodies and initializers would have to be parsed again */
+    if (macros_idx != pch_macros_idx)
+        error("Macros cannot be kept in the libc image");
+    for (i = pch_global_ir_idx; i < global_ir_idx; i++) {
+        if (GLOBAL_IR[i].op != OP_allocat)
+            error("Initialized globals cannot be kept in the libc image");
+    }
+
+    base = FUNC_LIST.head->bbs->elf_offset;
+    for (fn = FUNC_LIST.head; fn; fn = fn->next) {
+        sym = &LIBC_SYMBOLS[libc_symbols_idx++];
+        strcpy(sym->name, fn->func->return_def.var_name);
+        if (fn->next)
+            end = fn->next->bbs->elf_offset;
+        else
+            end = elf_code_idx;
+        sym->offset = fn->bbs->elf_offset - base;
+        sym->size = end - fn->bbs->elf_offset;
+        sym->reloc_start = r;
+        while (r < libc_relocs_idx && LIBC_RELOCS[r].offset < end)
+            r++;
+        sym->reloc_count = r - sym->reloc_start;
+    }
+
+    fp = fopen(file, "wb");
+    file_write_int(fp, LIBC_IMAGE_MAGIC);
+    file_write_int(fp, ELF_MACHINE);
+    file_write_int(fp, libc_size());
+    file_write_int(fp, libc_hash());
+
+    file_write_int(fp, pch_types_idx);
+    file_write_int(fp, pch_aliases_idx);
+    file_write_int(fp, pch_macros_idx);
+    file_write_int(fp, pch_constants_idx);
+    file_write_int(fp, pch_funcs_idx);
+    file_write_int(fp, pch_symbols_idx);
+    file_write_int(fp, pch_next_local);
+    file_write_int(fp, pch_data_idx);
+    pch_write_defs(fp);
+
+    file_write_int(fp, GLOBAL_BLOCK->next_local - pch_next_local);
+    for (i = pch_next_local; i < GLOBAL_BLOCK->next_local; i++)
+        pch_write_var(fp, globals[i]);
+
+    file_write_int(fp, elf_data_idx - pch_data_idx);
+    for (i = pch_data_idx; i < elf_data_idx; i++)
+        fputc(elf_data[i], fp);
+
+    file_write_int(fp, elf_code_idx - base);
+    file_write_int(fp, libc_symbols_idx);
+    file_write_int(fp, libc_relocs_idx);
+
+    for (i = 0; i < libc_symbols_idx; i++) {
+        sym = &LIBC_SYMBOLS[i];
+        file_write_str(fp, sym->name, MAX_VAR_LEN);
+        file_write_int(fp, sym->offset);
+        file_write_int(fp, sym->size);
+        file_write_int(fp, sym->reloc_start);
+        file_write_int(fp, sym->reloc_count);
+    }
+    for (i = 0; i < libc_relocs_idx; i++) {
+        reloc = &LIBC_RELOCS[i];
+        file_write_int(fp, reloc->offset - base);
+        file_write_int(fp, reloc->op);
+        file_write_int(fp, reloc->src0);
+        file_write_int(fp, reloc->src1);
+        file_write_int(fp, reloc->dest);
+        file_write_str(fp, reloc->func_name, MAX_VAR_LEN);
+        file_write_int(fp, reloc->then_offset - base);
+        file_write_int(fp, reloc->else_offset - base);
+        file_write_int(fp, reloc->is_branch_detached);
+    }
+    for (i = base; i < elf_code_idx; i++)
+        fputc(elf_code[i], fp);
+    fclose(fp);
+}
+
+void libc_image_use(opcode_t op, char *func_name)
+{
+    func_t *func;
+
+    if (op != OP_call && op != OP_tail_call && op != OP_address_of_func)
+        return;
+
+    func = find_func(func_name);
+    if (func && func->fn && func->fn->prebuilt && !func->fn->prebuilt->used)
+        func->fn->prebuilt->used = 1;
+}
+
+/* Place the image functions reachable from the flattened program at
+ * elf_offset, in image order.
+ */
+void libc_image_layout()
+{
+    ph2_ir_t *ph2_ir;
+    libc_symbol_t *sym;
+    libc_reloc_t *reloc;
+    int pending = 1, i, j;
+
+    if (build_libc_image || !libc_symbols_idx)
+        return;
+
+    for (ph2_ir = GLOBAL_FUNC.fn->bbs->ph2_ir_list.head; ph2_ir;
+         ph2_ir = ph2_ir->next)
+        libc_image_use(ph2_ir->op, ph2_ir->func_name);
+    for (i = 0; i < ph2_ir_idx; i++)
+        libc_image_use(PH2_IR[i].op, PH2_IR[i].func_name);
+
+    /* 1: used, 2: its own references have been followed */
+    while (pending) {
+        pending = 0;
+        for (i = 0; i < libc_symbols_idx; i++) {
+            sym = &LIBC_SYMBOLS[i];
+            if (sym->used != 1)
+                continue;
+            sym->used = 2;
+            pending = 1;
+            for (j = 0; j < sym->reloc_count; j++) {
+                reloc = &LIBC_RELOCS[sym->reloc_start + j];
+                libc_image_use(reloc->op, reloc->func_name);
+            }
+        }
+    }
+
+    for (i = 0; i < libc_symbols_idx; i++) {
+        sym = &LIBC_SYMBOLS[i];
+        if (!sym->used)
+            continue;
+        sym->fn->bbs->elf_offset = elf_offset;
+        elf_offset += sym->size;
+    }
+}
+
+/* Append the laid out image functions to the code, emitting the relocated
+ * instructions again at their final position.
+ */
+void libc_image_emit()
+{
+    ph2_ir_t *ph2_ir;
+    basic_block_t *then_bb, *else_bb;
+    libc_symbol_t *sym;
+    libc_reloc_t *reloc;
+    int ofs, start, i, j;
+
+    if (build_libc_image || !libc_symbols_idx)
+        return;
+
+    ph2_ir = calloc(1, sizeof(ph2_ir_t));
+    then_bb = calloc(1, sizeof(basic_block_t));
+    else_bb = calloc(1, sizeof(basic_block_t));
+    ph2_ir->then_bb = then_bb;
+    ph2_ir->else_bb = else_bb;
+
+    for (i = 0; i < libc_symbols_idx; i++) {
+        sym = &LIBC_SYMBOLS[i];
+        if (!sym->used)
+            continue;
+
+        ofs = sym->offset;
+        for (j = 0; j < sym->reloc_count; j++) {
+            reloc = &LIBC_RELOCS[sym->reloc_start + j];
+            while (ofs < reloc->offset)
+                elf_code[elf_code_idx++] = libc_image_code[ofs++];
+
+            ph2_ir->op = reloc->op;
+            ph2_ir->src0 = reloc->src0;
+            ph2_ir->src1 = reloc->src1;
+            ph2_ir->dest = reloc->dest;
+            ph2_ir->func_name = reloc->func_name;
+            ph2_ir->is_branch_detached = reloc->is_branch_detached;
+            then_bb->elf_offset =
+                sym->fn->bbs->elf_offset + reloc->then_offset - sym->offset;
+            else_bb->elf_offset =
+                sym->fn->bbs->elf_offset + reloc->else_offset - sym->offset;
+
+            start = elf_code_idx;
+            emit_ph2_ir(ph2_ir);
+            ofs += elf_code_idx - start;
+        }
+        while (ofs < sym->offset + sym->size)
+            elf_code[elf_code_idx++] = libc_image_code[ofs++];
+    }
+
+    free(ph2_ir);
+    free(then_bb);
+    free(else_bb);
+}
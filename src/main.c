@@ -24,6 +24,9 @@
 /* C language lexical analyzer */
 #include "lexer.c"
 
+/* Precompiled headers */
+#include "pch.c"
+
 /* C language syntactic analyzer */
 #include "parser.c"
 
@@ -36,6 +39,9 @@
 /* Peephole optimization */
 #include "peephole.c"
 
+/* Prebuilt libc image */
+#include "libc-image.c"
+
 /* Machine code generation. support ARMv7-A and RISC-V32I */
 #include "codegen.c"
 
@@ -45,7 +51,7 @@
 int main(int argc, char *argv[])
 {
     int libc = 1;
-    char *out = NULL, *in = NULL;
+    char *out = NULL, *in = NULL, *libc_image = NULL;
     int i;
 
     for (i = 1; i < argc; i++) {
@@ -53,8 +59,20 @@ int main(int argc, char *argv[])
             dump_ir = 1;
         else if (!strcmp(argv[i], "--no-libc"))
             libc = 0;
-        else if (!strcmp(argv[i], "-o")) {
-            if (i < argc + 1) {
+        else if (!strcmp(argv[i], "--pch"))
+            use_pch = 1;
+        else if (!strcmp(argv[i], "--emit-pch"))
+            emit_pch = 1;
+        else if (!strcmp(argv[i], "--build-libc-image"))
+            build_libc_image = 1;
+        else if (!strcmp(argv[i], "--libc-image")) {
+            if (i + 1 < argc) {
+                libc_image = argv[i + 1];
+                i++;
+            } else
+                abort();
+        } else if (!strcmp(argv[i], "-o")) {
+            if (i + 1 < argc) {
                 out = argv[i + 1];
                 i++;
             } else
@@ -64,22 +82,40 @@ int main(int argc, char *argv[])
             in = argv[i];
     }
 
-    if (!in) {
+    if (build_libc_image && (in || !out || !libc || libc_image)) {
+        printf("Usage: shecc --build-libc-image -o <image>\n");
+        return -1;
+    }
+
+    if (emit_pch && (!in || !out)) {
+        printf("Usage: shecc --emit-pch -o <header.h.pch> <header.h>\n");
+        return -1;
+    }
+
+    if (!in && !build_libc_image) {
         printf("Missing source file!\n");
-        printf("Usage: shecc [-o output] [--dump-ir] [--no-libc] <input.c>\n");
+        printf("Usage: shecc [-o output] [--dump-ir] [--no-libc] ");
+        printf("[--libc-image <image>] [--pch] <input.c>\n");
         return -1;
     }
 
     /* initialize global objects */
     global_init();
 
-    /* include libc */
-    if (libc)
+    /* include libc, unless it is restored from a matching prebuilt image */
+    if (libc && !libc_image_open(libc_image))
         libc_generate();
 
     /* load and parse source code into IR */
     parse(in);
 
+    /* a precompiled header needs nothing beyond parsing */
+    if (emit_pch) {
+        pch_write(out);
+        global_release();
+        exit(0);
+    }
+
     /* dump first phase IR */
     if (dump_ir)
         dump_ph1_ir();
@@ -89,12 +125,18 @@ int main(int argc, char *argv[])
     /* SSA-based optimization */
     optimize();
 
+    /* lower the phis into copies in their predecessors */
+    unwind_phi();
+
     /* SSA-based liveness analyses */
     liveness_analysis();
 
     /* allocate register from IR */
     reg_alloc();
 
+    /* release the first phase IR */
+    ssa_release();
+
     peephole();
 
     /* flatten CFG to linear instruction */
@@ -107,11 +149,13 @@ int main(int argc, char *argv[])
     /* generate code from IR */
     code_generate();
 
-    /* output code in ELF */
-    elf_generate(out);
+    /* output code in ELF, or the code of libc alone */
+    if (build_libc_image)
+        libc_image_write(out);
+    else
+        elf_generate(out);
 
     /* release allocated objects */
-    ssa_release();
     global_release();
 
     exit(0);
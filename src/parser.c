@@ -22,17 +22,47 @@ char *gen_label()
     return global_str_buf;
 }
 
+/* Double the local table of @blk, the variables are kept where they are */
+void grow_locals(block_t *blk)
+{
+    var_t **locals, **old_locals = blk->locals;
+    int i;
+
+    blk->locals_capacity = blk->locals_capacity ? blk->locals_capacity * 2 : 8;
+    locals = arena_alloc(BLOCK_ARENA, blk->locals_capacity * HOST_PTR_SIZE);
+    for (i = 0; i < blk->next_local; i++)
+        locals[i] = old_locals[i];
+    blk->locals = locals;
+}
+
 var_t *require_var(block_t *blk)
 {
-    if (blk->next_local >= MAX_LOCALS)
-        error("Too many locals");
+    var_t **locals;
+
+    if (blk->next_local >= blk->locals_capacity)
+        grow_locals(blk);
 
-    var_t *var = &blk->locals[blk->next_local++];
+    /* a slot given back by release_var() keeps its variable */
+    locals = blk->locals;
+    if (!locals[blk->next_local])
+        locals[blk->next_local] = arena_alloc(BLOCK_ARENA, sizeof(var_t));
+
+    var_t *var = locals[blk->next_local++];
+    var->type_name = "";
+    var->var_name = "";
     var->consumed = -1;
     var->base = var;
     return var;
 }
 
+/* Give back the most recently required slot of @blk */
+void release_var(block_t *blk)
+{
+    blk->next_local--;
+    if (blk->indexed_locals > blk->next_local)
+        blk->indexed_locals = blk->next_local;
+}
+
 /* stack of the operands of 3AC */
 var_t *operand_stack[MAX_OPERAND_STACK_SIZE];
 int operand_stack_idx = 0;
@@ -329,7 +359,6 @@ void cppd_control_flow_skip_lines()
            !lex_peek(T_cppd_endif, NULL)) {
         next_token = lex_token();
     }
-    skip_whitespace();
 }
 
 void check_def(char *alias)
@@ -392,17 +421,16 @@ int read_preproc_directive()
         } else if (lex_accept(T_open_bracket)) { /* function-like macro */
             macro_t *macro = add_macro(alias);
 
-            skip_newline = 0;
             while (lex_peek(T_identifier, alias)) {
                 lex_expect(T_identifier);
-                strcpy(macro->param_defs[macro->num_param_defs++].var_name,
-                       alias);
+                macro->param_defs[macro->num_param_defs++].var_name =
+                    intern_name(alias);
                 lex_accept(T_comma);
             }
             if (lex_accept(T_elipsis))
                 macro->is_variadic = 1;
 
-            macro->start_source_idx = source_idx;
+            macro->start_token_idx = token_idx;
             skip_macro_body();
         }
 
@@ -423,9 +451,12 @@ int read_preproc_directive()
         int i = 0;
         char error_diagnostic[MAX_LINE_LEN];
 
-        do {
-            error_diagnostic[i++] = next_char;
-        } while (read_char(0) != '\n');
+        /* the diagnostic is the rest of the directive line */
+        source_idx += 6; /* strlen("#error") */
+        while (is_whitespace(SOURCE[source_idx]))
+            source_idx++;
+        while (SOURCE[source_idx] && !is_newline(SOURCE[source_idx]))
+            error_diagnostic[i++] = SOURCE[source_idx++];
         error_diagnostic[i] = 0;
 
         error(error_diagnostic);
@@ -433,11 +464,8 @@ int read_preproc_directive()
     if (lex_accept(T_cppd_if)) {
         preproc_match = read_constant_expr() != 0;
 
-        if (preproc_match) {
-            skip_whitespace();
-        } else {
+        if (!preproc_match)
             cppd_control_flow_skip_lines();
-        }
 
         return 1;
     }
@@ -451,11 +479,8 @@ int read_preproc_directive()
 
         preproc_match = read_constant_expr() != 0;
 
-        if (preproc_match) {
-            skip_whitespace();
-        } else {
+        if (!preproc_match)
             cppd_control_flow_skip_lines();
-        }
 
         return 1;
     }
@@ -464,17 +489,14 @@ int read_preproc_directive()
          * 1. reach #ifdef preprocessor directive
          * 2. conditional expression in #elif is false
          */
-        if (!preproc_match) {
-            skip_whitespace();
+        if (!preproc_match)
             return 1;
-        }
 
         cppd_control_flow_skip_lines();
         return 1;
     }
     if (lex_accept(T_cppd_endif)) {
         preproc_match = 0;
-        skip_whitespace();
         return 1;
     }
     if (lex_accept_internal(T_cppd_ifdef, 0)) {
@@ -482,24 +504,48 @@ int read_preproc_directive()
         lex_ident(T_identifier, token);
         check_def(token);
 
-        if (preproc_match) {
-            skip_whitespace();
+        if (preproc_match)
             return 1;
-        }
 
         cppd_control_flow_skip_lines();
         return 1;
     }
+    if (lex_accept_internal(T_cppd_ifndef, 0)) {
+        preproc_match = 0;
+        lex_ident(T_identifier, token);
+        check_def(token);
+        preproc_match = !preproc_match;
+
+        if (preproc_match)
+            return 1;
+
+        cppd_control_flow_skip_lines();
+        return 1;
+    }
+    if (lex_peek(T_cppd_pragma, NULL)) {
+        /* `#pragma once` is handled when the file is loaded */
+        skip_macro_body();
+        return 1;
+    }
 
     return 0;
 }
 
 void read_parameter_list_decl(func_t *fd, int anon);
 
+/* Strictly match an identifier and return its stored name */
+char *lex_ident_name()
+{
+    char name[MAX_VAR_LEN];
+    lex_ident(T_identifier, name);
+    return intern_name(name);
+}
+
 void read_inner_var_decl(var_t *vd, int anon, int is_param)
 {
     vd->init_val = 0;
     vd->is_ptr = 0;
+    vd->var_name = "";
 
     while (lex_accept(T_asterisk))
         vd->is_ptr++;
@@ -508,13 +554,13 @@ void read_inner_var_decl(var_t *vd, int anon, int is_param)
     if (lex_accept(T_open_bracket)) {
         func_t func;
         lex_expect(T_asterisk);
-        lex_ident(T_identifier, vd->var_name);
+        vd->var_name = lex_ident_name();
         lex_expect(T_close_bracket);
         read_parameter_list_decl(&func, 1);
         vd->is_func = 1;
     } else {
         if (anon == 0) {
-            lex_ident(T_identifier, vd->var_name);
+            vd->var_name = lex_ident_name();
             if (!lex_peek(T_open_bracket, NULL) && !is_param) {
                 if (vd->is_global) {
                     ph1_ir_t *ir = add_global_ir(OP_allocat);
@@ -552,14 +598,14 @@ void read_inner_var_decl(var_t *vd, int anon, int is_param)
 void read_full_var_decl(var_t *vd, int anon, int is_param)
 {
     lex_accept(T_struct); /* ignore struct definition */
-    lex_ident(T_identifier, vd->type_name);
+    vd->type_name = lex_ident_name();
     read_inner_var_decl(vd, anon, is_param);
 }
 
 /* starting next_token, need to check the type */
 void read_partial_var_decl(var_t *vd, var_t *template)
 {
-    strcpy(vd->type_name, template->type_name);
+    vd->type_name = template->type_name;
     read_inner_var_decl(vd, 0, 0);
 }
 
@@ -592,7 +638,7 @@ void read_literal_param(block_t *parent, basic_block_t *bb)
 
     ph1_ir = add_ph1_ir(OP_load_data_address);
     vd = require_var(parent);
-    strcpy(vd->var_name, gen_name());
+    vd->var_name = intern_name(gen_name());
     vd->init_val = index;
     ph1_ir->dest = vd;
     opstack_push(vd);
@@ -644,7 +690,7 @@ void read_numeric_param(block_t *parent, basic_block_t *bb, int is_neg)
     ph1_ir = add_ph1_ir(OP_load_constant);
     vd = require_var(parent);
     vd->init_val = value;
-    strcpy(vd->var_name, gen_name());
+    vd->var_name = intern_name(gen_name());
     ph1_ir->dest = vd;
     opstack_push(vd);
     add_insn(parent, bb, OP_load_constant, ph1_ir->dest, NULL, NULL, 0, NULL);
@@ -661,7 +707,7 @@ void read_char_param(block_t *parent, basic_block_t *bb)
     ph1_ir = add_ph1_ir(OP_load_constant);
     vd = require_var(parent);
     vd->init_val = token[0];
-    strcpy(vd->var_name, gen_name());
+    vd->var_name = intern_name(gen_name());
     ph1_ir->dest = vd;
     opstack_push(vd);
     add_insn(parent, bb, OP_load_constant, ph1_ir->dest, NULL, NULL, 0, NULL);
@@ -701,7 +747,7 @@ void read_func_call(func_t *fn, block_t *parent, basic_block_t **bb)
 
     ph1_ir = add_ph1_ir(OP_call);
     ph1_ir->param_num = fn->num_params;
-    strcpy(ph1_ir->func_name, fn->return_def.var_name);
+    ph1_ir->func_name = fn->return_def.var_name;
     add_insn(parent, *bb, OP_call, NULL, NULL, NULL, 0,
              fn->return_def.var_name);
 }
@@ -757,7 +803,7 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
         ph1_ir = add_ph1_ir(OP_log_not);
         ph1_ir->src0 = opstack_pop();
         vd = require_var(parent);
-        strcpy(vd->var_name, gen_name());
+        vd->var_name = intern_name(gen_name());
         ph1_ir->dest = vd;
         opstack_push(vd);
         add_insn(parent, *bb, OP_log_not, ph1_ir->dest, ph1_ir->src0, NULL, 0,
@@ -768,7 +814,7 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
         ph1_ir = add_ph1_ir(OP_bit_not);
         ph1_ir->src0 = opstack_pop();
         vd = require_var(parent);
-        strcpy(vd->var_name, gen_name());
+        vd->var_name = intern_name(gen_name());
         ph1_ir->dest = vd;
         opstack_push(vd);
         add_insn(parent, *bb, OP_bit_not, ph1_ir->dest, ph1_ir->src0, NULL, 0,
@@ -786,7 +832,7 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
             ph1_ir = add_ph1_ir(OP_address_of);
             ph1_ir->src0 = opstack_pop();
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = vd;
             opstack_push(vd);
             add_insn(parent, *bb, OP_address_of, ph1_ir->dest, ph1_ir->src0,
@@ -812,7 +858,7 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
             ph1_ir->size = PTR_SIZE;
         else
             ph1_ir->size = lvalue.type->size;
-        strcpy(vd->var_name, gen_name());
+        vd->var_name = intern_name(gen_name());
         ph1_ir->dest = vd;
         opstack_push(vd);
         add_insn(parent, *bb, OP_read, ph1_ir->dest, ph1_ir->src0, ph1_ir->src1,
@@ -836,7 +882,7 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
         ph1_ir = add_ph1_ir(OP_load_constant);
         vd = require_var(parent);
         vd->init_val = type->size;
-        strcpy(vd->var_name, gen_name());
+        vd->var_name = intern_name(gen_name());
         ph1_ir->dest = vd;
         opstack_push(vd);
         lex_expect(T_close_bracket);
@@ -863,12 +909,12 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
         con = find_constant(token);
         var = find_var(token, parent);
         fn = find_func(token);
-        macro_param_idx = find_macro_param_src_idx(token, parent);
+        macro_param_idx = find_macro_param_token_idx(token, parent);
         mac = find_macro(token);
 
         if (!strcmp(token, "__VA_ARGS__")) {
-            /* `source_idx` has pointed at the character after __VA_ARGS__ */
-            int i, remainder, t = source_idx;
+            /* `token_idx` has pointed at the token after __VA_ARGS__ */
+            int i, remainder, t = token_idx;
             macro_t *macro = parent->macro;
 
             if (!macro)
@@ -878,13 +924,11 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
 
             remainder = macro->num_params - macro->num_param_defs;
             for (i = 0; i < remainder; i++) {
-                source_idx = macro->params[macro->num_params - remainder + i];
-                next_char = SOURCE[source_idx];
+                token_idx = macro->params[macro->num_params - remainder + i];
                 next_token = lex_token();
                 read_expr(parent, bb);
             }
-            source_idx = t;
-            next_char = SOURCE[source_idx];
+            token_idx = t;
             next_token = lex_token();
         } else if (mac) {
             if (parent->macro)
@@ -894,42 +938,37 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
             mac->num_params = 0;
             lex_expect(T_identifier);
 
-            /* `source_idx` has pointed at the first parameter */
+            /* `token_idx` has pointed at the first parameter */
             while (!lex_peek(T_close_bracket, NULL)) {
-                mac->params[mac->num_params++] = source_idx;
+                mac->params[mac->num_params++] = token_idx;
                 do {
                     next_token = lex_token();
                 } while (next_token != T_comma &&
                          next_token != T_close_bracket);
             }
-            /* move `source_idx` to the macro body */
-            macro_return_idx = source_idx;
-            source_idx = mac->start_source_idx;
-            next_char = SOURCE[source_idx];
+            /* move `token_idx` to the macro body */
+            macro_return_idx = token_idx;
+            token_idx = mac->start_token_idx;
             lex_expect(T_close_bracket);
 
-            skip_newline = 0;
             read_expr(parent, bb);
 
             /* cleanup */
-            skip_newline = 1;
             parent->macro = NULL;
             macro_return_idx = 0;
         } else if (macro_param_idx) {
             /* "expand" the argument from where it comes from */
-            int t = source_idx;
-            source_idx = macro_param_idx;
-            next_char = SOURCE[source_idx];
+            int t = token_idx;
+            token_idx = macro_param_idx;
             next_token = lex_token();
             read_expr(parent, bb);
-            source_idx = t;
-            next_char = SOURCE[source_idx];
+            token_idx = t;
             next_token = lex_token();
         } else if (con) {
             ph1_ir = add_ph1_ir(OP_load_constant);
             vd = require_var(parent);
             vd->init_val = con->value;
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = vd;
             opstack_push(vd);
             lex_expect(T_identifier);
@@ -946,7 +985,7 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
 
                 ph1_ir = add_ph1_ir(OP_func_ret);
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 opstack_push(vd);
                 add_insn(parent, *bb, OP_func_ret, ph1_ir->dest, NULL, NULL, 0,
@@ -960,7 +999,7 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
 
                 ph1_ir = add_ph1_ir(OP_func_ret);
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 opstack_push(vd);
                 add_insn(parent, *bb, OP_func_ret, ph1_ir->dest, NULL, NULL, 0,
@@ -969,7 +1008,7 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
                 /* indirective function pointer assignment */
                 vd = require_var(parent);
                 vd->is_func = 1;
-                strcpy(vd->var_name, token);
+                vd->var_name = intern_name(token);
                 opstack_push(vd);
             }
         } else {
@@ -982,7 +1021,7 @@ void read_expr_operand(block_t *parent, basic_block_t **bb)
             ph1_ir = add_ph1_ir(OP_negate);
             ph1_ir->src0 = opstack_pop();
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = vd;
             opstack_push(vd);
             add_insn(parent, *bb, OP_negate, ph1_ir->dest, ph1_ir->src0, NULL,
@@ -1019,7 +1058,7 @@ void read_expr(block_t *parent, basic_block_t **bb)
                     ph1_ir->src1 = opstack_pop();
                     ph1_ir->src0 = opstack_pop();
                     vd = require_var(parent);
-                    strcpy(vd->var_name, gen_name());
+                    vd->var_name = intern_name(gen_name());
                     ph1_ir->dest = vd;
                     opstack_push(vd);
                     add_insn(parent, *bb, ph1_ir->op, ph1_ir->dest,
@@ -1040,7 +1079,7 @@ void read_expr(block_t *parent, basic_block_t **bb)
         ph1_ir->src1 = opstack_pop();
         ph1_ir->src0 = opstack_pop();
         vd = require_var(parent);
-        strcpy(vd->var_name, gen_name());
+        vd->var_name = intern_name(gen_name());
         ph1_ir->dest = vd;
         opstack_push(vd);
         add_insn(parent, *bb, ph1_ir->op, ph1_ir->dest, ph1_ir->src0,
@@ -1065,6 +1104,7 @@ void read_lvalue(lvalue_t *lvalue,
     var_t *vd;
     int is_address_got = 0;
     int is_member = 0;
+    int subscripts = 0; /* applied to `var` */
 
     /* already peeked and have the variable */
     lex_expect(T_identifier);
@@ -1099,7 +1139,7 @@ void read_lvalue(lvalue_t *lvalue,
                 ph1_ir = add_ph1_ir(OP_load_constant);
                 vd = require_var(parent);
                 vd->init_val = lvalue->size;
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 opstack_push(vd);
                 add_insn(parent, *bb, OP_load_constant, ph1_ir->dest, NULL,
@@ -1109,7 +1149,7 @@ void read_lvalue(lvalue_t *lvalue,
                 ph1_ir->src1 = opstack_pop();
                 ph1_ir->src0 = opstack_pop();
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 opstack_push(vd);
                 add_insn(parent, *bb, OP_mul, ph1_ir->dest, ph1_ir->src0,
@@ -1120,7 +1160,7 @@ void read_lvalue(lvalue_t *lvalue,
             ph1_ir->src1 = opstack_pop();
             ph1_ir->src0 = opstack_pop();
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = vd;
             opstack_push(vd);
             add_insn(parent, *bb, OP_add, ph1_ir->dest, ph1_ir->src0,
@@ -1130,6 +1170,7 @@ void read_lvalue(lvalue_t *lvalue,
             is_address_got = 1;
             is_member = 1;
             lvalue->is_reference = 1;
+            subscripts++;
         } else {
             char token[MAX_ID_LEN];
 
@@ -1141,7 +1182,7 @@ void read_lvalue(lvalue_t *lvalue,
                     ph1_ir = add_ph1_ir(OP_read);
                     ph1_ir->src0 = opstack_pop();
                     vd = require_var(parent);
-                    strcpy(vd->var_name, gen_name());
+                    vd->var_name = intern_name(gen_name());
                     ph1_ir->dest = vd;
                     opstack_push(vd);
                     ph1_ir->size = 4;
@@ -1155,7 +1196,7 @@ void read_lvalue(lvalue_t *lvalue,
                     ph1_ir = add_ph1_ir(OP_address_of);
                     ph1_ir->src0 = opstack_pop();
                     vd = require_var(parent);
-                    strcpy(vd->var_name, gen_name());
+                    vd->var_name = intern_name(gen_name());
                     ph1_ir->dest = vd;
                     opstack_push(vd);
                     add_insn(parent, *bb, OP_address_of, ph1_ir->dest,
@@ -1169,6 +1210,7 @@ void read_lvalue(lvalue_t *lvalue,
 
             /* change type currently pointed to */
             var = find_member(token, lvalue->type);
+            subscripts = 0;
             lvalue->type = find_type(var->type_name, 0);
             lvalue->is_ptr = var->is_ptr;
             lvalue->is_func = var->is_func;
@@ -1183,7 +1225,7 @@ void read_lvalue(lvalue_t *lvalue,
             /* move pointer to offset of structure */
             ph1_ir = add_ph1_ir(OP_load_constant);
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             vd->init_val = var->offset;
             ph1_ir->dest = vd;
             opstack_push(vd);
@@ -1194,7 +1236,7 @@ void read_lvalue(lvalue_t *lvalue,
             ph1_ir->src1 = opstack_pop();
             ph1_ir->src0 = opstack_pop();
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = vd;
             opstack_push(vd);
             add_insn(parent, *bb, OP_add, ph1_ir->dest, ph1_ir->src0,
@@ -1208,15 +1250,17 @@ void read_lvalue(lvalue_t *lvalue,
     if (!eval)
         return;
 
-    if (lex_peek(T_plus, NULL) && (var->is_ptr || var->array_size)) {
-        while (lex_peek(T_plus, NULL) && (var->is_ptr || var->array_size)) {
+    /* an element is only a pointer if not every level has been subscripted */
+    if (lex_peek(T_plus, NULL) &&
+        var->is_ptr + (var->array_size > 0) > subscripts) {
+        while (lex_peek(T_plus, NULL)) {
             lex_expect(T_plus);
             if (lvalue->is_reference) {
                 ph1_ir = add_ph1_ir(OP_read);
                 ph1_ir->src0 = opstack_pop();
                 vd = require_var(parent);
                 ph1_ir->size = lvalue->size;
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 opstack_push(vd);
                 add_insn(parent, *bb, OP_read, ph1_ir->dest, ph1_ir->src0, NULL,
@@ -1230,7 +1274,7 @@ void read_lvalue(lvalue_t *lvalue,
             if (lvalue->size > 1) {
                 ph1_ir = add_ph1_ir(OP_load_constant);
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 vd->init_val = lvalue->size;
                 ph1_ir->dest = vd;
                 opstack_push(vd);
@@ -1241,7 +1285,7 @@ void read_lvalue(lvalue_t *lvalue,
                 ph1_ir->src1 = opstack_pop();
                 ph1_ir->src0 = opstack_pop();
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 opstack_push(vd);
                 add_insn(parent, *bb, OP_mul, ph1_ir->dest, ph1_ir->src0,
@@ -1252,7 +1296,7 @@ void read_lvalue(lvalue_t *lvalue,
             ph1_ir->src1 = opstack_pop();
             ph1_ir->src0 = opstack_pop();
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = vd;
             opstack_push(vd);
             add_insn(parent, *bb, OP_add, ph1_ir->dest, ph1_ir->src0,
@@ -1270,7 +1314,7 @@ void read_lvalue(lvalue_t *lvalue,
             ph1_ir->src0 = operand_stack[operand_stack_idx - 1];
             t = require_var(parent);
             ph1_ir->size = lvalue->size;
-            strcpy(t->var_name, gen_name());
+            t->var_name = intern_name(gen_name());
             ph1_ir->dest = t;
             opstack_push(t);
             add_insn(parent, *bb, OP_read, ph1_ir->dest, ph1_ir->src0, NULL,
@@ -1279,7 +1323,7 @@ void read_lvalue(lvalue_t *lvalue,
         if (prefix_op != OP_generic) {
             ph1_ir = add_ph1_ir(OP_load_constant);
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             vd->init_val = 1;
             ph1_ir->dest = vd;
             opstack_push(vd);
@@ -1293,7 +1337,7 @@ void read_lvalue(lvalue_t *lvalue,
             else
                 ph1_ir->src0 = operand_stack[operand_stack_idx - 1];
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = vd;
             add_insn(parent, *bb, ph1_ir->op, ph1_ir->dest, ph1_ir->src0,
                      ph1_ir->src1, 0, NULL);
@@ -1317,7 +1361,7 @@ void read_lvalue(lvalue_t *lvalue,
         } else if (lex_peek(T_increment, NULL) || lex_peek(T_decrement, NULL)) {
             side_effect[se_idx].op = OP_load_constant;
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             vd->init_val = 1;
             side_effect[se_idx].dest = vd;
             side_effect[se_idx].src0 = NULL;
@@ -1331,7 +1375,7 @@ void read_lvalue(lvalue_t *lvalue,
             else
                 side_effect[se_idx].src0 = operand_stack[operand_stack_idx - 1];
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             side_effect[se_idx].dest = vd;
             se_idx++;
 
@@ -1379,10 +1423,10 @@ void read_ternary_operation(block_t *parent, basic_block_t **bb)
     ph1_ir = add_ph1_ir(OP_branch);
     ph1_ir->dest = opstack_pop();
     vd = require_var(parent);
-    strcpy(vd->var_name, true_label);
+    vd->var_name = intern_name(true_label);
     ph1_ir->src0 = vd;
     vd = require_var(parent);
-    strcpy(vd->var_name, false_label);
+    vd->var_name = intern_name(false_label);
     ph1_ir->src1 = vd;
     add_insn(parent, *bb, OP_branch, NULL, ph1_ir->dest, NULL, 0, NULL);
 
@@ -1395,7 +1439,7 @@ void read_ternary_operation(block_t *parent, basic_block_t **bb)
     /* true branch */
     ph1_ir = add_ph1_ir(OP_label);
     vd = require_var(parent);
-    strcpy(vd->var_name, true_label);
+    vd->var_name = intern_name(true_label);
     ph1_ir->src0 = vd;
 
     read_expr(parent, &then_);
@@ -1409,7 +1453,7 @@ void read_ternary_operation(block_t *parent, basic_block_t **bb)
     ph1_ir = add_ph1_ir(OP_assign);
     ph1_ir->src0 = opstack_pop();
     var = require_var(parent);
-    strcpy(var->var_name, gen_name());
+    var->var_name = intern_name(gen_name());
     ph1_ir->dest = var;
     add_insn(parent, then_, OP_assign, ph1_ir->dest, ph1_ir->src0, NULL, 0,
              NULL);
@@ -1417,13 +1461,13 @@ void read_ternary_operation(block_t *parent, basic_block_t **bb)
     /* jump true branch to end of expression */
     ph1_ir = add_ph1_ir(OP_jump);
     vd = require_var(parent);
-    strcpy(vd->var_name, end_label);
+    vd->var_name = intern_name(end_label);
     ph1_ir->dest = vd;
 
     /* false branch */
     ph1_ir = add_ph1_ir(OP_label);
     vd = require_var(parent);
-    strcpy(vd->var_name, false_label);
+    vd->var_name = intern_name(false_label);
     ph1_ir->src0 = vd;
 
     read_expr(parent, &else_);
@@ -1437,7 +1481,7 @@ void read_ternary_operation(block_t *parent, basic_block_t **bb)
 
     ph1_ir = add_ph1_ir(OP_label);
     vd = require_var(parent);
-    strcpy(vd->var_name, end_label);
+    vd->var_name = intern_name(end_label);
     ph1_ir->src0 = vd;
 
     var->is_ternary_ret = 1;
@@ -1485,7 +1529,7 @@ int read_body_assignment(char *token,
             ph1_ir->src0 = opstack_pop();
             ph1_ir->size = PTR_SIZE;
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = vd;
             opstack_push(vd);
             add_insn(parent, *bb, OP_read, ph1_ir->dest, ph1_ir->src0, NULL,
@@ -1519,7 +1563,7 @@ int read_body_assignment(char *token,
                     ph1_ir->src0 = t;
                     ph1_ir->size = lvalue.size;
                     vd = require_var(parent);
-                    strcpy(vd->var_name, gen_name());
+                    vd->var_name = intern_name(gen_name());
                     ph1_ir->dest = vd;
                     opstack_push(vd);
                     add_insn(parent, *bb, OP_read, ph1_ir->dest, ph1_ir->src0,
@@ -1529,7 +1573,7 @@ int read_body_assignment(char *token,
 
                 ph1_ir = add_ph1_ir(OP_load_constant);
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 vd->init_val = increment_size;
                 ph1_ir->dest = vd;
                 add_insn(parent, *bb, OP_load_constant, ph1_ir->dest, NULL,
@@ -1539,7 +1583,7 @@ int read_body_assignment(char *token,
                 ph1_ir->src1 = vd;
                 ph1_ir->src0 = opstack_pop();
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 add_insn(parent, *bb, ph1_ir->op, ph1_ir->dest, ph1_ir->src0,
                          ph1_ir->src1, 0, NULL);
@@ -1565,7 +1609,7 @@ int read_body_assignment(char *token,
                     ph1_ir->src0 = t;
                     vd = require_var(parent);
                     ph1_ir->size = lvalue.size;
-                    strcpy(vd->var_name, gen_name());
+                    vd->var_name = intern_name(gen_name());
                     ph1_ir->dest = vd;
                     opstack_push(vd);
                     add_insn(parent, *bb, OP_read, ph1_ir->dest, ph1_ir->src0,
@@ -1578,7 +1622,7 @@ int read_body_assignment(char *token,
                 ph1_ir = add_ph1_ir(OP_load_constant);
                 vd = require_var(parent);
                 vd->init_val = increment_size;
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 opstack_push(vd);
                 add_insn(parent, *bb, OP_load_constant, ph1_ir->dest, NULL,
@@ -1588,7 +1632,7 @@ int read_body_assignment(char *token,
                 ph1_ir->src1 = opstack_pop();
                 ph1_ir->src0 = opstack_pop();
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 opstack_push(vd);
                 add_insn(parent, *bb, OP_mul, ph1_ir->dest, ph1_ir->src0,
@@ -1598,7 +1642,7 @@ int read_body_assignment(char *token,
                 ph1_ir->src1 = opstack_pop();
                 ph1_ir->src0 = opstack_pop();
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 add_insn(parent, *bb, op, ph1_ir->dest, ph1_ir->src0,
                          ph1_ir->src1, 0, NULL);
@@ -1739,7 +1783,7 @@ int read_global_assignment(char *token)
 {
     ph1_ir_t *ph1_ir;
     var_t *vd;
-    block_t *parent = &BLOCKS[0];
+    block_t *parent = GLOBAL_BLOCK;
 
     /* global initialization must be constant */
     var_t *var = find_global_var(token);
@@ -1755,7 +1799,7 @@ int read_global_assignment(char *token)
         if (op == OP_generic) {
             ph1_ir = add_global_ir(OP_load_constant);
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             vd->init_val = operand1;
             ph1_ir->dest = vd;
             add_insn(parent, GLOBAL_FUNC.fn->bbs, OP_load_constant,
@@ -1764,7 +1808,7 @@ int read_global_assignment(char *token)
             ph1_ir = add_global_ir(OP_assign);
             ph1_ir->src0 = vd;
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = opstack_pop();
             add_insn(parent, GLOBAL_FUNC.fn->bbs, OP_assign, ph1_ir->dest,
                      ph1_ir->src0, NULL, 0, NULL);
@@ -1781,7 +1825,7 @@ int read_global_assignment(char *token)
             /* only two operands, apply and return */
             ph1_ir = add_global_ir(OP_load_constant);
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             vd->init_val = eval_expression_imm(op, operand1, operand2);
             ph1_ir->dest = vd;
             add_insn(parent, GLOBAL_FUNC.fn->bbs, OP_load_constant,
@@ -1790,7 +1834,7 @@ int read_global_assignment(char *token)
             ph1_ir = add_global_ir(OP_assign);
             ph1_ir->src0 = vd;
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = opstack_pop();
             add_insn(parent, GLOBAL_FUNC.fn->bbs, OP_assign, ph1_ir->dest,
                      ph1_ir->src0, NULL, 0, NULL);
@@ -1859,7 +1903,7 @@ int read_global_assignment(char *token)
                 } else {
                     ph1_ir = add_global_ir(OP_load_constant);
                     vd = require_var(parent);
-                    strcpy(vd->var_name, gen_name());
+                    vd->var_name = intern_name(gen_name());
                     vd->init_val = val_stack[0];
                     ph1_ir->dest = vd;
                     add_insn(parent, GLOBAL_FUNC.fn->bbs, OP_load_constant,
@@ -1868,7 +1912,7 @@ int read_global_assignment(char *token)
                     ph1_ir = add_global_ir(OP_assign);
                     ph1_ir->src0 = vd;
                     vd = require_var(parent);
-                    strcpy(vd->var_name, gen_name());
+                    vd->var_name = intern_name(gen_name());
                     ph1_ir->dest = opstack_pop();
                     add_insn(parent, GLOBAL_FUNC.fn->bbs, OP_assign,
                              ph1_ir->dest, ph1_ir->src0, NULL, 0, NULL);
@@ -1885,7 +1929,7 @@ int read_global_assignment(char *token)
         } else {
             ph1_ir = add_global_ir(OP_load_constant);
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             vd->init_val = val_stack[0];
             ph1_ir->dest = vd;
             add_insn(parent, GLOBAL_FUNC.fn->bbs, OP_load_constant,
@@ -1894,7 +1938,7 @@ int read_global_assignment(char *token)
             ph1_ir = add_global_ir(OP_assign);
             ph1_ir->src0 = vd;
             vd = require_var(parent);
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = opstack_pop();
             add_insn(parent, GLOBAL_FUNC.fn->bbs, OP_assign, ph1_ir->dest,
                      ph1_ir->src0, NULL, 0, NULL);
@@ -1992,17 +2036,17 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
         ph1_ir = add_ph1_ir(OP_branch);
         ph1_ir->dest = opstack_pop();
         vd = require_var(parent);
-        strcpy(vd->var_name, label_true);
+        vd->var_name = intern_name(label_true);
         ph1_ir->src0 = vd;
         vd = require_var(parent);
-        strcpy(vd->var_name, label_false);
+        vd->var_name = intern_name(label_false);
         ph1_ir->src1 = vd;
         /* argument column is different with ph1_ir */
         add_insn(parent, bb, OP_branch, NULL, ph1_ir->dest, NULL, 0, NULL);
 
         ph1_ir = add_ph1_ir(OP_label);
         vd = require_var(parent);
-        strcpy(vd->var_name, label_true);
+        vd->var_name = intern_name(label_true);
         ph1_ir->src0 = vd;
 
         basic_block_t *then_ = bb_create(parent);
@@ -2021,13 +2065,13 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
             /* jump true branch to finish */
             ph1_ir = add_ph1_ir(OP_jump);
             vd = require_var(parent);
-            strcpy(vd->var_name, label_endif);
+            vd->var_name = intern_name(label_endif);
             ph1_ir->dest = vd;
 
             /* false branch */
             ph1_ir = add_ph1_ir(OP_label);
             vd = require_var(parent);
-            strcpy(vd->var_name, label_false);
+            vd->var_name = intern_name(label_false);
             ph1_ir->src0 = vd;
 
             basic_block_t *else_body = read_body_statement(parent, else_);
@@ -2039,7 +2083,7 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
 
             ph1_ir = add_ph1_ir(OP_label);
             vd = require_var(parent);
-            strcpy(vd->var_name, label_endif);
+            vd->var_name = intern_name(label_endif);
             ph1_ir->src0 = vd;
 
             if (then_next_ && else_next_) {
@@ -2059,7 +2103,7 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
             /* this is done, and link false jump */
             ph1_ir = add_ph1_ir(OP_label);
             vd = require_var(parent);
-            strcpy(vd->var_name, label_false);
+            vd->var_name = intern_name(label_false);
             ph1_ir->src0 = vd;
 
             if (then_next_) {
@@ -2086,12 +2130,12 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
 
         ph1_ir = add_ph1_ir(OP_label);
         var_continue = require_var(parent);
-        strcpy(var_continue->var_name, label_start);
+        var_continue->var_name = intern_name(label_start);
         ph1_ir->src0 = var_continue;
 
         continue_pos[continue_pos_idx++] = var_continue;
         var_break = require_var(parent);
-        strcpy(var_break->var_name, label_end);
+        var_break->var_name = intern_name(label_end);
         break_exit[break_exit_idx++] = var_break;
 
         lex_expect(T_open_bracket);
@@ -2101,16 +2145,16 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
         ph1_ir = add_ph1_ir(OP_branch);
         ph1_ir->dest = opstack_pop();
         vd = require_var(parent);
-        strcpy(vd->var_name, label_body);
+        vd->var_name = intern_name(label_body);
         ph1_ir->src0 = vd;
         vd = require_var(parent);
-        strcpy(vd->var_name, label_end);
+        vd->var_name = intern_name(label_end);
         ph1_ir->src1 = vd;
         add_insn(parent, bb, OP_branch, NULL, ph1_ir->dest, NULL, 0, NULL);
 
         ph1_ir = add_ph1_ir(OP_label);
         vd = require_var(parent);
-        strcpy(vd->var_name, label_body);
+        vd->var_name = intern_name(label_body);
         ph1_ir->src0 = vd;
 
         basic_block_t *then_ = bb_create(parent);
@@ -2127,7 +2171,7 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
         /* create exit jump for breaks */
         ph1_ir = add_ph1_ir(OP_jump);
         vd = require_var(parent);
-        strcpy(vd->var_name, label_start);
+        vd->var_name = intern_name(label_start);
         ph1_ir->dest = vd;
 
         ph1_ir = add_ph1_ir(OP_label);
@@ -2184,7 +2228,7 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
 
                 ph1_ir = add_ph1_ir(OP_load_constant);
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 vd->init_val = case_val;
                 ph1_ir->dest = vd;
                 opstack_push(vd);
@@ -2193,11 +2237,11 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
 
                 ph1_ir = add_ph1_ir(OP_eq);
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->src0 = opstack_pop();
                 ph1_ir->src1 = operand_stack[operand_stack_idx - 1];
                 vd = require_var(parent);
-                strcpy(vd->var_name, gen_name());
+                vd->var_name = intern_name(gen_name());
                 ph1_ir->dest = vd;
                 add_insn(parent, bb, OP_eq, ph1_ir->dest, ph1_ir->src0,
                          ph1_ir->src1, 0, NULL);
@@ -2205,10 +2249,10 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
                 ph1_ir = add_ph1_ir(OP_branch);
                 ph1_ir->dest = vd;
                 vd = require_var(parent);
-                strcpy(vd->var_name, true_label);
+                vd->var_name = intern_name(true_label);
                 ph1_ir->src0 = vd;
                 vd = require_var(parent);
-                strcpy(vd->var_name, false_label);
+                vd->var_name = intern_name(false_label);
                 ph1_ir->src1 = vd;
                 add_insn(parent, bb, OP_branch, NULL, ph1_ir->dest, NULL, 0,
                          NULL);
@@ -2227,7 +2271,7 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
                 !lex_peek(T_close_curly, NULL) && !lex_peek(T_default, NULL)) {
                 ph1_ir = add_ph1_ir(OP_label);
                 vd = require_var(parent);
-                strcpy(vd->var_name, true_label);
+                vd->var_name = intern_name(true_label);
                 ph1_ir->src0 = vd;
 
                 /* only create new true label at the first line of case body */
@@ -2252,7 +2296,7 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
 
             ph1_ir = add_ph1_ir(OP_label);
             vd = require_var(parent);
-            strcpy(vd->var_name, false_label);
+            vd->var_name = intern_name(false_label);
             ph1_ir->src0 = vd;
 
             if (!lex_peek(T_close_curly, NULL)) {
@@ -2285,15 +2329,10 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
             /* if the last label has no explicit break, connect it to the end */
             bb_connect(true_body_, switch_end, NEXT);
 
-        strcpy(var_break->var_name, vd->var_name);
+        var_break->var_name = vd->var_name;
         break_exit_idx--;
 
-        int i, dangling = 1;
-        for (i = 0; i < MAX_BB_PRED; i++)
-            if (switch_end->prev[i].bb)
-                dangling = 0;
-
-        if (dangling)
+        if (!switch_end->prev_idx)
             return NULL;
 
         return switch_end;
@@ -2392,7 +2431,7 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
         /* condition - check before the loop */
         ph1_ir = add_ph1_ir(OP_label);
         var_condition = require_var(blk);
-        strcpy(var_condition->var_name, cond);
+        var_condition->var_name = intern_name(cond);
         ph1_ir->src0 = var_condition;
         if (!lex_accept(T_semicolon)) {
             read_expr(blk, &cond_);
@@ -2402,7 +2441,7 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
             ph1_ir = add_ph1_ir(OP_load_constant);
             vd = require_var(blk);
             vd->init_val = 1;
-            strcpy(vd->var_name, gen_name());
+            vd->var_name = intern_name(gen_name());
             ph1_ir->dest = vd;
             opstack_push(vd);
             add_insn(blk, cond_, OP_load_constant, ph1_ir->dest, NULL, NULL, 0,
@@ -2412,15 +2451,15 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
         ph1_ir = add_ph1_ir(OP_branch);
         ph1_ir->dest = opstack_pop();
         vd = require_var(blk);
-        strcpy(vd->var_name, body);
+        vd->var_name = intern_name(body);
         ph1_ir->src0 = vd;
         vd = require_var(blk);
-        strcpy(vd->var_name, end);
+        vd->var_name = intern_name(end);
         ph1_ir->src1 = vd;
         add_insn(blk, cond_, OP_branch, NULL, ph1_ir->dest, NULL, 0, NULL);
 
         var_break = require_var(blk);
-        strcpy(var_break->var_name, end);
+        var_break->var_name = intern_name(end);
 
         break_exit[break_exit_idx++] = var_break;
 
@@ -2430,7 +2469,7 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
         /* increment after each loop */
         ph1_ir = add_ph1_ir(OP_label);
         var_inc = require_var(blk);
-        strcpy(var_inc->var_name, inc);
+        var_inc->var_name = intern_name(inc);
         ph1_ir->src0 = var_inc;
 
         continue_pos[continue_pos_idx++] = var_inc;
@@ -2448,30 +2487,29 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
         /* jump back to condition */
         ph1_ir = add_ph1_ir(OP_jump);
         vd = require_var(blk);
-        strcpy(vd->var_name, cond);
+        vd->var_name = intern_name(cond);
         ph1_ir->dest = vd;
 
         /* loop body */
         ph1_ir = add_ph1_ir(OP_label);
         vd = require_var(blk);
-        strcpy(vd->var_name, body);
+        vd->var_name = intern_name(body);
         ph1_ir->src0 = vd;
 
         basic_block_t *body_ = bb_create(blk);
         bb_connect(cond_, body_, THEN);
         body_ = read_body_statement(blk, body_);
 
-        if (body_) {
+        if (body_)
             bb_connect(body_, inc_, NEXT);
+        /* a body which never falls through may still continue */
+        if (inc_->prev_idx)
             bb_connect(inc_, cond_, NEXT);
-        } else {
-            /* TODO: Release dangling inc basicblock */;
-        }
 
         /* jump to increment */
         ph1_ir = add_ph1_ir(OP_jump);
         vd = require_var(blk);
-        strcpy(vd->var_name, inc);
+        vd->var_name = intern_name(inc);
         ph1_ir->dest = vd;
 
         ph1_ir = add_ph1_ir(OP_label);
@@ -2497,17 +2535,17 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
 
         ph1_ir = add_ph1_ir(OP_label);
         var_start = require_var(parent);
-        strcpy(var_start->var_name, gen_label());
+        var_start->var_name = intern_name(gen_label());
         ph1_ir->src0 = var_start;
 
         var_condition = require_var(parent);
-        strcpy(var_condition->var_name, gen_label());
+        var_condition->var_name = intern_name(gen_label());
 
         continue_bb[continue_pos_idx] = cond_;
         continue_pos[continue_pos_idx++] = var_condition;
 
         var_break = require_var(parent);
-        strcpy(var_break->var_name, gen_label());
+        var_break->var_name = intern_name(gen_label());
 
         break_bb[break_exit_idx] = do_while_end;
         break_exit[break_exit_idx++] = var_break;
@@ -2521,7 +2559,7 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
 
         ph1_ir = add_ph1_ir(OP_label);
         vd = require_var(parent);
-        strcpy(vd->var_name, var_condition->var_name);
+        vd->var_name = var_condition->var_name;
         ph1_ir->src0 = vd;
 
         read_expr(parent, &cond_);
@@ -2530,10 +2568,10 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
         ph1_ir = add_ph1_ir(OP_branch);
         ph1_ir->dest = opstack_pop();
         vd = require_var(parent);
-        strcpy(vd->var_name, var_start->var_name);
+        vd->var_name = var_start->var_name;
         ph1_ir->src0 = vd;
         vd = require_var(parent);
-        strcpy(vd->var_name, var_break->var_name);
+        vd->var_name = var_break->var_name;
         ph1_ir->src1 = vd;
         add_insn(parent, cond_, OP_branch, NULL, ph1_ir->dest, NULL, 0, NULL);
 
@@ -2543,14 +2581,10 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
         var_start->init_val = ph1_ir_idx - 1;
         lex_expect(T_semicolon);
 
-        int i;
-        for (i = 0; i < MAX_BB_PRED; i++) {
-            if (cond_->prev[i].bb) {
-                bb_connect(cond_, bb, THEN);
-                bb_connect(cond_, do_while_end, ELSE);
-                break;
-            }
-            /* if breaking out of loop, skip condition block */
+        /* if breaking out of loop, skip condition block */
+        if (cond_->prev_idx) {
+            bb_connect(cond_, bb, THEN);
+            bb_connect(cond_, do_while_end, ELSE);
         }
 
         continue_pos_idx--;
@@ -2624,24 +2658,21 @@ basic_block_t *read_body_statement(block_t *parent, basic_block_t *bb)
         mac->num_params = 0;
         lex_expect(T_identifier);
 
-        /* `source_idx` has pointed at the first parameter */
+        /* `token_idx` has pointed at the first parameter */
         while (!lex_peek(T_close_bracket, NULL)) {
-            mac->params[mac->num_params++] = source_idx;
+            mac->params[mac->num_params++] = token_idx;
             do {
                 next_token = lex_token();
             } while (next_token != T_comma && next_token != T_close_bracket);
         }
-        /* move `source_idx` to the macro body */
-        macro_return_idx = source_idx;
-        source_idx = mac->start_source_idx;
-        next_char = SOURCE[source_idx];
+        /* move `token_idx` to the macro body */
+        macro_return_idx = token_idx;
+        token_idx = mac->start_token_idx;
         lex_expect(T_close_bracket);
 
-        skip_newline = 0;
         bb = read_body_statement(parent, bb);
 
         /* cleanup */
-        skip_newline = 1;
         parent->macro = NULL;
         macro_return_idx = 0;
         return bb;
@@ -2724,13 +2755,13 @@ void read_global_decl(block_t *block)
         func_t *fd = add_func(var->var_name);
         memcpy(&fd->return_def, var, sizeof(var_t));
         var->is_global = 0;
-        block->next_local--;
+        release_var(block);
 
         read_parameter_list_decl(fd, 0);
 
         if (lex_peek(T_open_curly, NULL)) {
             ph1_ir_t *ph1_ir = add_ph1_ir(OP_define);
-            strcpy(ph1_ir->func_name, var->var_name);
+            ph1_ir->func_name = var->var_name;
 
             fn_t *fn = add_fn();
             fn->func = fd;
@@ -2767,7 +2798,7 @@ void read_global_decl(block_t *block)
 void read_global_statement()
 {
     char token[MAX_ID_LEN];
-    block_t *block = &BLOCKS[0]; /* global block */
+    block_t *block = GLOBAL_BLOCK;
 
     if (lex_accept(T_struct)) {
         int i = 0, size = 0;
@@ -2780,8 +2811,11 @@ void read_global_statement()
             type = add_type();
 
         strcpy(type->type_name, token);
+        index_type(type);
         lex_expect(T_open_curly);
         do {
+            if (i == MAX_FIELDS)
+                error("Too many fields");
             var_t *v = &type->fields[i++];
             read_full_var_decl(v, 0, 1);
             v->offset = size;
@@ -2813,6 +2847,7 @@ void read_global_statement()
             lex_expect(T_close_curly);
             lex_ident(T_identifier, token);
             strcpy(type->type_name, token);
+            index_type(type);
             lex_expect(T_semicolon);
         } else if (lex_accept(T_struct)) {
             int i = 0, size = 0, has_struct_def = 0;
@@ -2828,6 +2863,7 @@ void read_global_statement()
                     tag = add_type();
                     tag->base_type = TYPE_struct;
                     strcpy(tag->type_name, token);
+                    index_type(tag);
                 }
             }
 
@@ -2835,6 +2871,8 @@ void read_global_statement()
             if (lex_accept(T_open_curly)) {
                 has_struct_def = 1;
                 do {
+                    if (i == MAX_FIELDS)
+                        error("Too many fields");
                     var_t *v = &type->fields[i++];
                     read_full_var_decl(v, 0, 1);
                     v->offset = size;
@@ -2844,6 +2882,7 @@ void read_global_statement()
             }
 
             lex_ident(T_identifier, type->type_name);
+            index_type(type);
             type->size = size;
             type->num_fields = i;
             type->base_type = TYPE_typedef;
@@ -2875,6 +2914,7 @@ void read_global_statement()
             type->size = base->size;
             type->num_fields = 0;
             lex_ident(T_identifier, type->type_name);
+            index_type(type);
             lex_expect(T_semicolon);
         }
     } else if (lex_peek(T_identifier, NULL)) {
@@ -2883,6 +2923,8 @@ void read_global_statement()
         error("Syntax error in global statement");
 }
 
+void libc_image_start();
+
 void parse_internal()
 {
     /* parser initialization */
@@ -2915,64 +2957,275 @@ void parse_internal()
     func = add_func("__syscall");
     func->num_params = 0;
     func->va_args = 1;
-    func->fn = calloc(1, sizeof(fn_t));
-    func->fn->bbs = calloc(1, sizeof(basic_block_t));
+    func->fn = arena_alloc(BB_ARENA, sizeof(fn_t));
+    func->fn->bbs = arena_alloc(BB_ARENA, sizeof(basic_block_t));
 
     /* TODO: This hack should be removed after merging `func_t` and `fn_t` */
     GLOBAL_FUNC.stack_size = 4;
-    GLOBAL_FUNC.fn = calloc(1, sizeof(fn_t));
-    GLOBAL_FUNC.fn->bbs = calloc(1, sizeof(basic_block_t));
+    GLOBAL_FUNC.fn = arena_alloc(BB_ARENA, sizeof(fn_t));
+    GLOBAL_FUNC.fn->bbs = arena_alloc(BB_ARENA, sizeof(basic_block_t));
+
+    /* libc, when it is taken from its prebuilt image */
+    libc_image_start();
 
     /* lexer initialization */
-    source_idx = 0;
-    next_char = SOURCE[0];
+    tokenize();
+    token_idx = 0;
     lex_expect(T_start);
 
     do {
+        if (pch_global_statement())
+            continue;
         if (read_preproc_directive())
             continue;
         read_global_statement();
-    } while (!lex_accept(T_eof));
+    } while (next_token != T_eof);
+}
+
+/* The include guard and `#pragma once` detection below only looks at the raw
+ * lines of SOURCE, before anything is tokenized.
+ */
+
+/* the beginning of the line after the one at @idx */
+int next_source_line(int idx, int end)
+{
+    while (idx < end && SOURCE[idx] != '\n')
+        idx++;
+    return idx + 1;
+}
+
+/* skip blanks, line breaks and comments */
+int skip_source_space(int idx, int end)
+{
+    while (idx < end) {
+        if (is_whitespace(SOURCE[idx]) || is_newline(SOURCE[idx]))
+            idx++;
+        else if (SOURCE[idx] == '/' && SOURCE[idx + 1] == '/')
+            idx = next_source_line(idx, end);
+        else if (SOURCE[idx] == '/' && SOURCE[idx + 1] == '*') {
+            idx += 2;
+            while (idx < end &&
+                   !(SOURCE[idx] == '*' && SOURCE[idx + 1] == '/'))
+                idx++;
+            idx += 2;
+        } else
+            break;
+    }
+    return idx;
+}
+
+/* offset after @directive if the line at @idx starts with it, otherwise -1 */
+int match_directive(int idx, char *directive)
+{
+    int len = strlen(directive);
+
+    while (is_whitespace(SOURCE[idx]))
+        idx++;
+    if (strncmp(SOURCE + idx, directive, len) || is_alnum(SOURCE[idx + len]))
+        return -1;
+    return idx + len;
+}
+
+/* read the identifier following a directive, returns its length */
+int read_directive_ident(int idx, char *ident)
+{
+    int len = 0;
+
+    while (is_whitespace(SOURCE[idx]))
+        idx++;
+    while (is_alnum(SOURCE[idx]) && len < MAX_VAR_LEN - 1)
+        ident[len++] = SOURCE[idx++];
+    ident[len] = 0;
+    return len;
+}
+
+/* 1 if the line at @idx opens a conditional, -1 if it closes one */
+int conditional_directive(int idx)
+{
+    if (match_directive(idx, "#if") >= 0 ||
+        match_directive(idx, "#ifdef") >= 0 ||
+        match_directive(idx, "#ifndef") >= 0)
+        return 1;
+    if (match_directive(idx, "#endif") >= 0)
+        return -1;
+    return 0;
+}
+
+/* is there a line `@directive @name` in SOURCE between @start and @end? */
+int has_directive(char *directive, char *name, int start, int end)
+{
+    char ident[MAX_VAR_LEN];
+    int idx, n;
+
+    for (idx = start; idx < end; idx = next_source_line(idx, end)) {
+        n = match_directive(idx, directive);
+        if (n >= 0 && read_directive_ident(n, ident) && !strcmp(ident, name))
+            return 1;
+    }
+    return 0;
+}
+
+/* Mark the macros which `#define` and `#undef` lines between @start and @end
+ * name, so that include guards are checked without scanning SOURCE again.
+ */
+void record_directives(int start, int end)
+{
+    char ident[MAX_VAR_LEN];
+    int idx, n, id;
+
+    for (idx = start; idx < end; idx = next_source_line(idx, end)) {
+        n = match_directive(idx, "#define");
+        if (n >= 0 && read_directive_ident(n, ident)) {
+            /* interning may move IDENTS */
+            id = intern(ident);
+            IDENTS[id].defined = 1;
+        }
+        n = match_directive(idx, "#undef");
+        if (n >= 0 && read_directive_ident(n, ident)) {
+            id = intern(ident);
+            IDENTS[id].undefined = 1;
+        }
+    }
 }
 
-/* Load specified source file and referred inclusion recursively */
-void load_source_file(char *file)
+/* Recognize the classic guard wrapping the whole file, i.e.
+ *   #ifndef X
+ *   #define X
+ *   ...
+ *   #endif
+ * with nothing but blanks and comments outside. Its macro is kept in @guard.
+ */
+int scan_include_guard(int start, int end, char *guard)
 {
-    char buffer[MAX_LINE_LEN];
+    char name[MAX_VAR_LEN];
+    int idx, depth = 1;
+
+    idx = match_directive(skip_source_space(start, end), "#ifndef");
+    if (idx < 0 || !read_directive_ident(idx, guard))
+        return 0;
+    idx = skip_source_space(next_source_line(idx, end), end);
+    idx = match_directive(idx, "#define");
+    if (idx < 0 || !read_directive_ident(idx, name) || strcmp(name, guard))
+        return 0;
+
+    for (idx = next_source_line(idx, end); idx < end;
+         idx = next_source_line(idx, end)) {
+        depth += conditional_directive(idx);
+        if (!depth)
+            return skip_source_space(next_source_line(idx, end), end) >= end;
+    }
+    return 0;
+}
+
+/* Including @path again has no effect if it has been included before outside
+ * any condition, and `#pragma once` or an include guard which is never
+ * undefined keeps its content from being seen twice.
+ */
+int is_redundant_inclusion(char *path)
+{
+    source_file_t *file;
+    int i;
+
+    for (i = 0; i < source_files_idx; i++) {
+        file = &SOURCE_FILES[i];
+        if (!file->unconditional || strcmp(file->path, path))
+            continue;
+        if (file->once)
+            return 1;
+        if (file->guard[0] && !IDENTS[find_ident(file->guard)].undefined)
+            return 1;
+    }
+    return 0;
+}
+
+/* Load specified source file in bulk and referred inclusion recursively. Each
+ * file is kept whole in SOURCE: an `#include "..."` line is cut off by a NUL,
+ * and the text after it becomes another span behind the included file.
+ * Redundant inclusions are cut off as well, but nothing is loaded for them.
+ */
+void load_source_file(char *file, int unconditional)
+{
+    int fidx, start, end, idx, next, n, depth = 0;
 
     FILE *f = fopen(file, "rb");
     if (!f)
         abort();
 
-    for (;;) {
-        if (!fgets(buffer, MAX_LINE_LEN, f)) {
-            fclose(f);
-            return;
+    fidx = add_source_file(file);
+    start = source_idx;
+    do {
+        source_reserve(SOURCE_CHUNK);
+        n = fread(SOURCE + source_idx, 1, SOURCE_CHUNK, f);
+        source_idx += n;
+    } while (n == SOURCE_CHUNK);
+    fclose(f);
+
+    end = source_idx;
+    SOURCE[source_idx++] = 0;
+    SOURCE_FILES[fidx].end = end;
+    SOURCE_FILES[fidx].unconditional = unconditional;
+    SOURCE_FILES[fidx].once = has_directive("#pragma", "once", start, end);
+    if (scan_include_guard(start, end, SOURCE_FILES[fidx].guard)) {
+        /* the guard itself holds unless it was defined before */
+        n = find_ident(SOURCE_FILES[fidx].guard);
+        if (n < 0 || !IDENTS[n].defined)
+            depth = -1;
+    } else
+        SOURCE_FILES[fidx].guard[0] = 0;
+    record_directives(start, end);
+    SOURCE_FILES[fidx].span_start = source_spans_idx;
+    add_source_span(start, fidx);
+
+    for (idx = start; idx < end; idx = next) {
+        char path[MAX_LINE_LEN];
+        int c;
+
+        next = next_source_line(idx, end);
+        depth += conditional_directive(idx);
+
+        if (strncmp(SOURCE + idx, "#include \"", 10))
+            continue;
+
+        c = strlen(file) - 1;
+        while (c > 0 && file[c] != '/')
+            c--;
+        if (c) {
+            /* prepend directory name */
+            strncpy(path, file, c + 1);
+            c++;
         }
-        if (!strncmp(buffer, "#include ", 9) && (buffer[9] == '"')) {
-            char path[MAX_LINE_LEN];
-            int c = strlen(file) - 1;
-            while (c > 0 && file[c] != '/')
-                c--;
-            if (c) {
-                /* prepend directory name */
-                strncpy(path, file, c + 1);
-                c++;
-            }
-            path[c] = 0;
-            buffer[strlen(buffer) - 2] = 0;
-            strcpy(path + c, buffer + 10);
-            load_source_file(path);
-        } else {
-            strcpy(SOURCE + source_idx, buffer);
-            source_idx += strlen(buffer);
+        for (n = idx + 10; n < next - 1 && SOURCE[n] != '"'; n++) {
+            if (c >= MAX_LINE_LEN - 1)
+                error("Include path is too long");
+            path[c++] = SOURCE[n];
         }
+        path[c] = 0;
+
+        SOURCE[idx] = 0;
+        if (!is_redundant_inclusion(path))
+            load_source_file(path, unconditional && depth <= 0);
+        if (next <= end)
+            add_source_span(next, fidx);
     }
-    fclose(f);
+    SOURCE_FILES[fidx].span_end = source_spans_idx;
+
+    /* an included header may not need to be tokenized at all */
+    if (fidx && use_pch && !emit_pch)
+        pch_open(fidx);
 }
 
 void parse(char *file)
 {
-    load_source_file(file);
+    /* the inlined libc, if any, has been placed at the beginning */
+    source_reserve(0);
+    SOURCE[source_idx++] = 0;
+    add_source_span(0, -1);
+
+    lexer_init();
+    record_directives(0, source_idx);
+
+    /* no file when only libc is compiled into its prebuilt image */
+    if (file)
+        load_source_file(file, 1);
     parse_internal();
 }
@@ -0,0 +1,620 @@
+/*
+ * shecc - Self-Hosting and Educational C Compiler.
+ *
+ * shecc is freely redistributable under the BSD 2 clause license. See the
+ * file "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/* Precompiled headers.
+ *
+ * `--emit-pch` parses a header alone and saves the types, aliases, macros,
+ * enumerators and prototypes it declares. With `--pch`, a header included as
+ * "foo.h" is restored from "foo.h.pch" instead of being parsed, provided that
+ * its text, along with that of its own inclusions, and every definition made
+ * before it are exactly the same as when the file was written. The text is
+ * compared as soon as the header is loaded, so that a matching header is not
+ * even tokenized unless the definitions before it turn out to differ.
+ *
+ * Since restored entries land at the same indices as parsed ones would, a
+ * header only qualifies if it neither defines functions or variables nor
+ * changes earlier definitions.
+ */
+
+#define PCH_MAGIC 0x43504853 /* "SHPC" */
+
+/* the state the header has been parsed from */
+int pch_types_idx;
+int pch_aliases_idx;
+int pch_macros_idx;
+int pch_constants_idx;
+int pch_funcs_idx;
+int pch_symbols_idx;
+int pch_state_size; /* its first bytes of pch_buf */
+int pch_token_start = 0; /* 0 until recorded; token 0 is T_start */
+
+/* checked to ensure the header declares nothing else */
+int pch_blocks_idx;
+int pch_next_local;
+int pch_global_ir_idx;
+int pch_data_idx;
+fn_t *pch_func_tail;
+
+/* the definitions a header is parsed from, laid out by pch_put_state() */
+char *pch_buf;
+int pch_buf_idx = 0;
+int pch_buf_cap = 0;
+
+/* text read back from a precompiled header */
+char *pch_text;
+int pch_text_cap = 0;
+
+void pch_put(int c)
+{
+    pch_buf = table_reserve(pch_buf, pch_buf_idx, &pch_buf_cap, 1);
+    pch_buf[pch_buf_idx++] = c;
+}
+
+void pch_put_int(int val)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+        pch_put(val >> (i * 8));
+}
+
+/* an unnamed entry is laid out as the empty name */
+void pch_put_str(char *str)
+{
+    int i;
+    for (i = 0; str && str[i]; i++)
+        pch_put(str[i]);
+    pch_put(0);
+}
+
+void pch_put_var(var_t *var)
+{
+    pch_put_str(var->type_name);
+    pch_put_str(var->var_name);
+    pch_put_int(var->is_ptr);
+    pch_put_int(var->is_func);
+    pch_put_int(var->array_size);
+    pch_put_int(var->offset);
+}
+
+int pch_type_slot(type_t *type)
+{
+    int i;
+    for (i = 0; type && i < types_idx; i++) {
+        if (type == &TYPES[i])
+            return i;
+    }
+    return -1;
+}
+
+/* Append every detail of the first entries of each table to pch_buf. Two
+ * states are the same if and only if they are laid out the same.
+ */
+void pch_put_state(int types, int aliases, int macros, int constants, int funcs)
+{
+    type_t *type;
+    macro_t *macro;
+    func_t *func;
+    int i, j;
+
+    pch_put_int(types);
+    for (i = 0; i < types; i++) {
+        type = &TYPES[i];
+        pch_put_str(type->type_name);
+        pch_put_int(type->base_type);
+        pch_put_int(pch_type_slot(type->base_struct));
+        pch_put_int(type->size);
+        pch_put_int(type->num_fields);
+        for (j = 0; j < type->num_fields; j++)
+            pch_put_var(&type->fields[j]);
+    }
+
+    pch_put_int(aliases);
+    for (i = 0; i < aliases; i++) {
+        pch_put_str(ALIASES[i].alias);
+        pch_put_str(ALIASES[i].value);
+        pch_put_int(ALIASES[i].disabled);
+    }
+
+    /* a macro body runs until the next line */
+    pch_put_int(macros);
+    for (i = 0; i < macros; i++) {
+        macro = &MACROS[i];
+        pch_put_str(macro->name);
+        pch_put_int(macro->is_variadic);
+        pch_put_int(macro->num_param_defs);
+        for (j = 0; j < macro->num_param_defs; j++)
+            pch_put_str(macro->param_defs[j].var_name);
+        for (j = macro->start_token_idx;
+             !TOKENS[j].bol && TOKENS[j].kind != T_eof; j++) {
+            pch_put_int(TOKENS[j].kind);
+            pch_put_str(TOKENS[j].value);
+        }
+        pch_put_int(T_eof);
+        pch_put_int(macro->disabled);
+    }
+
+    pch_put_int(constants);
+    for (i = 0; i < constants; i++) {
+        pch_put_str(CONSTANTS[i].alias);
+        pch_put_int(CONSTANTS[i].value);
+    }
+
+    pch_put_int(funcs);
+    for (i = 0; i < funcs; i++) {
+        func = &FUNCS[i];
+        pch_put_var(&func->return_def);
+        pch_put_int(func->num_params);
+        for (j = 0; j < func->num_params; j++)
+            pch_put_var(&func->param_defs[j]);
+        pch_put_int(func->va_args);
+    }
+}
+
+/* Read @len bytes from @fp, and return 1 if they are the same as @text */
+int pch_read_same(FILE *fp, char *text, int len)
+{
+    int n, i;
+
+    pch_text = table_reserve(pch_text, 0, &pch_text_cap, 1);
+    while (pch_text_cap < len)
+        pch_text = table_reserve(pch_text, pch_text_cap, &pch_text_cap, 1);
+    n = fread(pch_text, 1, len, fp);
+    if (n != len)
+        return 0;
+    for (i = 0; i < len; i++) {
+        if (pch_text[i] != text[i])
+            return 0;
+    }
+    return 1;
+}
+
+/* Names of variables may be missing, e.g. of unnamed parameters, and are then
+ * written empty and read back as NULL.
+ */
+void pch_write_name(FILE *fp, char *name, int len)
+{
+    if (name)
+        file_write_str(fp, name, len);
+    else
+        file_write_str(fp, "", len);
+}
+
+char *pch_read_name(FILE *fp, int len)
+{
+    char name[MAX_VAR_LEN];
+
+    file_read_str(fp, name, len);
+    if (!name[0])
+        return NULL;
+    return intern_name(name);
+}
+
+void pch_write_var(FILE *fp, var_t *var)
+{
+    pch_write_name(fp, var->type_name, MAX_TYPE_LEN);
+    pch_write_name(fp, var->var_name, MAX_VAR_LEN);
+    file_write_int(fp, var->is_ptr);
+    file_write_int(fp, var->is_func);
+    file_write_int(fp, var->array_size);
+    file_write_int(fp, var->offset);
+}
+
+void pch_read_var(FILE *fp, var_t *var)
+{
+    var->type_name = pch_read_name(fp, MAX_TYPE_LEN);
+    var->var_name = pch_read_name(fp, MAX_VAR_LEN);
+    var->is_ptr = file_read_int(fp);
+    var->is_func = file_read_int(fp);
+    var->array_size = file_read_int(fp);
+    var->offset = file_read_int(fp);
+}
+
+/* Record the state right before the header given to `--emit-pch` */
+void pch_snapshot(int token_start)
+{
+    pch_types_idx = types_idx;
+    pch_aliases_idx = aliases_idx;
+    pch_macros_idx = macros_idx;
+    pch_constants_idx = constants_idx;
+    pch_funcs_idx = funcs_idx;
+    pch_symbols_idx = symbols_idx;
+    pch_buf_idx = 0;
+    pch_put_state(types_idx, aliases_idx, macros_idx, constants_idx,
+                  funcs_idx);
+    pch_state_size = pch_buf_idx;
+    pch_token_start = token_start;
+
+    pch_blocks_idx = blocks_idx;
+    pch_next_local = GLOBAL_BLOCK->next_local;
+    pch_global_ir_idx = global_ir_idx;
+    pch_data_idx = elf_data_idx;
+    pch_func_tail = FUNC_LIST.tail;
+}
+
+/* Write the definitions made since pch_snapshot(). Macro bodies are kept as
+ * token indices from the one the snapshot was taken at.
+ */
+void pch_write_defs(FILE *fp)
+{
+    symbol_entry_t *sym;
+    type_t *type;
+    macro_t *macro;
+    func_t *func;
+    int i, j;
+
+    file_write_int(fp, types_idx - pch_types_idx);
+    for (i = pch_types_idx; i < types_idx; i++) {
+        type = &TYPES[i];
+        file_write_str(fp, type->type_name, MAX_TYPE_LEN);
+        file_write_int(fp, type->base_type);
+        for (j = 0; j < types_idx; j++) {
+            if (type->base_struct == &TYPES[j])
+                break;
+        }
+        if (j == types_idx)
+            j = -1;
+        file_write_int(fp, j);
+        file_write_int(fp, type->size);
+        file_write_int(fp, type->num_fields);
+        for (j = 0; j < type->num_fields; j++)
+            pch_write_var(fp, &type->fields[j]);
+    }
+
+    file_write_int(fp, aliases_idx - pch_aliases_idx);
+    for (i = pch_aliases_idx; i < aliases_idx; i++) {
+        file_write_str(fp, ALIASES[i].alias, MAX_VAR_LEN);
+        file_write_str(fp, ALIASES[i].value, MAX_VAR_LEN);
+        file_write_int(fp, ALIASES[i].disabled);
+    }
+
+    file_write_int(fp, macros_idx - pch_macros_idx);
+    for (i = pch_macros_idx; i < macros_idx; i++) {
+        macro = &MACROS[i];
+        file_write_str(fp, macro->name, MAX_VAR_LEN);
+        file_write_int(fp, macro->is_variadic);
+        file_write_int(fp, macro->start_token_idx - pch_token_start);
+        file_write_int(fp, macro->num_param_defs);
+        for (j = 0; j < macro->num_param_defs; j++)
+            pch_write_name(fp, macro->param_defs[j].var_name, MAX_VAR_LEN);
+        file_write_int(fp, macro->disabled);
+    }
+
+    file_write_int(fp, constants_idx - pch_constants_idx);
+    for (i = pch_constants_idx; i < constants_idx; i++) {
+        file_write_str(fp, CONSTANTS[i].alias, MAX_VAR_LEN);
+        file_write_int(fp, CONSTANTS[i].value);
+    }
+
+    file_write_int(fp, funcs_idx - pch_funcs_idx);
+    for (i = pch_funcs_idx; i < funcs_idx; i++) {
+        func = &FUNCS[i];
+        pch_write_var(fp, &func->return_def);
+        file_write_int(fp, func->num_params);
+        for (j = 0; j < func->num_params; j++)
+            pch_write_var(fp, &func->param_defs[j]);
+        file_write_int(fp, func->va_args);
+        file_write_int(fp, func->stack_size);
+    }
+
+    /* Global variables are indexed lazily, so their entries are left to be
+     * indexed again after the header is restored.
+     */
+    j = 0;
+    for (i = pch_symbols_idx; i < symbols_idx; i++) {
+        if (SYMBOLS[i].kind != SYM_LOCAL)
+            j++;
+    }
+    file_write_int(fp, j);
+    for (i = pch_symbols_idx; i < symbols_idx; i++) {
+        sym = &SYMBOLS[i];
+        if (sym->kind == SYM_LOCAL)
+            continue;
+        file_write_int(fp, sym->kind);
+        file_write_int(fp, sym->slot);
+        file_write_str(fp, IDENTS[sym->ident].name, MAX_ID_LEN);
+    }
+}
+
+/* Restore the definitions written by pch_write_defs(), with macro bodies
+ * starting from token @start.
+ */
+void pch_read_defs(FILE *fp, int start)
+{
+    char name[MAX_ID_LEN];
+    type_t *type;
+    macro_t *macro;
+    func_t *func;
+    int n, i, j;
+
+    n = file_read_int(fp);
+    if (types_idx + n > MAX_TYPES)
+        error("Too many types");
+    for (i = 0; i < n; i++) {
+        type = add_type();
+        file_read_str(fp, type->type_name, MAX_TYPE_LEN);
+        type->base_type = file_read_int(fp);
+        j = file_read_int(fp);
+        if (j < 0)
+            type->base_struct = NULL;
+        else
+            type->base_struct = &TYPES[j];
+        type->size = file_read_int(fp);
+        type->num_fields = file_read_int(fp);
+        for (j = 0; j < type->num_fields; j++)
+            pch_read_var(fp, &type->fields[j]);
+    }
+
+    n = file_read_int(fp);
+    if (aliases_idx + n > MAX_ALIASES)
+        error("Too many aliases");
+    for (i = 0; i < n; i++) {
+        file_read_str(fp, ALIASES[aliases_idx].alias, MAX_VAR_LEN);
+        file_read_str(fp, ALIASES[aliases_idx].value, MAX_VAR_LEN);
+        ALIASES[aliases_idx++].disabled = file_read_int(fp);
+    }
+
+    n = file_read_int(fp);
+    if (macros_idx + n > MAX_ALIASES)
+        error("Too many macros");
+    for (i = 0; i < n; i++) {
+        macro = &MACROS[macros_idx++];
+        file_read_str(fp, macro->name, MAX_VAR_LEN);
+        macro->is_variadic = file_read_int(fp);
+        macro->start_token_idx = start + file_read_int(fp);
+        macro->num_param_defs = file_read_int(fp);
+        for (j = 0; j < macro->num_param_defs; j++)
+            macro->param_defs[j].var_name = pch_read_name(fp, MAX_VAR_LEN);
+        macro->disabled = file_read_int(fp);
+    }
+
+    n = file_read_int(fp);
+    if (constants_idx + n > MAX_CONSTANTS)
+        error("Too many constants");
+    for (i = 0; i < n; i++) {
+        file_read_str(fp, CONSTANTS[constants_idx].alias, MAX_VAR_LEN);
+        CONSTANTS[constants_idx++].value = file_read_int(fp);
+    }
+
+    n = file_read_int(fp);
+    if (funcs_idx + n > MAX_FUNCS)
+        error("Too many functions");
+    for (i = 0; i < n; i++) {
+        func = &FUNCS[funcs_idx++];
+        pch_read_var(fp, &func->return_def);
+        func->num_params = file_read_int(fp);
+        for (j = 0; j < func->num_params; j++)
+            pch_read_var(fp, &func->param_defs[j]);
+        func->va_args = file_read_int(fp);
+        func->stack_size = file_read_int(fp);
+        func->fn = NULL;
+    }
+
+    n = file_read_int(fp);
+    for (i = 0; i < n; i++) {
+        sym_kind_t kind = file_read_int(fp);
+        j = file_read_int(fp);
+        file_read_str(fp, name, MAX_ID_LEN);
+        add_symbol_entry(kind, name, -1, j);
+    }
+}
+
+void pch_write_token(FILE *fp, int idx, int base)
+{
+    int len = strlen(TOKENS[idx].value);
+
+    file_write_int(fp, TOKENS[idx].kind);
+    file_write_int(fp, TOKENS[idx].bol);
+    file_write_int(fp, TOKENS[idx].offset - base);
+    file_write_int(fp, len);
+    file_write_str(fp, TOKENS[idx].value, len);
+}
+
+void pch_read_token(FILE *fp, int idx, int base)
+{
+    token_t kind = file_read_int(fp);
+    int bol = file_read_int(fp);
+    int offset = base + file_read_int(fp);
+    int len = file_read_int(fp);
+
+    if (len >= MAX_TOKEN_LEN)
+        error("Invalid precompiled header");
+    fread(token_str, 1, len, fp);
+    token_str[len] = 0;
+    set_token(idx, kind, offset, bol);
+}
+
+/* The header is written with its text, which is SOURCE_FILES[0] and the
+ * files it includes, the state it has been parsed from, its definitions and
+ * finally the tokens of its macro bodies.
+ */
+void pch_write(char *file)
+{
+    FILE *fp;
+    source_file_t *header = &SOURCE_FILES[0];
+    int len, i, j;
+
+    if (!pch_token_start)
+        error("Nothing to precompile");
+    if (blocks_idx != pch_blocks_idx ||
+        GLOBAL_BLOCK->next_local != pch_next_local ||
+        global_ir_idx != pch_global_ir_idx || elf_data_idx != pch_data_idx ||
+        FUNC_LIST.tail != pch_func_tail)
+        error("Only declarations and macros can be precompiled");
+
+    pch_buf_idx = pch_state_size;
+    pch_put_state(pch_types_idx, pch_aliases_idx, pch_macros_idx,
+                  pch_constants_idx, pch_funcs_idx);
+    if (pch_buf_idx != pch_state_size * 2)
+        error("Precompiled header changes earlier definitions");
+    for (i = 0; i < pch_state_size; i++) {
+        if (pch_buf[i] != pch_buf[pch_state_size + i])
+            error("Precompiled header changes earlier definitions");
+    }
+
+    fp = fopen(file, "wb");
+    file_write_int(fp, PCH_MAGIC);
+    file_write_int(fp, ELF_MACHINE);
+    file_write_int(fp, header->span_end - header->span_start);
+    for (i = header->span_start; i < header->span_end; i++) {
+        len = strlen(SOURCE + SOURCE_SPANS[i].start);
+        file_write_int(fp, len);
+        file_write_str(fp, SOURCE + SOURCE_SPANS[i].start, len);
+    }
+    file_write_int(fp, header->token_end - pch_token_start);
+
+    file_write_int(fp, pch_state_size);
+    for (i = 0; i < pch_state_size; i++)
+        fputc(pch_buf[i], fp);
+    pch_write_defs(fp);
+
+    for (i = pch_macros_idx; i < macros_idx; i++) {
+        for (j = MACROS[i].start_token_idx;
+             !TOKENS[j].bol && TOKENS[j].kind != T_eof; j++)
+            ;
+        file_write_int(fp, j - MACROS[i].start_token_idx);
+        for (j = MACROS[i].start_token_idx;
+             !TOKENS[j].bol && TOKENS[j].kind != T_eof; j++)
+            pch_write_token(fp, j, header->start);
+    }
+    fclose(fp);
+}
+
+/* Open the precompiled header of SOURCE_FILES[@file], which has just been
+ * loaded along with its inclusions, and keep it if it has been written from
+ * the same text. The header is then left untokenized, see tokenize_spans().
+ */
+void pch_open(int file)
+{
+    FILE *fp;
+    char path[MAX_LINE_LEN];
+    int first = SOURCE_FILES[file].span_start;
+    int last = SOURCE_FILES[file].span_end;
+    int n, i;
+
+    n = strlen(SOURCE_FILES[file].path);
+    if (n + 5 > MAX_LINE_LEN)
+        return;
+    strcpy(path, SOURCE_FILES[file].path);
+    strcpy(path + n, ".pch");
+    fp = fopen(path, "rb");
+    if (!fp)
+        return;
+
+    if (file_read_int(fp) != PCH_MAGIC || file_read_int(fp) != ELF_MACHINE ||
+        file_read_int(fp) != last - first) {
+        fclose(fp);
+        return;
+    }
+    for (i = first; i < last; i++) {
+        n = strlen(SOURCE + SOURCE_SPANS[i].start);
+        if (file_read_int(fp) != n ||
+            !pch_read_same(fp, SOURCE + SOURCE_SPANS[i].start, n)) {
+            fclose(fp);
+            return;
+        }
+    }
+    SOURCE_FILES[file].pch_tokens = file_read_int(fp);
+    SOURCE_FILES[file].pch = fp;
+}
+
+/* Restore SOURCE_FILES[@file] from its opened precompiled header. Return 1 if
+ * done, or 0 if the definitions before it differ and it has to be parsed.
+ */
+int pch_load(int file)
+{
+    FILE *fp = SOURCE_FILES[file].pch;
+    int start = SOURCE_FILES[file].token_start;
+    int macros = macros_idx, n, i, j;
+
+    SOURCE_FILES[file].pch = NULL;
+    pch_buf_idx = 0;
+    pch_put_state(types_idx, aliases_idx, macros_idx, constants_idx,
+                  funcs_idx);
+    if (file_read_int(fp) != pch_buf_idx ||
+        !pch_read_same(fp, pch_buf, pch_buf_idx)) {
+        fclose(fp);
+        return 0;
+    }
+
+    pch_read_defs(fp, start);
+    for (i = macros; i < macros_idx; i++) {
+        n = file_read_int(fp);
+        for (j = 0; j < n; j++)
+            pch_read_token(fp, MACROS[i].start_token_idx + j,
+                           SOURCE_FILES[file].start);
+    }
+    fclose(fp);
+    return 1;
+}
+
+/* Tokenize SOURCE_FILES[@file] into the room left for its tokens */
+void pch_scan(int file)
+{
+    int end = tokens_idx;
+
+    if (SOURCE_FILES[file].pch)
+        fclose(SOURCE_FILES[file].pch);
+    SOURCE_FILES[file].pch = NULL;
+
+    tokens_idx = SOURCE_FILES[file].token_start;
+    tokenize_spans(SOURCE_FILES[file].span_start,
+                   SOURCE_FILES[file].span_end);
+    if (tokens_idx != SOURCE_FILES[file].token_end)
+        error("Precompiled header does not match its header");
+    tokens_idx = end;
+}
+
+/* the header whose unscanned tokens start at token_idx */
+int pch_pending_file()
+{
+    int f;
+
+    for (f = 0; f < source_files_idx; f++) {
+        if (SOURCE_FILES[f].pch && SOURCE_FILES[f].token_start == token_idx)
+            return f;
+    }
+    error("No header to scan");
+    return -1;
+}
+
+/* Called by the lexer when the parser reads past the first token of a header
+ * which has not been restored.
+ */
+void pch_scan_pending()
+{
+    token_pending = 0;
+    pch_scan(pch_pending_file());
+}
+
+/* Called before each global statement. In `--emit-pch` mode, it records the
+ * state the header starts from. With `--pch`, it restores the headers which
+ * start here from their precompiled ones, or tokenizes them, and returns 1 if
+ * any has been restored.
+ */
+int pch_global_statement()
+{
+    int cur = token_idx - 1, restored = 0, f;
+
+    if (emit_pch) {
+        if (!pch_token_start && cur == SOURCE_FILES[0].token_start)
+            pch_snapshot(cur);
+        return 0;
+    }
+
+    /* an enclosing header starts at the same token as its first inclusion */
+    while (token_pending) {
+        token_pending = 0;
+        f = pch_pending_file();
+        if (pch_load(f)) {
+            token_idx = SOURCE_FILES[f].token_end;
+            restored = 1;
+        } else
+            pch_scan(f);
+        next_token = lex_token();
+    }
+    return restored;
+}
@@ -38,10 +38,10 @@ void insn_fusion(ph2_ir_t *ph2_ir)
         return;
 
     if (next->op == OP_assign) {
-        /* eliminate {ALU rn, rs1, rs2; mv rd, rn;} */
+        /* eliminate {ALU rn, rs1, rs2; mv rd, rn;} unless rn is read again */
         if (!is_fusible_insn(ph2_ir))
             return;
-        if (ph2_ir->dest == next->src0) {
+        if (ph2_ir->dest == next->src0 && !next->is_src0_live) {
             ph2_ir->dest = next->dest;
             ph2_ir->next = next->next;
             return;
@@ -14,11 +14,39 @@
 
 int check_live_out(basic_block_t *bb, var_t *var)
 {
-    int i;
-    for (i = 0; i < bb->live_out_idx; i++)
-        if (bb->live_out[i] == var)
-            return 1;
-    return 0;
+    /* globals are not numbered and never live across blocks */
+    if (var->is_global)
+        return 0;
+    return bitset_test(bb->live_out, var->live_id);
+}
+
+/* The versions of a scalar local whose address is taken share the stack slot
+ * of the variable, where each value given to them is stored at once. Arrays
+ * and structures live in the frame anyway, see OP_allocat.
+ */
+int in_memory(var_t *var)
+{
+    if (var->is_global || !var->base || !var->base->is_addr_taken)
+        return 0;
+    if (var->array_size)
+        return 0;
+    return var->is_ptr ||
+           !strcmp(var->type_name, "int") ||
+           !strcmp(var->type_name, "char") ||
+           !strcmp(var->type_name, "void");
+}
+
+var_t *slot_of(var_t *var)
+{
+    if (in_memory(var))
+        return var->base;
+    return var;
+}
+
+/* Whether @var is read again after @insn */
+int is_live_after(basic_block_t *bb, insn_t *insn, var_t *var)
+{
+    return check_live_out(bb, var) || var->consumed > insn->idx;
 }
 
 void refresh(basic_block_t *bb, insn_t *insn)
@@ -38,7 +66,7 @@ void refresh(basic_block_t *bb, insn_t *insn)
 
 ph2_ir_t *bb_add_ph2_ir(basic_block_t *bb, opcode_t op)
 {
-    ph2_ir_t *n = calloc(1, sizeof(ph2_ir_t));
+    ph2_ir_t *n = arena_alloc(BB_ARENA, sizeof(ph2_ir_t));
     n->op = op;
 
     if (!bb->ph2_ir_list.head)
@@ -61,6 +89,7 @@ void spill_var(basic_block_t *bb, var_t *var, int idx)
         return;
     }
 
+    var = slot_of(var);
     if (!var->offset) {
         var->offset = bb->belong_to->func->stack_size;
         bb->belong_to->func->stack_size += 4;
@@ -86,9 +115,17 @@ int find_in_regs(var_t *var)
 
 void load_var(basic_block_t *bb, var_t *var, int idx)
 {
-    ph2_ir_t *ir = var->is_global ? bb_add_ph2_ir(bb, OP_global_load)
-                                  : bb_add_ph2_ir(bb, OP_load);
-    ir->src0 = var->offset;
+    var_t *slot = slot_of(var);
+    ph2_ir_t *ir;
+
+    /* blocks laid out ahead of the one spilling it may read it first */
+    if (!slot->is_global && !slot->offset) {
+        slot->offset = bb->belong_to->func->stack_size;
+        bb->belong_to->func->stack_size += 4;
+    }
+    ir = slot->is_global ? bb_add_ph2_ir(bb, OP_global_load)
+                         : bb_add_ph2_ir(bb, OP_load);
+    ir->src0 = slot->offset;
     ir->dest = idx;
     REGS[idx].var = var;
     REGS[idx].polluted = 0;
@@ -306,7 +343,7 @@ void reg_alloc()
 
         /* set arguments available */
         for (i = 0; i < fn->func->num_params; i++) {
-            REGS[i].var = fn->func->param_defs[i].subscripts[0];
+            REGS[i].var = get_subscript(&fn->func->param_defs[i], 0);
             REGS[i].polluted = 1;
         }
 
@@ -315,9 +352,11 @@ void reg_alloc()
             for (i = 0; i < MAX_PARAMS; i++) {
                 ph2_ir_t *ir = bb_add_ph2_ir(fn->bbs, OP_store);
 
-                if (i < fn->func->num_params)
-                    fn->func->param_defs[i].subscripts[0]->offset =
-                        fn->func->stack_size;
+                if (i < fn->func->num_params) {
+                    var_t *param =
+                        slot_of(get_subscript(&fn->func->param_defs[i], 0));
+                    param->offset = fn->func->stack_size;
+                }
 
                 ir->src0 = i;
                 ir->src1 = fn->func->stack_size;
@@ -334,25 +373,14 @@ void reg_alloc()
             insn_t *insn;
             for (insn = bb->insn_list.head; insn; insn = insn->next) {
                 func_t *func;
+                var_t *var;
                 ph2_ir_t *ir;
                 int dest, src0, src1;
-                int i, sz, clear_reg;
+                int i, sz, clear_reg, is_src0_live;
 
                 refresh(bb, insn);
 
                 switch (insn->opcode) {
-                case OP_unwound_phi:
-                    src0 = prepare_operand(bb, insn->rs1, -1);
-
-                    if (!insn->rd->offset) {
-                        insn->rd->offset = bb->belong_to->func->stack_size;
-                        bb->belong_to->func->stack_size += 4;
-                    }
-
-                    ir = bb_add_ph2_ir(bb, OP_store);
-                    ir->src0 = src0;
-                    ir->src1 = insn->rd->offset;
-                    break;
                 case OP_allocat:
                     if ((!strcmp(insn->rd->type_name, "void") ||
                          !strcmp(insn->rd->type_name, "int") ||
@@ -383,7 +411,7 @@ void reg_alloc()
                     break;
                 case OP_load_constant:
                 case OP_load_data_address:
-                    if (insn->rd->consumed == -1)
+                    if (insn->rd->consumed == -1 && !in_memory(insn->rd))
                         break;
 
                     dest = prepare_dest(bb, insn->rd, -1, -1);
@@ -402,8 +430,9 @@ void reg_alloc()
                     break;
                 case OP_address_of:
                     /* make sure variable is on stack */
-                    if (!insn->rs1->offset) {
-                        insn->rs1->offset = bb->belong_to->func->stack_size;
+                    var = slot_of(insn->rs1);
+                    if (!var->offset) {
+                        var->offset = bb->belong_to->func->stack_size;
                         bb->belong_to->func->stack_size += 4;
 
                         int i;
@@ -411,20 +440,20 @@ void reg_alloc()
                             if (REGS[i].var == insn->rs1) {
                                 ir = bb_add_ph2_ir(bb, OP_store);
                                 ir->src0 = i;
-                                ir->src1 = insn->rs1->offset;
+                                ir->src1 = var->offset;
                             }
                     }
 
                     dest = prepare_dest(bb, insn->rd, -1, -1);
-                    if (insn->rs1->is_global)
+                    if (var->is_global)
                         ir = bb_add_ph2_ir(bb, OP_global_address_of);
                     else
                         ir = bb_add_ph2_ir(bb, OP_address_of);
-                    ir->src0 = insn->rs1->offset;
+                    ir->src0 = var->offset;
                     ir->dest = dest;
                     break;
                 case OP_assign:
-                    if (insn->rd->consumed == -1)
+                    if (insn->rd->consumed == -1 && !in_memory(insn->rd))
                         break;
 
                     src0 = find_in_regs(insn->rs1);
@@ -442,6 +471,7 @@ void reg_alloc()
                     ir = bb_add_ph2_ir(bb, OP_assign);
                     ir->src0 = src0;
                     ir->dest = dest;
+                    ir->is_src0_live = is_live_after(bb, insn, insn->rs1);
 
                     /* store global variable immediately after assignment */
                     if (insn->rd->is_global) {
@@ -468,7 +498,7 @@ void reg_alloc()
                         src0 = prepare_operand(bb, insn->rs1, -1);
                         ir = bb_add_ph2_ir(bb, OP_address_of_func);
                         ir->src0 = src0;
-                        strcpy(ir->func_name, insn->rs2->var_name);
+                        ir->func_name = insn->rs2->var_name;
                     } else {
                         /* FIXME: Avoid outdated content in register after
                          * storing, but causing some redundant spilling. */
@@ -495,6 +525,7 @@ void reg_alloc()
                     ir->else_bb = bb->else_;
                     break;
                 case OP_push:
+                    is_src0_live = is_live_after(bb, insn, insn->rs1);
                     extend_liveness(bb, insn, insn->rs1, insn->sz);
 
                     if (!is_pushing_args) {
@@ -506,6 +537,7 @@ void reg_alloc()
                     ir = bb_add_ph2_ir(bb, OP_assign);
                     ir->src0 = src0;
                     ir->dest = args++;
+                    ir->is_src0_live = is_src0_live;
                     REGS[ir->dest].var = insn->rs1;
                     REGS[ir->dest].polluted = 0;
                     break;
@@ -515,7 +547,7 @@ void reg_alloc()
                         spill_alive(bb, insn);
 
                     ir = bb_add_ph2_ir(bb, OP_call);
-                    strcpy(ir->func_name, insn->str);
+                    ir->func_name = insn->str;
 
                     is_pushing_args = 0;
                     args = 0;
@@ -523,6 +555,13 @@ void reg_alloc()
                     for (i = 0; i < REG_CNT; i++)
                         REGS[i].var = NULL;
 
+                    break;
+                case OP_tail_call:
+                    ir = bb_add_ph2_ir(bb, OP_tail_call);
+                    ir->func_name = insn->str;
+
+                    is_pushing_args = 0;
+                    args = 0;
                     break;
                 case OP_indirect:
                     if (!args)
@@ -591,6 +630,13 @@ void reg_alloc()
                     printf("Unknown opcode\n");
                     abort();
                 }
+
+                /* a pointer may read it before the register is spilled */
+                if (insn->rd && in_memory(insn->rd)) {
+                    i = find_in_regs(insn->rd);
+                    if (i > -1)
+                        spill_var(bb, insn->rd, i);
+                }
             }
 
             if (bb->next)
@@ -615,16 +661,16 @@ void reg_alloc()
         }
 
         /* handle implicit return */
-        for (i = 0; i < MAX_BB_PRED; i++) {
-            basic_block_t *bb = fn->exit->prev[i].bb;
-            if (!bb)
-                continue;
+        bb_connection_t *prev = fn->exit->prev;
+        for (i = 0; i < fn->exit->prev_idx; i++) {
+            basic_block_t *bb = prev[i].bb;
 
             if (strcmp(fn->func->return_def.type_name, "void"))
                 continue;
 
             if (bb->insn_list.tail)
-                if (bb->insn_list.tail->opcode == OP_return)
+                if (bb->insn_list.tail->opcode == OP_return ||
+                    bb->insn_list.tail->opcode == OP_tail_call)
                     continue;
 
             ph2_ir_t *ir = bb_add_ph2_ir(bb, OP_return);
@@ -675,11 +721,14 @@ void dump_ph2_ir()
             printf("\tbr %%x%c", rs1);
             break;
         case OP_jump:
-            printf("\tj %s", ph2_ir->func_name);
+            printf("\tj");
             break;
         case OP_call:
             printf("\tcall @%s", ph2_ir->func_name);
             break;
+        case OP_tail_call:
+            printf("\ttail call @%s", ph2_ir->func_name);
+            break;
         case OP_return:
             if (ph2_ir->src0 == -1)
                 printf("\tret");
@@ -61,7 +61,6 @@ void update_elf_offset(ph2_ir_t *ph2_ir)
     case OP_bit_or:
     case OP_bit_xor:
     case OP_negate:
-    case OP_log_and:
     case OP_bit_not:
         elf_offset += 4;
         return;
@@ -75,6 +74,7 @@ void update_elf_offset(ph2_ir_t *ph2_ir)
         return;
     case OP_address_of_func:
     case OP_eq:
+    case OP_log_and:
         elf_offset += 12;
         return;
     case OP_branch:
@@ -83,6 +83,9 @@ void update_elf_offset(ph2_ir_t *ph2_ir)
     case OP_return:
         elf_offset += 24;
         return;
+    case OP_tail_call:
+        elf_offset += 20;
+        return;
     default:
         printf("Unknown opcode\n");
         abort();
@@ -112,6 +115,7 @@ void cfg_flatten()
         /* reserve stack */
         flatten_ir = add_ph2_ir(OP_define);
         flatten_ir->src0 = fn->func->stack_size;
+        flatten_ir->func_name = fn->func->return_def.var_name;
 
         basic_block_t *bb;
         for (bb = fn->bbs; bb; bb = bb->rpo_next) {
@@ -126,7 +130,7 @@ void cfg_flatten()
                 flatten_ir = add_ph2_ir(OP_generic);
                 memcpy(flatten_ir, insn, sizeof(ph2_ir_t));
 
-                if (insn->op == OP_return)
+                if (insn->op == OP_return || insn->op == OP_tail_call)
                     /* restore sp */
                     flatten_ir->src1 = bb->belong_to->func->stack_size;
 
@@ -134,6 +138,9 @@ void cfg_flatten()
             }
         }
     }
+
+    /* functions taken from the prebuilt libc image */
+    libc_image_layout();
 }
 
 void emit(int code)
@@ -267,6 +274,14 @@ void emit_ph2_ir(ph2_ir_t *ph2_ir)
     case OP_indirect:
         emit(__jalr(__ra, __t0, 0));
         return;
+    case OP_tail_call:
+        func = find_func(ph2_ir->func_name);
+        emit(__lw(__ra, __sp, 0));
+        emit(__lui(__t0, rv_hi(ph2_ir->src1 + 4)));
+        emit(__addi(__t0, __t0, rv_lo(ph2_ir->src1 + 4)));
+        emit(__add(__sp, __sp, __t0));
+        emit(__jal(__zero, func->fn->bbs->elf_offset - elf_code_idx));
+        return;
     case OP_return:
         if (ph2_ir->src0 == -1)
             emit(__addi(__zero, __zero, 0));
@@ -342,8 +357,10 @@ void emit_ph2_ir(ph2_ir_t *ph2_ir)
         emit(__xori(rd, rd, 1));
         return;
     case OP_log_and:
-        /* FIXME: bad logical-and instruction */
-        emit(__and(rd, rs1, rs2));
+        /* normalize both operands to 0/1 before masking them */
+        emit(__sltu(__t0, __zero, rs1));
+        emit(__sltu(rd, __zero, rs2));
+        emit(__and(rd, rd, __t0));
         return;
     case OP_log_or:
         emit(__or(rd, rs1, rs2));
@@ -397,11 +414,18 @@ void code_generate()
     emit(__add(__t0, __gp, __t0));
     emit(__lw(__a0, __t0, 0));
     emit(__addi(__a1, __t0, 4));
-    emit(__jal(__zero, MAIN_BB->elf_offset - elf_code_idx));
+    if (MAIN_BB)
+        emit(__jal(__zero, MAIN_BB->elf_offset - elf_code_idx));
+    else
+        /* building the libc image, which has no `main` */
+        emit(__jal(__zero, 0));
 
     int i;
     for (i = 0; i < ph2_ir_idx; i++) {
         ph2_ir = &PH2_IR[i];
+        libc_image_record(ph2_ir);
         emit_ph2_ir(ph2_ir);
     }
+
+    libc_image_emit();
 }
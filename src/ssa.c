@@ -48,16 +48,15 @@ void bb_backward_traversal(bb_traversal_args_t *args)
     if (args->preorder_cb)
         args->preorder_cb(args->fn, args->bb);
 
+    bb_connection_t *prev = args->bb->prev;
     int i;
-    for (i = 0; i < MAX_BB_PRED; i++) {
-        if (!args->bb->prev[i].bb)
-            continue;
-        if (args->bb->prev[i].bb->visited < args->fn->visited) {
+    for (i = 0; i < args->bb->prev_idx; i++) {
+        if (prev[i].bb->visited < args->fn->visited) {
             /* 'args' is a reference, do not modify it */
             bb_traversal_args_t next_args;
             memcpy(&next_args, args, sizeof(bb_traversal_args_t));
 
-            next_args.bb = args->bb->prev[i].bb;
+            next_args.bb = prev[i].bb;
             bb_backward_traversal(&next_args);
         }
     }
@@ -144,46 +143,65 @@ basic_block_t *intersect(basic_block_t *i, basic_block_t *j)
  *   Cooper, Keith D.; Harvey, Timothy J.; Kennedy, Ken (2001).
  *   "A Simple, Fast Dominance Algorithm"
  */
-void build_idom()
+void fn_build_idom(fn_t *fn)
 {
-    fn_t *fn;
-    for (fn = FUNC_LIST.head; fn; fn = fn->next) {
-        int changed;
+    int changed;
 
-        fn->bbs->idom = fn->bbs;
+    fn->bbs->idom = fn->bbs;
 
-        do {
-            changed = 0;
+    do {
+        changed = 0;
 
-            basic_block_t *bb;
-            for (bb = fn->bbs->rpo_next; bb; bb = bb->rpo_next) {
-                /* pick one predecessor */
-                basic_block_t *pred;
-                int i;
-                for (i = 0; i < MAX_BB_PRED; i++) {
-                    if (!bb->prev[i].bb)
-                        continue;
-                    if (!bb->prev[i].bb->idom)
-                        continue;
-                    pred = bb->prev[i].bb;
-                    break;
-                }
+        basic_block_t *bb;
+        for (bb = fn->bbs->rpo_next; bb; bb = bb->rpo_next) {
+            /* pick one predecessor */
+            bb_connection_t *prev = bb->prev;
+            basic_block_t *pred;
+            int i;
+            for (i = 0; i < bb->prev_idx; i++) {
+                if (!prev[i].bb->idom)
+                    continue;
+                pred = prev[i].bb;
+                break;
+            }
 
-                for (i = 0; i < MAX_BB_PRED; i++) {
-                    if (!bb->prev[i].bb)
-                        continue;
-                    if (bb->prev[i].bb == pred)
-                        continue;
-                    if (bb->prev[i].bb->idom)
-                        pred = intersect(bb->prev[i].bb, pred);
-                }
-                if (bb->idom != pred) {
-                    bb->idom = pred;
-                    changed = 1;
-                }
+            for (i = 0; i < bb->prev_idx; i++) {
+                if (prev[i].bb == pred)
+                    continue;
+                if (prev[i].bb->idom)
+                    pred = intersect(prev[i].bb, pred);
             }
-        } while (changed);
+            if (bb->idom != pred) {
+                bb->idom = pred;
+                changed = 1;
+            }
+        }
+    } while (changed);
+}
+
+void build_idom()
+{
+    fn_t *fn;
+    for (fn = FUNC_LIST.head; fn; fn = fn->next)
+        fn_build_idom(fn);
+}
+
+/* Append @item to the growable pointer list @list of @idx entries and @cap
+ * capacity, returns the list, which may have moved.
+ */
+void *list_add(void *list, int idx, int *cap, void *item)
+{
+    void **old_list = list, **new_list = list;
+    int i;
+
+    if (idx == cap[0]) {
+        cap[0] = cap[0] ? cap[0] * 2 : 2;
+        new_list = arena_alloc(INSN_ARENA, cap[0] * HOST_PTR_SIZE);
+        for (i = 0; i < idx; i++)
+            new_list[i] = old_list[i];
     }
+    new_list[idx] = item;
+    return new_list;
 }
 
 int dom_connect(basic_block_t *pred, basic_block_t *succ)
@@ -191,20 +209,16 @@ int dom_connect(basic_block_t *pred, basic_block_t *succ)
     if (succ->dom_prev)
         return 0;
 
+    basic_block_t **dom_next = pred->dom_next;
     int i;
-    for (i = 0; i < MAX_BB_DOM_SUCC; i++) {
-        if (pred->dom_next[i] == succ)
+    for (i = 0; i < pred->dom_next_idx; i++) {
+        if (dom_next[i] == succ)
             return 0;
-        if (!pred->dom_next[i])
-            break;
     }
 
-    if (i > MAX_BB_DOM_SUCC - 1) {
-        printf("Error: too many predecessors\n");
-        abort();
-    }
-
-    pred->dom_next[i++] = succ;
+    pred->dom_next =
+        list_add(dom_next, pred->dom_next_idx, &pred->dom_next_cap, succ);
+    pred->dom_next_idx++;
     succ->dom_prev = pred;
     return 1;
 }
@@ -219,6 +233,19 @@ void bb_build_dom(fn_t *fn, basic_block_t *bb)
     }
 }
 
+/* Rebuild the dominator tree of @fn from the immediate dominators */
+void fn_build_dom(fn_t *fn)
+{
+    basic_block_t *bb;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        bb->dom_next_idx = 0;
+        bb->dom_prev = NULL;
+    }
+    for (bb = fn->bbs->rpo_next; bb; bb = bb->rpo_next)
+        dom_connect(bb->idom, bb);
+}
+
 void build_dom()
 {
     fn_t *fn;
@@ -238,18 +265,18 @@ void bb_build_df(fn_t *fn, basic_block_t *bb)
 {
     UNUSED(fn);
 
-    int i, cnt = 0;
-    for (i = 0; i < MAX_BB_PRED; i++)
-        if (bb->prev[i].bb)
-            cnt++;
+    bb_connection_t *prev = bb->prev;
+    int i;
 
-    if (cnt > 1)
-        for (i = 0; i < MAX_BB_PRED; i++)
-            if (bb->prev[i].bb) {
-                basic_block_t *curr;
-                for (curr = bb->prev[i].bb; curr != bb->idom; curr = curr->idom)
-                    curr->DF[curr->df_idx++] = bb;
+    if (bb->prev_idx > 1)
+        for (i = 0; i < bb->prev_idx; i++) {
+            basic_block_t *curr;
+            for (curr = prev[i].bb; curr != bb->idom; curr = curr->idom) {
+                curr->DF =
+                    list_add(curr->DF, curr->df_idx, &curr->df_cap, bb);
+                curr->df_idx++;
             }
+        }
 }
 
 void build_df()
@@ -267,30 +294,34 @@ void build_df()
     free(args);
 }
 
-int var_check_killed(var_t *var, basic_block_t *bb)
+/* Liveness sets are bitsets over the values used in a function, which are
+ * numbered densely by live_id. Global variables are never live across blocks
+ * and have no number.
+ */
+int bitset_test(int *set, int id)
 {
-    int i;
-    for (i = 0; i < bb->live_kill_idx; i++) {
-        if (bb->live_kill[i] == var)
-            return 1;
-    }
-    return 0;
+    if (id < 0)
+        return 0;
+
+    int word = set[id >> 5];
+    return (word >> (id & 31)) & 1;
 }
 
-void bb_add_killed_var(basic_block_t *bb, var_t *var)
+void bitset_add(int *set, int id)
 {
-    int i, found = 0;
-    for (i = 0; i < bb->live_kill_idx; i++) {
-        if (bb->live_kill[i] == var) {
-            found = 1;
-            break;
-        }
-    }
+    int i = id >> 5;
+    set[i] = set[i] | (1 << (id & 31));
+}
 
-    if (found)
-        return;
+int var_check_killed(var_t *var, basic_block_t *bb)
+{
+    return bitset_test(bb->live_kill, var->live_id);
+}
 
-    bb->live_kill[bb->live_kill_idx++] = var;
+void bb_add_killed_var(basic_block_t *bb, var_t *var)
+{
+    if (var->live_id >= 0)
+        bitset_add(bb->live_kill, var->live_id);
 }
 
 void var_add_killed_bb(var_t *var, basic_block_t *bb)
@@ -307,7 +338,7 @@ void var_add_killed_bb(var_t *var, basic_block_t *bb)
     if (found)
         return;
 
-    ref = calloc(1, sizeof(ref_block_t));
+    ref = arena_alloc(INSN_ARENA, sizeof(ref_block_t));
     ref->bb = bb;
     if (!var->ref_block_list.head)
         var->ref_block_list.head = ref;
@@ -331,7 +362,7 @@ void fn_add_global(fn_t *fn, var_t *var)
     if (found)
         return;
 
-    sym = calloc(1, sizeof(symbol_t));
+    sym = arena_alloc(INSN_ARENA, sizeof(symbol_t));
     sym->var = var;
     if (!fn->global_sym_list.head) {
         sym->index = 0;
@@ -344,23 +375,235 @@ void fn_add_global(fn_t *fn, var_t *var)
     }
 }
 
-void bb_solve_globals(fn_t *fn, basic_block_t *bb)
+void reset_live_id(var_t *var)
+{
+    if (var)
+        var->live_id = -1;
+}
+
+void bb_reset_live_ids(fn_t *fn, basic_block_t *bb)
 {
     UNUSED(fn);
 
+    insn_t *insn;
+    for (insn = bb->insn_list.head; insn; insn = insn->next) {
+        reset_live_id(insn->rd);
+        reset_live_id(insn->rs1);
+        reset_live_id(insn->rs2);
+    }
+}
+
+void number_var(fn_t *fn, var_t *var, int with_globals)
+{
+    if (!var || var->live_id >= 0)
+        return;
+    if (var->is_global && !with_globals)
+        return;
+    var->live_id = fn->live_vars;
+    fn->live_vars++;
+}
+
+/* Global variables are only numbered while the SSA is built. A global is
+ * shared by all functions, so its number would be stale afterwards.
+ */
+void bb_number_vars(fn_t *fn, basic_block_t *bb)
+{
+    insn_t *insn;
+    for (insn = bb->insn_list.head; insn; insn = insn->next) {
+        number_var(fn, insn->rd, 1);
+        number_var(fn, insn->rs1, 1);
+        number_var(fn, insn->rs2, 1);
+    }
+}
+
+void bb_number_live_vars(fn_t *fn, basic_block_t *bb)
+{
+    insn_t *insn;
+    for (insn = bb->insn_list.head; insn; insn = insn->next) {
+        number_var(fn, insn->rd, 0);
+        number_var(fn, insn->rs1, 0);
+        number_var(fn, insn->rs2, 0);
+    }
+}
+
+int live_words(fn_t *fn)
+{
+    return (fn->live_vars + 31) >> 5;
+}
+
+void bb_alloc_live_sets(fn_t *fn, basic_block_t *bb)
+{
+    int size = live_words(fn) * sizeof(int);
+
+    bb->live_gen = arena_alloc(INSN_ARENA, size);
+    bb->live_kill = arena_alloc(INSN_ARENA, size);
+    bb->live_in = arena_alloc(INSN_ARENA, size);
+    bb->live_out = arena_alloc(INSN_ARENA, size);
+}
+
+/* Blocks only reachable backward from the exit are given empty sets late */
+void bb_reserve_live_sets(fn_t *fn, basic_block_t *bb)
+{
+    if (!bb->live_in)
+        bb_alloc_live_sets(fn, bb);
+}
+
+/* Number the values used in @fn and give its blocks empty sets */
+void fn_number_vars(bb_traversal_args_t *args, int with_globals)
+{
+    fn_t *fn = args->fn;
+
+    args->preorder_cb = NULL;
+    args->postorder_cb = NULL;
+
+    fn->visited++;
+    args->preorder_cb = bb_reset_live_ids;
+    bb_forward_traversal(args);
+
+    fn->live_vars = 0;
+    fn->visited++;
+    if (with_globals)
+        args->preorder_cb = bb_number_vars;
+    else
+        args->preorder_cb = bb_number_live_vars;
+    bb_forward_traversal(args);
+
+    fn->visited++;
+    args->preorder_cb = bb_alloc_live_sets;
+    bb_forward_traversal(args);
+    args->preorder_cb = NULL;
+}
+
+void add_live_gen(basic_block_t *bb, var_t *var)
+{
+    if (var->is_global)
+        return;
+
+    bitset_add(bb->live_gen, var->live_id);
+}
+
+/* live_in = gen | (live_out - kill), returns whether live_in changed */
+int update_live_in(fn_t *fn, basic_block_t *bb)
+{
+    int *in, *out, *gen, *kill, word, i, changed = 0;
+
+    in = bb->live_in;
+    out = bb->live_out;
+    gen = bb->live_gen;
+    kill = bb->live_kill;
+    for (i = live_words(fn) - 1; i >= 0; i--) {
+        word = gen[i] | (out[i] & ~kill[i]);
+        if (in[i] != word) {
+            in[i] = word;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+void merge_live_in(fn_t *fn, int *live_out, basic_block_t *bb)
+{
+    int *in, i;
+
+    bb_reserve_live_sets(fn, bb);
+    in = bb->live_in;
+    for (i = live_words(fn) - 1; i >= 0; i--)
+        live_out[i] = live_out[i] | in[i];
+}
+
+/* live_out is the union of the cached live_in of the successors, returns
+ * whether it changed. @live_out is scratch space for the new set.
+ */
+int recompute_live_out(fn_t *fn, basic_block_t *bb, int *live_out)
+{
+    int *out, i, changed = 0;
+
+    for (i = live_words(fn) - 1; i >= 0; i--)
+        live_out[i] = 0;
+    if (bb->next)
+        merge_live_in(fn, live_out, bb->next);
+    if (bb->then_)
+        merge_live_in(fn, live_out, bb->then_);
+    if (bb->else_)
+        merge_live_in(fn, live_out, bb->else_);
+
+    out = bb->live_out;
+    for (i = live_words(fn) - 1; i >= 0; i--) {
+        if (out[i] != live_out[i]) {
+            out[i] = live_out[i];
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/* Solve the liveness of @fn with a worklist seeded with the @count blocks in
+ * @blocks, best given in postorder. Only the predecessors of a block whose
+ * live_in changed are visited again.
+ */
+void solve_liveness(fn_t *fn, basic_block_t **blocks, int count)
+{
+    basic_block_t **queue, *bb;
+    int *live_out, head = 0, tail = 0, size = count + 1, i;
+
+    queue = arena_alloc(INSN_ARENA, size * HOST_PTR_SIZE);
+    live_out = arena_alloc(INSN_ARENA, live_words(fn) * sizeof(int));
+
+    for (i = 0; i < count; i++) {
+        bb = blocks[i];
+        bb_reserve_live_sets(fn, bb);
+        update_live_in(fn, bb);
+        bb->live_queued = 1;
+        queue[tail] = bb;
+        tail++;
+    }
+
+    while (head != tail) {
+        bb = queue[head];
+        head = (head + 1) % size;
+        bb->live_queued = 0;
+
+        if (!recompute_live_out(fn, bb, live_out))
+            continue;
+        if (!update_live_in(fn, bb))
+            continue;
+
+        /* predecessors outside the seeded blocks have no sets */
+        bb_connection_t *prev = bb->prev;
+        for (i = 0; i < bb->prev_idx; i++) {
+            basic_block_t *pred = prev[i].bb;
+            if (!pred->live_in || pred->live_queued)
+                continue;
+            pred->live_queued = 1;
+            queue[tail] = pred;
+            tail = (tail + 1) % size;
+        }
+    }
+}
+
+/* Values used before being assigned in a block are live-in, which is also
+ * how the SSA finds the variables living across blocks.
+ */
+void bb_solve_globals(fn_t *fn, basic_block_t *bb)
+{
     insn_t *insn;
     for (insn = bb->insn_list.head; insn; insn = insn->next) {
         if (insn->rs1)
-            if (!var_check_killed(insn->rs1, bb))
+            if (!var_check_killed(insn->rs1, bb)) {
                 fn_add_global(bb->belong_to, insn->rs1);
+                add_live_gen(bb, insn->rs1);
+            }
         if (insn->rs2)
-            if (!var_check_killed(insn->rs2, bb))
+            if (!var_check_killed(insn->rs2, bb)) {
                 fn_add_global(bb->belong_to, insn->rs2);
+                add_live_gen(bb, insn->rs2);
+            }
         if (insn->rd) {
             bb_add_killed_var(bb, insn->rd);
             var_add_killed_bb(insn->rd, bb);
         }
     }
+    update_live_in(fn, bb);
 }
 
 void solve_globals()
@@ -370,10 +613,25 @@ void solve_globals()
     for (fn = FUNC_LIST.head; fn; fn = fn->next) {
         args->fn = fn;
         args->bb = fn->bbs;
+        fn_number_vars(args, 1);
 
         fn->visited++;
         args->postorder_cb = bb_solve_globals;
         bb_forward_traversal(args);
+        args->postorder_cb = NULL;
+
+        /* liveness of the variables before renaming, to prune the phis */
+        basic_block_t **blocks, *bb;
+        int count = 0, i;
+        for (bb = fn->bbs; bb; bb = bb->rpo_next)
+            count++;
+        blocks = arena_alloc(INSN_ARENA, count * HOST_PTR_SIZE);
+        i = count;
+        for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+            i--;
+            blocks[i] = bb;
+        }
+        solve_liveness(fn, blocks, count);
     }
     free(args);
 }
@@ -384,9 +642,9 @@ int var_check_in_scope(var_t *var, block_t *block)
 
     while (block) {
         int i;
+        var_t **locals = block->locals;
         for (i = 0; i < block->next_local; i++) {
-            var_t *locals = block->locals;
-            if (var == &locals[i])
+            if (var == locals[i])
                 return 1;
         }
         block = block->parent;
@@ -415,7 +673,7 @@ int insert_phi_insn(basic_block_t *bb, var_t *var)
         return 0;
 
     insn_t *head = bb->insn_list.head;
-    insn_t *n = calloc(1, sizeof(insn_t));
+    insn_t *n = arena_alloc(INSN_ARENA, sizeof(insn_t));
     n->opcode = OP_phi;
     n->rd = var;
     n->rs1 = var;
@@ -425,6 +683,7 @@ int insert_phi_insn(basic_block_t *bb, var_t *var)
         bb->insn_list.tail = n;
     } else {
         n->next = head;
+        head->prev = n;
         bb->insn_list.head = n;
     }
     return 1;
@@ -438,19 +697,23 @@ void solve_phi_insertion()
         for (sym = fn->global_sym_list.head; sym; sym = sym->next) {
             var_t *var = sym->var;
 
-            basic_block_t *work_list[64];
-            int work_list_idx = 0;
+            basic_block_t **work_list = NULL;
+            int work_list_idx = 0, work_list_cap = 0;
 
             ref_block_t *ref;
-            for (ref = var->ref_block_list.head; ref; ref = ref->next)
-                work_list[work_list_idx++] = ref->bb;
+            for (ref = var->ref_block_list.head; ref; ref = ref->next) {
+                work_list = list_add(work_list, work_list_idx,
+                                     &work_list_cap, ref->bb);
+                work_list_idx++;
+            }
 
             int i;
             for (i = 0; i < work_list_idx; i++) {
                 basic_block_t *bb = work_list[i];
+                basic_block_t **frontier = bb->DF;
                 int j;
                 for (j = 0; j < bb->df_idx; j++) {
-                    basic_block_t *df = bb->DF[j];
+                    basic_block_t *df = frontier[j];
                     if (!var_check_in_scope(var, df->scope))
                         continue;
 
@@ -468,6 +731,10 @@ void solve_phi_insertion()
                     if (df == fn->exit)
                         continue;
 
+                    /* pruned SSA, no phi where the variable is dead */
+                    if (!bitset_test(df->live_in, var->live_id))
+                        continue;
+
                     if (var->is_global)
                         continue;
 
@@ -488,8 +755,11 @@ void solve_phi_insertion()
                                 found = 1;
                                 break;
                             }
-                        if (!found)
-                            work_list[work_list_idx++] = df;
+                        if (!found) {
+                            work_list = list_add(work_list, work_list_idx,
+                                                 &work_list_cap, df);
+                            work_list_idx++;
+                        }
                     }
                 }
             }
@@ -499,6 +769,55 @@ void solve_phi_insertion()
 
 var_t *require_var(block_t *blk);
 
+/* Make room for one more SSA version of @var. Its rename stack never holds
+ * more entries than there are versions, so both share the same capacity.
+ */
+void reserve_subscript(var_t *var)
+{
+    var_t **subscripts, **old_subscripts = var->subscripts;
+    int *stack, *old_stack = var->rename.stack, cap, i;
+
+    if (var->subscripts_idx < var->subscripts_cap &&
+        var->rename.stack_idx < var->subscripts_cap)
+        return;
+
+    cap = var->subscripts_cap ? var->subscripts_cap * 2 : 4;
+    subscripts = arena_alloc(INSN_ARENA, cap * HOST_PTR_SIZE);
+    stack = arena_alloc(INSN_ARENA, cap * sizeof(int));
+    for (i = 0; i < var->subscripts_idx; i++)
+        subscripts[i] = old_subscripts[i];
+    for (i = 0; i < var->rename.stack_idx; i++)
+        stack[i] = old_stack[i];
+    var->subscripts = subscripts;
+    var->rename.stack = stack;
+    var->subscripts_cap = cap;
+}
+
+/* Record @version as the SSA version of @base with the next subscript, and
+ * push that subscript onto the rename stack of @base.
+ */
+void push_subscript(var_t *base, var_t *version)
+{
+    var_t **subscripts;
+    int *stack;
+
+    reserve_subscript(base);
+    subscripts = base->subscripts;
+    stack = base->rename.stack;
+    subscripts[base->subscripts_idx++] = version;
+    stack[base->rename.stack_idx++] = base->rename.counter++;
+}
+
+/* versions are appended in the order of their subscripts */
+var_t *get_subscript(var_t *base, int sub)
+{
+    var_t **subscripts = base->subscripts;
+
+    if (sub >= base->subscripts_idx || subscripts[sub]->subscript != sub)
+        abort();
+    return subscripts[sub];
+}
+
 void new_name(block_t *block, var_t **var)
 {
     var_t *v = *var;
@@ -507,13 +826,11 @@ void new_name(block_t *block, var_t **var)
     if (v->is_global)
         return;
 
-    int i = v->base->rename.counter++;
-    v->base->rename.stack[v->base->rename.stack_idx++] = i;
     var_t *vd = require_var(block);
     memcpy(vd, *var, sizeof(var_t));
     vd->base = *var;
-    vd->subscript = i;
-    v->subscripts[v->subscripts_idx++] = vd;
+    vd->subscript = v->base->rename.counter;
+    push_subscript(v->base, vd);
     var[0] = vd;
 }
 
@@ -522,14 +839,8 @@ var_t *get_stack_top_subscript_var(var_t *var)
     if (var->base->rename.stack_idx < 1)
         error("Index is less than 1");
 
-    int sub = var->base->rename.stack[var->base->rename.stack_idx - 1];
-    int i;
-    for (i = 0; i < var->base->subscripts_idx; i++) {
-        if (var->base->subscripts[i]->subscript == sub)
-            return var->base->subscripts[i];
-    }
-
-    abort();
+    int *stack = var->base->rename.stack;
+    return get_subscript(var->base, stack[var->base->rename.stack_idx - 1]);
 }
 
 void rename_var(var_t **var)
@@ -552,7 +863,7 @@ void pop_name(var_t *var)
 
 void append_phi_operand(insn_t *insn, var_t *var, basic_block_t *bb_from)
 {
-    phi_operand_t *op = calloc(1, sizeof(phi_operand_t));
+    phi_operand_t *op = arena_alloc(INSN_ARENA, sizeof(phi_operand_t));
     op->from = bb_from;
     op->var = get_stack_top_subscript_var(var);
 
@@ -600,12 +911,10 @@ void bb_solve_phi_params(basic_block_t *bb)
                 append_phi_operand(insn, insn->rd, bb);
     }
 
+    basic_block_t **dom_next = bb->dom_next;
     int i;
-    for (i = 0; i < MAX_BB_DOM_SUCC; i++) {
-        if (!bb->dom_next[i])
-            break;
-        bb_solve_phi_params(bb->dom_next[i]);
-    }
+    for (i = 0; i < bb->dom_next_idx; i++)
+        bb_solve_phi_params(dom_next[i]);
 
     for (insn = bb->insn_list.head; insn; insn = insn->next) {
         if (insn->opcode == OP_phi)
@@ -628,79 +937,13 @@ void solve_phi_params()
             var->base = base;
             var->subscript = 0;
 
-            base->rename.stack[base->rename.stack_idx++] =
-                base->rename.counter++;
-            base->subscripts[base->subscripts_idx++] = var;
+            push_subscript(base, var);
         }
 
         bb_solve_phi_params(fn->bbs);
     }
 }
 
-void append_unwound_phi_insn(basic_block_t *bb, var_t *dest, var_t *rs)
-{
-    insn_t *n = calloc(1, sizeof(insn_t));
-    n->opcode = OP_unwound_phi;
-    n->rd = dest;
-    n->rs1 = rs;
-
-    insn_t *tail = bb->insn_list.tail;
-    if (!tail) {
-        bb->insn_list.head = n;
-        bb->insn_list.tail = n;
-    } else {
-        /* insert it before branch instruction */
-        if (tail->opcode == OP_branch) {
-            if (tail->prev) {
-                tail->prev->next = n;
-                n->prev = tail->prev;
-            } else
-                bb->insn_list.head = n;
-
-            n->next = tail;
-            tail->prev = n;
-        } else {
-            tail->next = n;
-            bb->insn_list.tail = n;
-        }
-    }
-}
-
-void bb_unwind_phi(fn_t *fn, basic_block_t *bb)
-{
-    UNUSED(fn);
-
-    insn_t *insn;
-    for (insn = bb->insn_list.head; insn; insn = insn->next) {
-        if (insn->opcode != OP_phi)
-            break;
-
-        phi_operand_t *operand;
-        for (operand = insn->phi_ops; operand; operand = operand->next)
-            append_unwound_phi_insn(operand->from, insn->rd, operand->var);
-        /* TODO: Release dangling phi instruction */
-    }
-
-    bb->insn_list.head = insn;
-    if (!insn)
-        bb->insn_list.tail = NULL;
-}
-
-void unwind_phi()
-{
-    fn_t *fn;
-    bb_traversal_args_t *args = calloc(1, sizeof(bb_traversal_args_t));
-    for (fn = FUNC_LIST.head; fn; fn = fn->next) {
-        args->fn = fn;
-        args->bb = fn->bbs;
-
-        fn->visited++;
-        args->preorder_cb = bb_unwind_phi;
-        bb_forward_traversal(args);
-    }
-    free(args);
-}
-
 /*
  * The current cfonrt does not yet support string literal addressing, which
  * results in the omission of basic block visualization during the stage-1 and
@@ -972,10 +1215,10 @@ void bb_dump(FILE *fd, fn_t *fn, basic_block_t *bb)
         bb_dump_connection(fd, bb, bb->else_, ELSE);
     }
 
+    bb_connection_t *prev = bb->prev;
     int i;
-    for (i = 0; i < MAX_BB_PRED; i++)
-        if (bb->prev[i].bb)
-            bb_dump_connection(fd, bb->prev[i].bb, bb, bb->prev[i].type);
+    for (i = 0; i < bb->prev_idx; i++)
+        bb_dump_connection(fd, prev[i].bb, bb, prev[i].type);
 }
 
 void dump_cfg(char name[])
@@ -999,12 +1242,11 @@ void dump_cfg(char name[])
 void dom_dump(FILE *fd, basic_block_t *bb)
 {
     fprintf(fd, "\"%p\"\n", bb);
+    basic_block_t **dom_next = bb->dom_next;
     int i;
-    for (i = 0; i < MAX_BB_DOM_SUCC; i++) {
-        if (!bb->dom_next[i])
-            break;
-        dom_dump(fd, bb->dom_next[i]);
-        fprintf(fd, "\"%p\":s->\"%p\":n\n", bb, bb->dom_next[i]);
+    for (i = 0; i < bb->dom_next_idx; i++) {
+        dom_dump(fd, dom_next[i]);
+        fprintf(fd, "\"%p\":s->\"%p\":n\n", bb, dom_next[i]);
     }
 }
 
@@ -1045,174 +1287,3456 @@ void ssa_build(int dump_ir)
         dump_dom("DOM.dot");
     }
 #endif
-
-    unwind_phi();
 }
 
-/* Common Subexpression Elimination (CSE) */
-/* TODO: simplify with def-use chain */
-/* TODO: release detached insns node */
-int cse(insn_t *insn, basic_block_t *bb)
+/* Def-use chains of the renamed variables. Each variable records its
+ * defining instruction and the instructions reading it, which passes keep up
+ * to date through the helpers below when they rewrite instructions. Global
+ * variables are not tracked, and the variables of unwound phis are defined
+ * once per predecessor.
+ */
+void var_add_use(var_t *var, insn_t *insn)
 {
-    if (insn->opcode != OP_read)
-        return 0;
+    use_t *use;
 
-    insn_t *prev = insn->prev;
+    if (!var || var->is_global)
+        return;
 
-    if (!prev)
-        return 0;
-    if (prev->opcode != OP_add)
-        return 0;
-    if (prev->rd != insn->rs1)
-        return 0;
+    use = arena_alloc(INSN_ARENA, sizeof(use_t));
+    use->insn = insn;
+    use->next = var->uses;
+    var->uses = use;
+}
 
-    var_t *def = NULL, *base = prev->rs1, *idx = prev->rs2;
-    if (base->is_global || idx->is_global)
-        return 0;
+void var_remove_use(var_t *var, insn_t *insn)
+{
+    use_t *use, *prev = NULL;
 
-    basic_block_t *b;
-    insn_t *i = prev;
-    for (b = bb;; b = b->idom) {
-        if (!i)
-            i = b->insn_list.tail;
+    if (!var || var->is_global)
+        return;
 
-        for (; i; i = i->prev) {
-            if (i == prev)
-                continue;
-            if (i->opcode != OP_add)
-                continue;
-            if (!i->next)
-                continue;
-            if (i->next->opcode != OP_read)
-                continue;
-            if (i->rs1 != base || i->rs2 != idx)
-                continue;
-            def = i->next->rd;
+    for (use = var->uses; use; use = use->next) {
+        if (use->insn == insn) {
+            if (prev)
+                prev->next = use->next;
+            else
+                var->uses = use->next;
+            return;
         }
-        if (def)
-            break;
-        if (b->idom == b)
-            break;
+        prev = use;
     }
+}
 
-    if (!def)
-        return 0;
+/* The only instruction defining @var, or NULL */
+insn_t *var_def(var_t *var)
+{
+    if (var->def_cnt != 1)
+        return NULL;
+    return var->def;
+}
 
-    if (prev->prev) {
-        insn->prev = prev->prev;
-        prev->prev->next = insn;
-    } else {
-        bb->insn_list.head = insn;
-        insn->prev = NULL;
-    }
+void insn_set_rs1(insn_t *insn, var_t *var)
+{
+    var_remove_use(insn->rs1, insn);
+    insn->rs1 = var;
+    var_add_use(var, insn);
+}
 
-    insn->opcode = OP_assign;
-    insn->rs1 = def;
-    return 1;
+void insn_set_rs2(insn_t *insn, var_t *var)
+{
+    var_remove_use(insn->rs2, insn);
+    insn->rs2 = var;
+    var_add_use(var, insn);
 }
 
-int mark_const(insn_t *insn)
+/* Drop the operand of @insn coming from @from, if it is a phi */
+void insn_remove_phi_operand(insn_t *insn, basic_block_t *from)
 {
-    if (insn->opcode == OP_load_constant) {
-        insn->rd->is_const = 1;
-        return 0;
-    }
-    if (insn->opcode != OP_assign)
+    phi_operand_t *op, *prev = NULL;
+
+    for (op = insn->phi_ops; op; op = op->next) {
+        if (op->from == from) {
+            if (prev)
+                prev->next = op->next;
+            else
+                insn->phi_ops = op->next;
+            var_remove_use(op->var, insn);
+            return;
+        }
+        prev = op;
+    }
+}
+
+/* Unlink @insn from @bb, its chains are left untouched */
+void bb_unlink_insn(basic_block_t *bb, insn_t *insn)
+{
+    if (bb->insn_list.head == insn)
+        bb->insn_list.head = insn->next;
+    else
+        insn->prev->next = insn->next;
+    if (bb->insn_list.tail == insn)
+        bb->insn_list.tail = insn->prev;
+    else
+        insn->next->prev = insn->prev;
+    insn->prev = NULL;
+    insn->next = NULL;
+}
+
+/* Link @insn into @bb after @pos, or at the head if @pos is NULL */
+void bb_insert_insn_after(basic_block_t *bb, insn_t *pos, insn_t *insn)
+{
+    insn->prev = pos;
+    if (pos) {
+        insn->next = pos->next;
+        pos->next = insn;
+    } else {
+        insn->next = bb->insn_list.head;
+        bb->insn_list.head = insn;
+    }
+    if (insn->next)
+        insn->next->prev = insn;
+    else
+        bb->insn_list.tail = insn;
+    insn->belong_to = bb;
+}
+
+/* Unlink @insn from @bb and drop it from the chains */
+void bb_remove_insn(basic_block_t *bb, insn_t *insn)
+{
+    phi_operand_t *op;
+
+    bb_unlink_insn(bb, insn);
+    if (insn->opcode == OP_phi) {
+        for (op = insn->phi_ops; op; op = op->next)
+            var_remove_use(op->var, insn);
+    } else {
+        var_remove_use(insn->rs1, insn);
+        var_remove_use(insn->rs2, insn);
+    }
+    if (insn->rd && !insn->rd->is_global) {
+        insn->rd->def_cnt--;
+        if (insn->rd->def == insn)
+            insn->rd->def = NULL;
+    }
+}
+
+void reset_def_use(var_t *var)
+{
+    if (!var)
+        return;
+    var->def = NULL;
+    var->def_cnt = 0;
+    var->uses = NULL;
+}
+
+/* Phi operands are read by the phi, which keeps the un-renamed variable in
+ * rs1 and rs2.
+ */
+void build_def_use(fn_t *fn)
+{
+    basic_block_t *bb;
+    insn_t *insn;
+    phi_operand_t *op;
+    int i;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            reset_def_use(insn->rd);
+            reset_def_use(insn->rs1);
+            reset_def_use(insn->rs2);
+            for (op = insn->phi_ops; op; op = op->next)
+                reset_def_use(op->var);
+        }
+    }
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        i = 0;
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            insn->belong_to = bb;
+            insn->idx = i++;
+            if (insn->opcode == OP_phi) {
+                for (op = insn->phi_ops; op; op = op->next)
+                    var_add_use(op->var, insn);
+            } else {
+                var_add_use(insn->rs1, insn);
+                var_add_use(insn->rs2, insn);
+            }
+            if (insn->rd && !insn->rd->is_global) {
+                insn->rd->def = insn;
+                insn->rd->def_cnt++;
+            }
+        }
+    }
+}
+
+/* Cut the edge from @pred to @succ, dropping its phi operands */
+void bb_cut_edge(basic_block_t *pred, basic_block_t *succ)
+{
+    insn_t *insn;
+
+    for (insn = succ->insn_list.head; insn; insn = insn->next)
+        if (insn->opcode == OP_phi)
+            insn_remove_phi_operand(insn, pred);
+    bb_disconnect(pred, succ);
+}
+
+/* Drop the blocks whose executable flag is clear from the CFG, except the
+ * exit block which always stays.
+ */
+void fn_remove_unreachable(fn_t *fn)
+{
+    basic_block_t *bb, *prev = NULL;
+    int i = 0;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        if (bb->executable || bb == fn->exit) {
+            prev = bb;
+            continue;
+        }
+        if (bb->next)
+            bb_cut_edge(bb, bb->next);
+        if (bb->then_)
+            bb_cut_edge(bb, bb->then_);
+        if (bb->else_)
+            bb_cut_edge(bb, bb->else_);
+        prev->rpo_next = bb->rpo_next;
+    }
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        bb->rpo = i;
+        i++;
+    }
+}
+
+/* Sparse conditional constant propagation (SCCP), after Wegman and Zadeck.
+ * Blocks are only evaluated once an edge into them is found executable, and
+ * variables start unknown and only drop down the lattice, so constants flow
+ * through phis, and branches on constants lose their dead edge. Variables
+ * whose address is taken are kept in memory and never propagated.
+ */
+int sccp_tracked(var_t *var)
+{
+    if (var->is_global || var->is_addr_taken)
+        return 0;
+    if (var->base && var->base->is_addr_taken)
+        return 0;
+    return 1;
+}
+
+void sccp_reset_var(var_t *var)
+{
+    if (!var)
+        return;
+    if (sccp_tracked(var) && var->def_cnt)
+        var->lattice = LATTICE_TOP;
+    else
+        var->lattice = LATTICE_BOTTOM;
+}
+
+void sccp_push_block(sccp_t *sccp, basic_block_t *bb)
+{
+    sccp->blocks =
+        list_add(sccp->blocks, sccp->blocks_idx, &sccp->blocks_cap, bb);
+    sccp->blocks_idx++;
+}
+
+void sccp_push_var(sccp_t *sccp, var_t *var)
+{
+    sccp->vars = list_add(sccp->vars, sccp->vars_idx, &sccp->vars_cap, var);
+    sccp->vars_idx++;
+}
+
+/* Move @var down to @state, which is met with its current value */
+void sccp_lower(sccp_t *sccp, var_t *var, lattice_t state, int val)
+{
+    if (state == LATTICE_TOP || var->lattice == LATTICE_BOTTOM)
+        return;
+    if (var->lattice == LATTICE_CONST) {
+        if (state == LATTICE_CONST && val == var->lattice_val)
+            return;
+        state = LATTICE_BOTTOM;
+    }
+    var->lattice = state;
+    var->lattice_val = val;
+    sccp_push_var(sccp, var);
+}
+
+int sccp_edge_executable(basic_block_t *from, basic_block_t *to)
+{
+    if (from->next == to && (from->exec_edges & (1 << NEXT)))
+        return 1;
+    if (from->then_ == to && (from->exec_edges & (1 << THEN)))
+        return 1;
+    if (from->else_ == to && (from->exec_edges & (1 << ELSE)))
+        return 1;
+    return 0;
+}
+
+void sccp_visit_insn(sccp_t *sccp, insn_t *insn);
+
+void sccp_mark_edge(sccp_t *sccp,
+                    basic_block_t *from,
+                    basic_block_t *to,
+                    bb_connection_type_t type)
+{
+    insn_t *insn;
+
+    if (!to || (from->exec_edges & (1 << type)))
+        return;
+    from->exec_edges = from->exec_edges | (1 << type);
+
+    if (!to->executable) {
+        to->executable = 1;
+        sccp_push_block(sccp, to);
+        return;
+    }
+    /* a new edge into a visited block only changes its phis */
+    for (insn = to->insn_list.head; insn; insn = insn->next)
+        if (insn->opcode == OP_phi)
+            sccp_visit_insn(sccp, insn);
+}
+
+/* Fold @op over constants, returns 0 if it has no foldable result */
+int sccp_fold(opcode_t op, int l, int r, int *res)
+{
+    switch (op) {
+    case OP_add:
+        res[0] = l + r;
+        break;
+    case OP_sub:
+        res[0] = l - r;
+        break;
+    case OP_mul:
+        res[0] = l * r;
+        break;
+    case OP_div:
+    case OP_mod:
+        if (!r || (r == -1 && l == -2147483647 - 1))
+            return 0;
+        if (op == OP_div)
+            res[0] = l / r;
+        else
+            res[0] = l % r;
+        break;
+    case OP_lshift:
+        if (r < 0 || r > 31)
+            return 0;
+        res[0] = l << r;
+        break;
+    case OP_rshift:
+        /* logical on Arm but arithmetic on RISC-V */
+        if (l < 0 || r < 0 || r > 31)
+            return 0;
+        res[0] = l >> r;
+        break;
+    case OP_eq:
+        res[0] = l == r;
+        break;
+    case OP_neq:
+        res[0] = l != r;
+        break;
+    case OP_lt:
+        res[0] = l < r;
+        break;
+    case OP_leq:
+        res[0] = l <= r;
+        break;
+    case OP_gt:
+        res[0] = l > r;
+        break;
+    case OP_geq:
+        res[0] = l >= r;
+        break;
+    case OP_bit_and:
+        res[0] = l & r;
+        break;
+    case OP_bit_or:
+        res[0] = l | r;
+        break;
+    case OP_bit_xor:
+        res[0] = l ^ r;
+        break;
+    case OP_log_and:
+        res[0] = l && r;
+        break;
+    case OP_log_or:
+        res[0] = l || r;
+        break;
+    case OP_log_not:
+        res[0] = !l;
+        break;
+    case OP_bit_not:
+        res[0] = ~l;
+        break;
+    case OP_negate:
+        res[0] = -l;
+        break;
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+void sccp_visit_phi(sccp_t *sccp, insn_t *insn)
+{
+    basic_block_t *bb = insn->belong_to;
+    phi_operand_t *op;
+    lattice_t state = LATTICE_TOP;
+    int val = 0;
+
+    for (op = insn->phi_ops; op; op = op->next) {
+        if (!op->var || !sccp_edge_executable(op->from, bb))
+            continue;
+        if (op->var->lattice == LATTICE_TOP)
+            continue;
+        if (op->var->lattice == LATTICE_BOTTOM ||
+            (state == LATTICE_CONST && val != op->var->lattice_val)) {
+            state = LATTICE_BOTTOM;
+            break;
+        }
+        state = LATTICE_CONST;
+        val = op->var->lattice_val;
+    }
+    sccp_lower(sccp, insn->rd, state, val);
+}
+
+void sccp_visit_branch(sccp_t *sccp, insn_t *insn)
+{
+    basic_block_t *bb = insn->belong_to;
+    var_t *cond = insn->rs1;
+
+    /* an unknown condition is taken both ways */
+    if (cond->lattice != LATTICE_CONST || cond->lattice_val)
+        sccp_mark_edge(sccp, bb, bb->then_, THEN);
+    if (cond->lattice != LATTICE_CONST || !cond->lattice_val)
+        sccp_mark_edge(sccp, bb, bb->else_, ELSE);
+}
+
+void sccp_visit_insn(sccp_t *sccp, insn_t *insn)
+{
+    var_t *rd = insn->rd, *rs1 = insn->rs1, *rs2 = insn->rs2;
+    int res;
+
+    if (insn->opcode == OP_branch) {
+        sccp_visit_branch(sccp, insn);
+        return;
+    }
+    if (!rd || rd->lattice == LATTICE_BOTTOM)
+        return;
+
+    switch (insn->opcode) {
+    case OP_phi:
+        sccp_visit_phi(sccp, insn);
+        return;
+    case OP_load_constant:
+        sccp_lower(sccp, rd, LATTICE_CONST, rd->init_val);
+        return;
+    case OP_assign:
+        sccp_lower(sccp, rd, rs1->lattice, rs1->lattice_val);
+        return;
+    case OP_log_not:
+    case OP_bit_not:
+    case OP_negate:
+        if (rs1->lattice != LATTICE_CONST) {
+            sccp_lower(sccp, rd, rs1->lattice, 0);
+            return;
+        }
+        sccp_fold(insn->opcode, rs1->lattice_val, 0, &res);
+        sccp_lower(sccp, rd, LATTICE_CONST, res);
+        return;
+    default:
+        break;
+    }
+
+    if (!rs1 || !rs2 || !sccp_fold(insn->opcode, 0, 1, &res)) {
+        sccp_lower(sccp, rd, LATTICE_BOTTOM, 0);
+        return;
+    }
+    if (rs1->lattice == LATTICE_BOTTOM || rs2->lattice == LATTICE_BOTTOM) {
+        sccp_lower(sccp, rd, LATTICE_BOTTOM, 0);
+        return;
+    }
+    if (rs1->lattice == LATTICE_TOP || rs2->lattice == LATTICE_TOP)
+        return;
+    if (!sccp_fold(insn->opcode, rs1->lattice_val, rs2->lattice_val, &res)) {
+        sccp_lower(sccp, rd, LATTICE_BOTTOM, 0);
+        return;
+    }
+    sccp_lower(sccp, rd, LATTICE_CONST, res);
+}
+
+void sccp_visit_block(sccp_t *sccp, basic_block_t *bb)
+{
+    insn_t *insn;
+
+    for (insn = bb->insn_list.head; insn; insn = insn->next)
+        sccp_visit_insn(sccp, insn);
+
+    if (bb->insn_list.tail && bb->insn_list.tail->opcode == OP_branch)
+        return;
+    sccp_mark_edge(sccp, bb, bb->next, NEXT);
+    sccp_mark_edge(sccp, bb, bb->then_, THEN);
+    sccp_mark_edge(sccp, bb, bb->else_, ELSE);
+}
+
+/* The dead successor of a branch on a constant is cut, and the branch
+ * falls through to the other one.
+ */
+void sccp_fold_branch(basic_block_t *bb, insn_t *insn)
+{
+    basic_block_t *taken = bb->else_, *dead = bb->then_;
+
+    if (insn->rs1->lattice_val) {
+        taken = bb->then_;
+        dead = bb->else_;
+    }
+    bb_remove_insn(bb, insn);
+    if (dead != taken)
+        bb_cut_edge(bb, dead);
+    else
+        bb_disconnect(bb, dead);
+    bb_disconnect(bb, taken);
+    bb_connect(bb, taken, NEXT);
+}
+
+/* Turn the definition of a constant variable into a load of the constant.
+ * A phi is moved after the other phis of its block.
+ */
+void sccp_rewrite_insn(basic_block_t *bb, insn_t *insn)
+{
+    var_t *rd = insn->rd;
+    insn_t *pos;
+
+    if (insn->opcode == OP_phi) {
+        bb_remove_insn(bb, insn);
+        for (pos = bb->insn_list.head; pos && pos->next; pos = pos->next)
+            if (pos->next->opcode != OP_phi)
+                break;
+        if (pos && pos->opcode != OP_phi)
+            pos = NULL;
+        insn->opcode = OP_load_constant;
+        insn->phi_ops = NULL;
+        insn->rs1 = NULL;
+        insn->rs2 = NULL;
+        bb_insert_insn_after(bb, pos, insn);
+        rd->def = insn;
+        rd->def_cnt++;
+    } else {
+        insn->opcode = OP_load_constant;
+        insn_set_rs1(insn, NULL);
+        insn_set_rs2(insn, NULL);
+    }
+    rd->init_val = rd->lattice_val;
+    rd->is_const = 1;
+}
+
+void sccp(fn_t *fn)
+{
+    sccp_t ctx;
+    basic_block_t **blocks;
+    var_t **vars;
+    basic_block_t *bb;
+    insn_t *insn, *next;
+    phi_operand_t *op;
+    use_t *use;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        bb->executable = 0;
+        bb->exec_edges = 0;
+        for (insn = bb->insn_list.head; insn; insn = insn->next)
+            if (insn->opcode == OP_address_of) {
+                /* every version of the variable lives at that address */
+                insn->rs1->is_addr_taken = 1;
+                if (insn->rs1->base)
+                    insn->rs1->base->is_addr_taken = 1;
+            }
+    }
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            sccp_reset_var(insn->rd);
+            sccp_reset_var(insn->rs1);
+            sccp_reset_var(insn->rs2);
+            for (op = insn->phi_ops; op; op = op->next)
+                sccp_reset_var(op->var);
+        }
+    }
+
+    ctx.blocks = NULL;
+    ctx.blocks_idx = 0;
+    ctx.blocks_cap = 0;
+    ctx.vars = NULL;
+    ctx.vars_idx = 0;
+    ctx.vars_cap = 0;
+
+    fn->bbs->executable = 1;
+    sccp_push_block(&ctx, fn->bbs);
+    while (ctx.blocks_idx || ctx.vars_idx) {
+        if (ctx.blocks_idx) {
+            ctx.blocks_idx--;
+            blocks = ctx.blocks;
+            sccp_visit_block(&ctx, blocks[ctx.blocks_idx]);
+            continue;
+        }
+        ctx.vars_idx--;
+        vars = ctx.vars;
+        for (use = vars[ctx.vars_idx]->uses; use; use = use->next)
+            if (use->insn->belong_to->executable)
+                sccp_visit_insn(&ctx, use->insn);
+    }
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        if (!bb->executable)
+            continue;
+        for (insn = bb->insn_list.head; insn; insn = next) {
+            next = insn->next;
+            if (insn->opcode == OP_branch) {
+                if (insn->rs1->lattice == LATTICE_CONST)
+                    sccp_fold_branch(bb, insn);
+                continue;
+            }
+            if (!insn->rd || insn->rd->lattice != LATTICE_CONST)
+                continue;
+            if (insn->opcode == OP_load_constant)
+                continue;
+            sccp_rewrite_insn(bb, insn);
+        }
+    }
+
+    fn_remove_unreachable(fn);
+}
+
+/* Global value numbering (GVN) over the dominator tree. Every variable gets
+ * a value number, and a pure instruction computing an opcode over value
+ * numbers already computed in a dominating block is dropped, its uses taking
+ * the earlier result. Copies and equal constants share their number, so the
+ * expressions built on them match too. Loads are never numbered, since any
+ * store or call in between may change the memory.
+ */
+int gvn_value(gvn_t *gvn, var_t *var)
+{
+    if (!var->vn) {
+        gvn->vn_cnt++;
+        var->vn = gvn->vn_cnt;
+    }
+    return var->vn;
+}
+
+/* Whether @var holds the same value wherever it is read */
+int gvn_stable(var_t *var)
+{
+    return sccp_tracked(var) && var->def_cnt <= 1;
+}
+
+int gvn_commutative(opcode_t op)
+{
+    switch (op) {
+    case OP_add:
+    case OP_mul:
+    case OP_log_and:
+    case OP_log_or:
+    case OP_eq:
+    case OP_neq:
+    case OP_bit_or:
+    case OP_bit_and:
+    case OP_bit_xor:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+void gvn_reset_var(var_t *var)
+{
+    if (var)
+        var->vn = 0;
+}
+
+/* Fill @key with the opcode and operands of @insn, returns 0 if the
+ * instruction is not numbered.
+ */
+int gvn_key(gvn_t *gvn, insn_t *insn, int *key)
+{
+    var_t *rd = insn->rd, *rs1 = insn->rs1, *rs2 = insn->rs2;
+    int tmp;
+
+    if (!rd || !gvn_stable(rd) || rd->def_cnt != 1)
+        return 0;
+
+    key[0] = insn->opcode;
+    key[1] = 0;
+    key[2] = 0;
+    switch (insn->opcode) {
+    case OP_load_constant:
+    case OP_load_data_address:
+        key[1] = rd->init_val;
+        return 1;
+    case OP_address_of:
+        /* every version of a variable has its own slot */
+        key[1] = gvn_value(gvn, rs1);
+        return 1;
+    case OP_negate:
+    case OP_bit_not:
+    case OP_log_not:
+        if (!gvn_stable(rs1))
+            return 0;
+        key[1] = gvn_value(gvn, rs1);
+        return 1;
+    case OP_add:
+    case OP_sub:
+    case OP_mul:
+    case OP_div:
+    case OP_mod:
+    case OP_lshift:
+    case OP_rshift:
+    case OP_log_and:
+    case OP_log_or:
+    case OP_eq:
+    case OP_neq:
+    case OP_lt:
+    case OP_leq:
+    case OP_gt:
+    case OP_geq:
+    case OP_bit_or:
+    case OP_bit_and:
+    case OP_bit_xor:
+        if (!gvn_stable(rs1) || !gvn_stable(rs2))
+            return 0;
+        key[1] = gvn_value(gvn, rs1);
+        key[2] = gvn_value(gvn, rs2);
+        /* commutative operators take their operands in order */
+        if (gvn_commutative(insn->opcode) && key[1] > key[2]) {
+            tmp = key[1];
+            key[1] = key[2];
+            key[2] = tmp;
+        }
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int gvn_hash(int *key)
+{
+    return (key[0] * 31 + key[1] * 17 + key[2]) & (GVN_BUCKETS - 1);
+}
+
+/* Let the readers of @from read @to instead */
+void var_replace_uses(var_t *from, var_t *to)
+{
+    use_t *use;
+    phi_operand_t *op;
+    insn_t *insn;
+
+    for (use = from->uses; use; use = use->next) {
+        insn = use->insn;
+        if (insn->opcode == OP_phi) {
+            for (op = insn->phi_ops; op; op = op->next) {
+                if (op->var == from) {
+                    op->var = to;
+                    var_add_use(to, insn);
+                }
+            }
+            continue;
+        }
+        if (insn->rs1 == from)
+            insn_set_rs1(insn, to);
+        if (insn->rs2 == from)
+            insn_set_rs2(insn, to);
+    }
+    from->uses = NULL;
+}
+
+void gvn_visit(gvn_t *gvn, basic_block_t *bb)
+{
+    insn_t **buckets = gvn->buckets;
+    basic_block_t **dom_next = bb->dom_next;
+    insn_t *insn, *next, *found;
+    var_t *rd;
+    int key[3], found_key[3], h, i;
+
+    for (insn = bb->insn_list.head; insn; insn = next) {
+        next = insn->next;
+        rd = insn->rd;
+        if (!rd)
+            continue;
+        if (insn->opcode == OP_assign && gvn_stable(insn->rs1) &&
+            gvn_stable(rd) && rd->def_cnt == 1) {
+            rd->vn = gvn_value(gvn, insn->rs1);
+            continue;
+        }
+        /* a value kept in memory may change before it would be reused */
+        if (!gvn_key(gvn, insn, key) || !sccp_tracked(rd)) {
+            gvn_value(gvn, rd);
+            continue;
+        }
+
+        h = gvn_hash(key);
+        for (found = buckets[h]; found; found = found->vn_next) {
+            gvn_key(gvn, found, found_key);
+            if (found_key[0] == key[0] && found_key[1] == key[1] &&
+                found_key[2] == key[2])
+                break;
+        }
+        if (!found) {
+            gvn_value(gvn, rd);
+            insn->vn_next = buckets[h];
+            buckets[h] = insn;
+            continue;
+        }
+
+        rd->vn = found->rd->vn;
+        /* constants are cheaper to load again than to keep in a register */
+        if (insn->opcode == OP_load_constant)
+            continue;
+        var_replace_uses(rd, found->rd);
+        bb_remove_insn(bb, insn);
+    }
+
+    for (i = 0; i < bb->dom_next_idx; i++)
+        gvn_visit(gvn, dom_next[i]);
+
+    /* the expressions of @bb are not available beside its subtree */
+    for (insn = bb->insn_list.tail; insn; insn = insn->prev) {
+        if (!gvn_key(gvn, insn, key))
+            continue;
+        h = gvn_hash(key);
+        if (buckets[h] == insn)
+            buckets[h] = insn->vn_next;
+    }
+}
+
+void gvn(fn_t *fn)
+{
+    gvn_t ctx;
+    basic_block_t *bb;
+    insn_t *insn;
+    phi_operand_t *op;
+    int i;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            gvn_reset_var(insn->rd);
+            gvn_reset_var(insn->rs1);
+            gvn_reset_var(insn->rs2);
+            for (op = insn->phi_ops; op; op = op->next)
+                gvn_reset_var(op->var);
+        }
+    }
+
+    ctx.buckets = arena_alloc(INSN_ARENA, GVN_BUCKETS * HOST_PTR_SIZE);
+    ctx.vn_cnt = 0;
+    insn_t **buckets = ctx.buckets;
+    for (i = 0; i < GVN_BUCKETS; i++)
+        buckets[i] = NULL;
+
+    gvn_visit(&ctx, fn->bbs);
+}
+
+/* Dead code elimination (DCE), mark and sweep. Instructions with side
+ * effects are live, and so are the definitions of variables read through
+ * memory or defined more than once. Every definition read by a live
+ * instruction is live too. Whatever stays unmarked is removed, dead phis
+ * included, once the blocks out of reach of the entry are gone.
+ */
+void bb_mark_reachable(basic_block_t *bb)
+{
+    if (!bb || bb->executable)
+        return;
+    bb->executable = 1;
+    bb_mark_reachable(bb->next);
+    bb_mark_reachable(bb->then_);
+    bb_mark_reachable(bb->else_);
+}
+
+int dce_is_critical(insn_t *insn)
+{
+    switch (insn->opcode) {
+    case OP_load_constant:
+    case OP_load_data_address:
+    case OP_address_of:
+    case OP_assign:
+    case OP_read:
+    case OP_phi:
+    case OP_add:
+    case OP_sub:
+    case OP_mul:
+    case OP_div:
+    case OP_mod:
+    case OP_lshift:
+    case OP_rshift:
+    case OP_log_and:
+    case OP_log_or:
+    case OP_log_not:
+    case OP_eq:
+    case OP_neq:
+    case OP_lt:
+    case OP_leq:
+    case OP_gt:
+    case OP_geq:
+    case OP_bit_or:
+    case OP_bit_and:
+    case OP_bit_xor:
+    case OP_bit_not:
+    case OP_negate:
+        return !sccp_tracked(insn->rd) || insn->rd->def_cnt != 1;
+    default:
+        return 1;
+    }
+}
+
+/* Mark the definition of @var live, returns it if it was not yet */
+insn_t *dce_mark(var_t *var)
+{
+    insn_t *def;
+
+    if (!var)
+        return NULL;
+    def = var_def(var);
+    if (!def || def->is_live)
+        return NULL;
+    def->is_live = 1;
+    return def;
+}
+
+void dce(fn_t *fn)
+{
+    basic_block_t *bb;
+    insn_t **work = NULL, *insn, *next, *def;
+    phi_operand_t *op;
+    int work_idx = 0, work_cap = 0;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next)
+        bb->executable = 0;
+    bb_mark_reachable(fn->bbs);
+    fn_remove_unreachable(fn);
+    build_def_use(fn);
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            insn->is_live = dce_is_critical(insn);
+            if (!insn->is_live)
+                continue;
+            work = list_add(work, work_idx, &work_cap, insn);
+            work_idx++;
+        }
+    }
+
+    while (work_idx) {
+        work_idx--;
+        insn = work[work_idx];
+        if (insn->opcode == OP_phi) {
+            for (op = insn->phi_ops; op; op = op->next) {
+                def = dce_mark(op->var);
+                if (!def)
+                    continue;
+                work = list_add(work, work_idx, &work_cap, def);
+                work_idx++;
+            }
+            continue;
+        }
+        def = dce_mark(insn->rs1);
+        if (def) {
+            work = list_add(work, work_idx, &work_cap, def);
+            work_idx++;
+        }
+        def = dce_mark(insn->rs2);
+        if (def) {
+            work = list_add(work, work_idx, &work_cap, def);
+            work_idx++;
+        }
+    }
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = next) {
+            next = insn->next;
+            if (!insn->is_live)
+                bb_remove_insn(bb, insn);
+        }
+    }
+}
+
+/* Loop-invariant code motion (LICM). The natural loops are found from the
+ * back edges, whose target dominates their source, and nested into a forest
+ * from the inner loops to the outer ones. Each loop entered from a single
+ * block gets a preheader, and the pure computations of the loop whose
+ * operands do not change in it are moved there, the inner loops first, so
+ * that they can keep moving out of the enclosing loops.
+ */
+int bb_dominates(basic_block_t *dom, basic_block_t *bb)
+{
+    while (bb != dom) {
+        if (!bb->idom || bb->idom == bb)
+            return 0;
+        bb = bb->idom;
+    }
+    return 1;
+}
+
+int loop_contains(loop_t *loop, basic_block_t *bb)
+{
+    loop_t *l;
+
+    for (l = bb->loop; l; l = l->parent)
+        if (l == loop)
+            return 1;
+    return 0;
+}
+
+/* Whether @bb was collected in the blocks of @loop, valid before the blocks
+ * know their innermost loop.
+ */
+int loop_has_block(loop_t *loop, basic_block_t *bb)
+{
+    basic_block_t **blocks = loop->blocks;
+    int i;
+
+    for (i = 0; i < loop->blocks_idx; i++)
+        if (blocks[i] == bb)
+            return 1;
+    return 0;
+}
+
+void loop_add_block(loop_t *loop, basic_block_t *bb)
+{
+    loop->blocks =
+        list_add(loop->blocks, loop->blocks_idx, &loop->blocks_cap, bb);
+    loop->blocks_idx++;
+}
+
+/* Collect the natural loop of @header from its back edges, or NULL */
+loop_t *build_loop(fn_t *fn, basic_block_t *header)
+{
+    basic_block_t **work = NULL, *bb;
+    bb_connection_t *prev = header->prev;
+    loop_t *loop;
+    int work_idx = 0, work_cap = 0, latches = 0, i;
+
+    fn->visited++;
+    header->visited = fn->visited;
+    for (i = 0; i < header->prev_idx; i++) {
+        bb = prev[i].bb;
+        if (!bb_dominates(header, bb))
+            continue;
+        latches++;
+        if (bb->visited == fn->visited)
+            continue;
+        bb->visited = fn->visited;
+        work = list_add(work, work_idx, &work_cap, bb);
+        work_idx++;
+    }
+    if (!latches)
+        return NULL;
+
+    loop = arena_alloc(INSN_ARENA, sizeof(loop_t));
+    loop->header = header;
+    loop_add_block(loop, header);
+    while (work_idx) {
+        work_idx--;
+        bb = work[work_idx];
+        loop_add_block(loop, bb);
+        prev = bb->prev;
+        for (i = 0; i < bb->prev_idx; i++) {
+            if (prev[i].bb->visited == fn->visited)
+                continue;
+            prev[i].bb->visited = fn->visited;
+            work = list_add(work, work_idx, &work_cap, prev[i].bb);
+            work_idx++;
+        }
+    }
+    return loop;
+}
+
+/* Build the loop nesting forest of @fn into fn->loops, ordered by size, so
+ * that every loop comes before the loops enclosing it.
+ */
+void build_loops(fn_t *fn)
+{
+    basic_block_t *bb, **blocks;
+    loop_t *loop, *l, *prev;
+    int i;
+
+    fn->loops = NULL;
+    for (bb = fn->bbs; bb; bb = bb->rpo_next)
+        bb->loop = NULL;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        loop = build_loop(fn, bb);
+        if (!loop)
+            continue;
+        prev = NULL;
+        for (l = fn->loops; l && l->blocks_idx <= loop->blocks_idx;
+             l = l->next)
+            prev = l;
+        loop->next = l;
+        if (prev)
+            prev->next = loop;
+        else
+            fn->loops = loop;
+    }
+
+    /* the smallest loop containing a block is its innermost one */
+    for (loop = fn->loops; loop; loop = loop->next) {
+        for (l = loop->next; l; l = l->next) {
+            if (loop_has_block(l, loop->header)) {
+                loop->parent = l;
+                break;
+            }
+        }
+        blocks = loop->blocks;
+        for (i = 0; i < loop->blocks_idx; i++)
+            if (!blocks[i]->loop)
+                blocks[i]->loop = loop;
+    }
+    for (loop = fn->loops; loop; loop = loop->next) {
+        loop->depth = 0;
+        for (l = loop; l; l = l->parent)
+            loop->depth++;
+    }
+
+    /* the traversals count visits, keep every block in step */
+    for (bb = fn->bbs; bb; bb = bb->rpo_next)
+        bb->visited = fn->visited;
+}
+
+/* Return the block entering @loop, which only flows into its header, and
+ * split the entering edge if needed. Returns NULL if the loop is entered
+ * from several blocks.
+ */
+basic_block_t *loop_preheader(fn_t *fn, loop_t *loop)
+{
+    basic_block_t *header = loop->header, *pred = NULL, *ph, *bb;
+    bb_connection_t *prev = header->prev;
+    bb_connection_type_t type = NEXT;
+    phi_operand_t *op;
+    insn_t *insn;
+    loop_t *l;
+    int i;
+
+    for (i = 0; i < header->prev_idx; i++) {
+        if (loop_contains(loop, prev[i].bb))
+            continue;
+        if (pred)
+            return NULL;
+        pred = prev[i].bb;
+        type = prev[i].type;
+    }
+    if (!pred)
+        return NULL;
+    if (type == NEXT)
+        return pred;
+
+    ph = bb_create(header->scope);
+    bb_disconnect(pred, header);
+    bb_connect(pred, ph, type);
+    bb_connect(ph, header, NEXT);
+    for (insn = header->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode != OP_phi)
+            continue;
+        for (op = insn->phi_ops; op; op = op->next)
+            if (op->from == pred)
+                op->from = ph;
+    }
+
+    ph->idom = header->idom;
+    header->idom = ph;
+    ph->loop = loop->parent;
+    ph->visited = fn->visited;
+    for (l = loop->parent; l; l = l->parent)
+        loop_add_block(l, ph);
+
+    bb = fn->bbs;
+    while (bb->rpo_next != header)
+        bb = bb->rpo_next;
+    bb->rpo_next = ph;
+    ph->rpo_next = header;
+    i = 0;
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        bb->rpo = i;
+        i++;
+    }
+    return ph;
+}
+
+/* Make @ph, the preheader of @loop, flow straight to where the loop exits
+ * from its header, and drop the blocks of the loop.
+ */
+void loop_bypass(fn_t *fn, loop_t *loop, basic_block_t *ph)
+{
+    basic_block_t *header = loop->header, *exit = header->else_, *bb;
+    phi_operand_t *op;
+    insn_t *insn;
+
+    for (insn = exit->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode != OP_phi)
+            continue;
+        for (op = insn->phi_ops; op; op = op->next)
+            if (op->from == header)
+                op->from = ph;
+    }
+
+    bb_disconnect(ph, header);
+    bb_disconnect(header, exit);
+    bb_connect(ph, exit, NEXT);
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        bb->executable = !loop_contains(loop, bb);
+        if (loop_contains(loop, bb->idom))
+            bb->idom = ph;
+    }
+    fn_remove_unreachable(fn);
+}
+
+/* Materializations of a constant or an address, cheaper to redo in the loop
+ * than to reload from the stack, so only moved along with their users.
+ */
+int licm_is_leaf(opcode_t op)
+{
+    switch (op) {
+    case OP_load_constant:
+    case OP_load_data_address:
+    case OP_address_of:
+    case OP_global_address_of:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Whether @var keeps the same value all along @loop */
+int licm_invariant(loop_t *loop, var_t *var)
+{
+    insn_t *def;
+
+    if (!var)
+        return 1;
+    /* an array always names the same storage */
+    if (var->is_global && var->array_size)
+        return 1;
+    if (!gvn_stable(var))
+        return 0;
+    def = var_def(var);
+    if (!def)
+        return 1;
+    return def->is_invariant || !loop_contains(loop, def->belong_to);
+}
+
+/* Whether @insn computes the same value on every iteration of @loop and is
+ * safe to compute even if the loop does not run. Division may trap.
+ */
+int licm_hoistable(loop_t *loop, insn_t *insn)
+{
+    var_t *rd = insn->rd;
+
+    if (!rd || !sccp_tracked(rd) || rd->def_cnt != 1)
+        return 0;
+    switch (insn->opcode) {
+    case OP_load_constant:
+    case OP_load_data_address:
+    case OP_address_of:
+    case OP_global_address_of:
+        return 1;
+    case OP_add:
+    case OP_sub:
+    case OP_mul:
+    case OP_lshift:
+    case OP_rshift:
+    case OP_log_and:
+    case OP_log_or:
+    case OP_eq:
+    case OP_neq:
+    case OP_lt:
+    case OP_leq:
+    case OP_gt:
+    case OP_geq:
+    case OP_bit_or:
+    case OP_bit_and:
+    case OP_bit_xor:
+    case OP_bit_not:
+    case OP_negate:
+    case OP_log_not:
+        return licm_invariant(loop, insn->rs1) &&
+               licm_invariant(loop, insn->rs2);
+    default:
+        return 0;
+    }
+}
+
+/* Whether every use of @insn inside @loop moves out with it */
+int licm_uses_hoisted(loop_t *loop, insn_t *insn)
+{
+    use_t *use;
+
+    for (use = insn->rd->uses; use; use = use->next)
+        if (!use->insn->is_invariant &&
+            loop_contains(loop, use->insn->belong_to))
+            return 0;
+    return 1;
+}
+
+void licm_loop(fn_t *fn, loop_t *loop)
+{
+    basic_block_t *bb, *ph;
+    insn_t **cands = NULL, *insn;
+    int cands_idx = 0, cands_cap = 0, changed, i;
+
+    ph = loop_preheader(fn, loop);
+    if (!ph)
+        return;
+
+    /* in order, the definitions of a loop come before their uses */
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        if (!loop_contains(loop, bb))
+            continue;
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            if (!licm_hoistable(loop, insn))
+                continue;
+            insn->is_invariant = 1;
+            cands = list_add(cands, cands_idx, &cands_cap, insn);
+            cands_idx++;
+        }
+    }
+
+    /* keep the leaves used in the loop there, and what depends on them */
+    do {
+        changed = 0;
+        for (i = 0; i < cands_idx; i++) {
+            insn = cands[i];
+            if (!insn->is_invariant)
+                continue;
+            if (licm_is_leaf(insn->opcode)) {
+                if (licm_uses_hoisted(loop, insn))
+                    continue;
+            } else if (licm_invariant(loop, insn->rs1) &&
+                       licm_invariant(loop, insn->rs2))
+                continue;
+            insn->is_invariant = 0;
+            changed = 1;
+        }
+    } while (changed);
+
+    for (i = 0; i < cands_idx; i++) {
+        insn = cands[i];
+        if (!insn->is_invariant)
+            continue;
+        insn->is_invariant = 0;
+        bb_unlink_insn(insn->belong_to, insn);
+        bb_insert_insn_after(ph, ph->insn_list.tail, insn);
+    }
+}
+
+void licm(fn_t *fn)
+{
+    basic_block_t *bb;
+    insn_t *insn;
+    loop_t *loop;
+
+    build_def_use(fn);
+    build_loops(fn);
+    for (loop = fn->loops; loop; loop = loop->next)
+        licm_loop(fn, loop);
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            if (!insn->rd || insn->rd->is_global)
+                continue;
+            insn->rd->in_loop = bb->loop ? bb->loop->depth : 0;
+        }
+    }
+}
+
+/* Induction variable strength reduction (IVSR). The basic induction
+ * variables of a loop are the phis of its header which step by a constant on
+ * the back edge. A multiplication of one by a constant, with the invariant
+ * offset added to it as when indexing an array, becomes a new induction
+ * variable stepping by the scaled constant. Linear function test replacement
+ * (LFTR) then moves the exit test onto it, so that a counter only kept for
+ * that test goes away with dead code elimination.
+ */
+int var_constant(var_t *var, int *val)
+{
+    insn_t *def;
+
+    if (!var || !gvn_stable(var))
+        return 0;
+    def = var_def(var);
+    if (!def || def->opcode != OP_load_constant)
+        return 0;
+    val[0] = var->init_val;
+    return 1;
+}
+
+/* The only instruction reading @var, or NULL */
+insn_t *var_single_use(var_t *var)
+{
+    use_t *use = var->uses;
+
+    if (!use || use->next)
+        return NULL;
+    return use->insn;
+}
+
+/* Whether every instruction reading @var is inside @loop */
+int var_used_in_loop(loop_t *loop, var_t *var)
+{
+    use_t *use;
+
+    for (use = var->uses; use; use = use->next)
+        if (!loop_contains(loop, use->insn->belong_to))
+            return 0;
+    return 1;
+}
+
+/* Create @rd = @op @rs1, @rs2 after @pos in @bb, or at its head */
+insn_t *bb_new_insn(basic_block_t *bb,
+                    insn_t *pos,
+                    opcode_t op,
+                    var_t *rd,
+                    var_t *rs1,
+                    var_t *rs2)
+{
+    insn_t *insn = arena_alloc(INSN_ARENA, sizeof(insn_t));
+
+    insn->opcode = op;
+    insn->rd = rd;
+    insn->rs1 = rs1;
+    insn->rs2 = rs2;
+    bb_insert_insn_after(bb, pos, insn);
+    var_add_use(rs1, insn);
+    var_add_use(rs2, insn);
+    rd->def = insn;
+    rd->def_cnt = 1;
+    return insn;
+}
+
+var_t *bb_new_var(basic_block_t *bb)
+{
+    var_t *var = require_var(bb->scope);
+    var->var_name = intern_name(gen_name());
+    return var;
+}
+
+/* Append a new value of @op @rs1, @rs2 to @bb, ahead of its branch */
+var_t *bb_append_op(basic_block_t *bb, opcode_t op, var_t *rs1, var_t *rs2)
+{
+    insn_t *pos = bb->insn_list.tail;
+    var_t *rd = bb_new_var(bb);
+
+    if (pos && pos->opcode == OP_branch)
+        pos = pos->prev;
+    bb_new_insn(bb, pos, op, rd, rs1, rs2);
+    return rd;
+}
+
+var_t *bb_append_constant(basic_block_t *bb, int val)
+{
+    var_t *rd = bb_append_op(bb, OP_load_constant, NULL, NULL);
+    rd->init_val = val;
+    return rd;
+}
+
+/* Fill @iv if @phi, in the header of @loop entered from @ph, is a basic
+ * induction variable.
+ */
+int ivsr_basic(loop_t *loop, basic_block_t *ph, insn_t *phi, induction_t *iv)
+{
+    phi_operand_t *entry = phi->phi_ops, *back;
+    insn_t *inc;
+    int step;
+
+    if (!entry || !entry->next || entry->next->next)
+        return 0;
+    back = entry->next;
+    if (back->from == ph) {
+        back = entry;
+        entry = entry->next;
+    }
+    if (entry->from != ph || !loop_contains(loop, back->from))
+        return 0;
+    if (!gvn_stable(phi->rd) || !gvn_stable(back->var))
+        return 0;
+
+    /* follow the copies back to the step */
+    inc = var_def(back->var);
+    while (inc && inc->opcode == OP_assign) {
+        if (!gvn_stable(inc->rs1))
+            return 0;
+        inc = var_def(inc->rs1);
+    }
+    if (!inc || !loop_contains(loop, inc->belong_to))
+        return 0;
+    if (inc->opcode == OP_add && inc->rs1 == phi->rd &&
+        var_constant(inc->rs2, &step)) {
+        iv->step = step;
+    } else if (inc->opcode == OP_add && inc->rs2 == phi->rd &&
+               var_constant(inc->rs1, &step)) {
+        iv->step = step;
+    } else if (inc->opcode == OP_sub && inc->rs1 == phi->rd &&
+               var_constant(inc->rs2, &step)) {
+        iv->step = -step;
+    } else
+        return 0;
+
+    iv->var = phi->rd;
+    iv->init = entry->var;
+    iv->inc = inc;
+    iv->latch = back->from;
+    iv->derived = NULL;
+    return 1;
+}
+
+/* The basic induction variable of @ivs multiplied by @insn, with the
+ * constant factor in @scale, or NULL.
+ */
+induction_t *ivsr_scaled(induction_t *ivs, int ivs_idx, insn_t *insn,
+                         int *scale)
+{
+    int i, shift;
+
+    for (i = 0; i < ivs_idx; i++) {
+        if (insn->opcode == OP_mul) {
+            if (insn->rs1 == ivs[i].var && var_constant(insn->rs2, scale))
+                return &ivs[i];
+            if (insn->rs2 == ivs[i].var && var_constant(insn->rs1, scale))
+                return &ivs[i];
+        } else if (insn->opcode == OP_lshift) {
+            if (insn->rs1 != ivs[i].var || !var_constant(insn->rs2, &shift))
+                continue;
+            if (shift < 0 || shift > 30)
+                continue;
+            scale[0] = 1 << shift;
+            return &ivs[i];
+        }
+    }
+    return NULL;
+}
+
+/* Replace @insn, which scales @iv by @scale, and the invariant offset added
+ * to it if any, with a new induction variable.
+ */
+void ivsr_reduce(loop_t *loop,
+                 basic_block_t *ph,
+                 induction_t *iv,
+                 insn_t *insn,
+                 int scale)
+{
+    insn_t *target = insn, *add, *phi;
+    phi_operand_t *entry, *back;
+    var_t *offset = NULL, *other, *init, *var, *next;
+
+    if (!gvn_stable(insn->rd))
+        return;
+    add = var_single_use(insn->rd);
+    if (add && add->opcode == OP_add && gvn_stable(add->rd) &&
+        loop_contains(loop, add->belong_to)) {
+        other = add->rs1 == insn->rd ? add->rs2 : add->rs1;
+        if (other != insn->rd && licm_invariant(loop, other)) {
+            target = add;
+            offset = other;
+        }
+    }
+    /* past the loop, the new variable has already stepped once more */
+    if (!var_used_in_loop(loop, target->rd))
+        return;
+
+    init = bb_append_op(ph, OP_mul, iv->init, bb_append_constant(ph, scale));
+    if (offset)
+        init = bb_append_op(ph, OP_add, init, offset);
+    var = bb_new_var(loop->header);
+    next = bb_append_op(iv->latch, OP_add, var,
+                        bb_append_constant(iv->latch, iv->step * scale));
+
+    phi = bb_new_insn(loop->header, NULL, OP_phi, var, NULL, NULL);
+    entry = arena_alloc(INSN_ARENA, sizeof(phi_operand_t));
+    back = arena_alloc(INSN_ARENA, sizeof(phi_operand_t));
+    entry->var = init;
+    entry->from = ph;
+    entry->next = back;
+    back->var = next;
+    back->from = iv->latch;
+    phi->phi_ops = entry;
+    var_add_use(init, phi);
+    var_add_use(next, phi);
+
+    var_replace_uses(target->rd, var);
+    bb_remove_insn(target->belong_to, target);
+    if (target != insn)
+        bb_remove_insn(insn->belong_to, insn);
+
+    if (!iv->derived && scale > 0) {
+        iv->derived = var;
+        iv->scale = scale;
+        iv->offset = offset;
+    }
+}
+
+/* Whether @val times @scale, one step of @step further, fits in an int */
+int ivsr_fits(int val, int step, int scale)
+{
+    int max = 2147483647 / scale;
+
+    if (step < 0)
+        step = -step;
+    return val <= max - step && val >= step - max;
+}
+
+/* Compare the reduced variable of @iv instead in its exit test, if the
+ * counter is read nowhere else. The scaled values only compare the same way
+ * if none of them overflows, which is only known for a constant start and
+ * bound, and never for an address the variable has been offset to.
+ */
+void ivsr_lftr(loop_t *loop, basic_block_t *ph, induction_t *iv)
+{
+    insn_t *cmp = NULL, *insn;
+    var_t *bound;
+    use_t *use;
+    int val, init;
+
+    if (!iv->derived || iv->offset)
+        return;
+    for (use = iv->var->uses; use; use = use->next) {
+        insn = use->insn;
+        if (insn == iv->inc)
+            continue;
+        if (cmp)
+            return;
+        cmp = insn;
+    }
+    if (!cmp || !loop_contains(loop, cmp->belong_to))
+        return;
+    switch (cmp->opcode) {
+    case OP_eq:
+    case OP_neq:
+    case OP_lt:
+    case OP_leq:
+    case OP_gt:
+    case OP_geq:
+        break;
+    default:
+        return;
+    }
+    if (cmp->rs1 == iv->var)
+        bound = cmp->rs2;
+    else
+        bound = cmp->rs1;
+    if (bound == iv->var)
+        return;
+    if (!var_constant(bound, &val) || !var_constant(iv->init, &init))
+        return;
+    if (!ivsr_fits(val, iv->step, iv->scale) ||
+        !ivsr_fits(init, iv->step, iv->scale))
+        return;
+
+    /* the step must only feed the phi */
+    insn = var_single_use(iv->inc->rd);
+    while (insn && insn->opcode == OP_assign)
+        insn = var_single_use(insn->rd);
+    if (!insn || insn != var_def(iv->var))
+        return;
+
+    if (cmp->rs1 == iv->var) {
+        insn_set_rs1(cmp, iv->derived);
+        insn_set_rs2(cmp, bb_append_constant(ph, val * iv->scale));
+    } else {
+        insn_set_rs1(cmp, bb_append_constant(ph, val * iv->scale));
+        insn_set_rs2(cmp, iv->derived);
+    }
+}
+
+void ivsr_loop(fn_t *fn, loop_t *loop)
+{
+    induction_t *ivs, *iv;
+    basic_block_t *bb, *ph;
+    insn_t **cands = NULL, *insn;
+    int ivs_idx = 0, cands_idx = 0, cands_cap = 0, scale, i;
+
+    ph = loop_preheader(fn, loop);
+    if (!ph)
+        return;
+
+    ivs = arena_alloc(INSN_ARENA, MAX_INDUCTIONS * sizeof(induction_t));
+    for (insn = loop->header->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode != OP_phi)
+            break;
+        if (ivs_idx == MAX_INDUCTIONS)
+            break;
+        if (ivsr_basic(loop, ph, insn, &ivs[ivs_idx]))
+            ivs_idx++;
+    }
+    if (!ivs_idx)
+        return;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        if (!loop_contains(loop, bb))
+            continue;
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            if (insn->opcode != OP_mul && insn->opcode != OP_lshift)
+                continue;
+            cands = list_add(cands, cands_idx, &cands_cap, insn);
+            cands_idx++;
+        }
+    }
+    /* reducing removes instructions, so collect them first */
+    for (i = 0; i < cands_idx; i++) {
+        insn = cands[i];
+        iv = ivsr_scaled(ivs, ivs_idx, insn, &scale);
+        if (iv)
+            ivsr_reduce(loop, ph, iv, insn, scale);
+    }
+    for (i = 0; i < ivs_idx; i++)
+        ivsr_lftr(loop, ph, &ivs[i]);
+}
+
+void ivsr(fn_t *fn)
+{
+    loop_t *loop;
+
+    build_def_use(fn);
+    for (loop = fn->loops; loop; loop = loop->next)
+        ivsr_loop(fn, loop);
+}
+
+/* Loop unrolling. Only an innermost loop made of its header and a straight
+ * chain of blocks back to it qualifies, with a header computing nothing but
+ * its exit test, which compares a basic induction variable to a bound. If
+ * the bound and the initial value are constants and the loop runs at most
+ * UNROLL_MAX_TRIPS times, the iterations replace the loop in its preheader.
+ * Otherwise a copy running UNROLL_FACTOR iterations per exit test goes
+ * ahead of the loop, which is left with the remaining iterations. Both stay
+ * within UNROLL_BUDGET instructions.
+ */
+var_t *unroll_value(var_t *var)
+{
+    if (var && var->copy)
+        return var->copy;
+    return var;
+}
+
+/* A new version of @var, for the value it gets in another iteration */
+var_t *unroll_new_var(basic_block_t *bb, var_t *var)
+{
+    var_t *copy = require_var(bb->scope);
+
+    memcpy(copy, var, sizeof(var_t));
+    copy->var_name = intern_name(gen_name());
+    copy->copy = NULL;
+    var->copy = copy;
+    return copy;
+}
+
+/* Append to @bb the instructions of @from but its phis and branch, reading
+ * the values of the iteration being unrolled.
+ */
+void unroll_copy_block(basic_block_t *bb, basic_block_t *from)
+{
+    insn_t *insn, *copy;
+
+    for (insn = from->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode == OP_phi || insn->opcode == OP_branch)
+            continue;
+        /* no need to copy copies */
+        if (insn->opcode == OP_assign && sccp_tracked(insn->rd) &&
+            gvn_stable(insn->rs1)) {
+            insn->rd->copy = unroll_value(insn->rs1);
+            continue;
+        }
+        copy = arena_alloc(INSN_ARENA, sizeof(insn_t));
+        memcpy(copy, insn, sizeof(insn_t));
+        copy->rs1 = unroll_value(insn->rs1);
+        copy->rs2 = unroll_value(insn->rs2);
+        if (insn->rd && sccp_tracked(insn->rd))
+            copy->rd = unroll_new_var(bb, insn->rd);
+        bb_insert_insn_after(bb, bb->insn_list.tail, copy);
+    }
+}
+
+/* The operand of @phi coming from @from */
+phi_operand_t *phi_operand_from(insn_t *phi, basic_block_t *from)
+{
+    phi_operand_t *op = phi->phi_ops;
+
+    while (op->from != from)
+        op = op->next;
+    return op;
+}
+
+/* Move the phis of @header on to the values they get from @latch */
+void unroll_step(basic_block_t *header, basic_block_t *latch)
+{
+    var_t **next;
+    insn_t *insn;
+    phi_operand_t *op;
+    int cnt = 0, i;
+
+    for (insn = header->insn_list.head; insn; insn = insn->next)
+        if (insn->opcode == OP_phi)
+            cnt++;
+    next = arena_alloc(INSN_ARENA, cnt * HOST_PTR_SIZE);
+
+    /* all at once, as the phis may read each other */
+    i = 0;
+    for (insn = header->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode != OP_phi)
+            continue;
+        op = phi_operand_from(insn, latch);
+        next[i] = unroll_value(op->var);
+        i++;
+    }
+    i = 0;
+    for (insn = header->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode != OP_phi)
+            continue;
+        insn->rd->copy = next[i];
+        i++;
+    }
+}
+
+/* Start the phis of @header on the values entering from @ph */
+void unroll_enter(basic_block_t *header, basic_block_t *ph)
+{
+    insn_t *insn;
+    phi_operand_t *op;
+
+    for (insn = header->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode != OP_phi)
+            continue;
+        op = phi_operand_from(insn, ph);
+        insn->rd->copy = op->var;
+    }
+}
+
+/* The blocks of @loop after its header, in order, or NULL if the loop is
+ * not a straight chain. Sets @len.
+ */
+basic_block_t **unroll_chain(loop_t *loop, int *len)
+{
+    basic_block_t *header = loop->header, *bb, **chain = NULL;
+    int idx = 0, cap = 0;
+
+    if (!header->then_ || !header->else_ || header->prev_idx != 2)
+        return NULL;
+    if (!loop_contains(loop, header->then_) ||
+        loop_contains(loop, header->else_))
+        return NULL;
+    for (bb = header->then_; bb != header; bb = bb->next) {
+        if (!bb || bb->then_ || bb->prev_idx != 1 || !loop_contains(loop, bb))
+            return NULL;
+        chain = list_add(chain, idx, &cap, bb);
+        idx++;
+    }
+    if (idx + 1 != loop->blocks_idx)
+        return NULL;
+    len[0] = idx;
+    return chain;
+}
+
+/* The instructions to copy per iteration, or -1 if the loop can not be
+ * unrolled.
+ */
+int unroll_size(basic_block_t *header, basic_block_t **chain, int len)
+{
+    insn_t *insn;
+    int size = 0, i;
+
+    for (insn = header->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode == OP_branch)
+            continue;
+        if (insn->opcode == OP_phi) {
+            if (!sccp_tracked(insn->rd))
+                return -1;
+            continue;
+        }
+        /* the exit test runs again when leaving the unrolled copy */
+        if (dce_is_critical(insn))
+            return -1;
+        size++;
+    }
+    for (i = 0; i < len; i++) {
+        for (insn = chain[i]->insn_list.head; insn; insn = insn->next) {
+            if (insn->opcode == OP_phi)
+                return -1;
+            if (insn->opcode == OP_allocat && insn->rd->array_size)
+                return -1;
+            /* every copy renames what it defines */
+            if (insn->rd && sccp_tracked(insn->rd) && insn->rd->def_cnt != 1)
+                return -1;
+            size++;
+        }
+    }
+    return size;
+}
+
+/* How many times the exit test @cmp of @iv against @bound passes, or -1 if
+ * more than UNROLL_MAX_TRIPS.
+ */
+int unroll_trips(induction_t *iv, insn_t *cmp, int bound)
+{
+    int init, val, trips = 0, res;
+
+    if (!var_constant(iv->init, &init))
+        return -1;
+    for (val = init; trips <= UNROLL_MAX_TRIPS; val = val + iv->step) {
+        if (cmp->rs1 == iv->var) {
+            if (!sccp_fold(cmp->opcode, val, bound, &res))
+                return -1;
+        } else if (!sccp_fold(cmp->opcode, bound, val, &res))
+            return -1;
+        if (!res)
+            return trips;
+        trips++;
+    }
+    return -1;
+}
+
+/* Replace @loop by @trips copies of its iterations in @ph */
+void unroll_full(fn_t *fn,
+                 loop_t *loop,
+                 basic_block_t *ph,
+                 basic_block_t **chain,
+                 int len,
+                 int trips)
+{
+    basic_block_t *header = loop->header;
+    insn_t *insn;
+    int t, i;
+
+    unroll_enter(header, ph);
+    for (t = 0; t < trips; t++) {
+        unroll_copy_block(ph, header);
+        for (i = 0; i < len; i++)
+            unroll_copy_block(ph, chain[i]);
+        unroll_step(header, chain[len - 1]);
+    }
+    unroll_copy_block(ph, header);
+
+    /* the values leaving the loop are those of the last exit test */
+    for (insn = header->insn_list.head; insn; insn = insn->next)
+        if (insn->rd && insn->rd->copy)
+            var_replace_uses(insn->rd, insn->rd->copy);
+    loop_bypass(fn, loop, ph);
+}
+
+/* Put ahead of @loop a copy of it running UNROLL_FACTOR iterations as long
+ * as the exit test @cmp of @iv would pass for all of them.
+ */
+void unroll_partial(fn_t *fn,
+                    loop_t *loop,
+                    basic_block_t *ph,
+                    basic_block_t **chain,
+                    int len,
+                    induction_t *iv,
+                    insn_t *cmp)
+{
+    basic_block_t *header = loop->header, *head, *body, *bb;
+    insn_t *insn, *phi, *br;
+    phi_operand_t *op, *entry, *back;
+    var_t *last, *bound, *guard;
+    int u, i, val;
+
+    head = bb_create(header->scope);
+    body = bb_create(header->scope);
+
+    /* phis of the copy, entered with the values of the loop */
+    for (insn = header->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode != OP_phi)
+            continue;
+        op = phi_operand_from(insn, ph);
+        phi = arena_alloc(INSN_ARENA, sizeof(insn_t));
+        phi->opcode = OP_phi;
+        phi->rd = unroll_new_var(head, insn->rd);
+        entry = arena_alloc(INSN_ARENA, sizeof(phi_operand_t));
+        entry->var = op->var;
+        entry->from = ph;
+        phi->phi_ops = entry;
+        bb_insert_insn_after(head, head->insn_list.tail, phi);
+
+        /* the loop is now entered from the copy */
+        op->var = phi->rd;
+        op->from = head;
+    }
+
+    /* test the last of the iterations, the values step monotonically */
+    unroll_copy_block(head, header);
+    last = bb_append_op(head, OP_add, unroll_value(iv->var),
+                        bb_append_constant(head,
+                                           (UNROLL_FACTOR - 1) * iv->step));
+    bound = cmp->rs1 == iv->var ? cmp->rs2 : cmp->rs1;
+    if (var_constant(bound, &val))
+        bound = bb_append_constant(head, val);
+    if (cmp->rs1 == iv->var)
+        guard = bb_append_op(head, cmp->opcode, last, bound);
+    else
+        guard = bb_append_op(head, cmp->opcode, bound, last);
+    /* nor may the last one wrap around */
+    if (iv->step > 0)
+        last = bb_append_op(head, OP_gt, last, unroll_value(iv->var));
+    else
+        last = bb_append_op(head, OP_lt, last, unroll_value(iv->var));
+    guard = bb_append_op(head, OP_bit_and, guard, last);
+    br = arena_alloc(INSN_ARENA, sizeof(insn_t));
+    br->opcode = OP_branch;
+    br->rs1 = guard;
+    bb_insert_insn_after(head, head->insn_list.tail, br);
+
+    for (u = 0; u < UNROLL_FACTOR; u++) {
+        if (u)
+            unroll_copy_block(body, header);
+        for (i = 0; i < len; i++)
+            unroll_copy_block(body, chain[i]);
+        unroll_step(header, chain[len - 1]);
+    }
+
+    /* close the phis of the copy on the values of its last iteration */
+    phi = head->insn_list.head;
+    for (insn = header->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode != OP_phi)
+            continue;
+        back = arena_alloc(INSN_ARENA, sizeof(phi_operand_t));
+        back->var = insn->rd->copy;
+        back->from = body;
+        phi->phi_ops->next = back;
+        phi = phi->next;
+    }
+
+    bb_disconnect(ph, header);
+    bb_connect(ph, head, NEXT);
+    bb_connect(head, body, THEN);
+    bb_connect(head, header, ELSE);
+    bb_connect(body, head, NEXT);
+    head->idom = header->idom;
+    body->idom = head;
+    header->idom = head;
+    head->loop = loop->parent;
+    body->loop = loop->parent;
+    head->visited = fn->visited;
+    body->visited = fn->visited;
+
+    bb = fn->bbs;
+    while (bb->rpo_next != header)
+        bb = bb->rpo_next;
+    bb->rpo_next = head;
+    head->rpo_next = body;
+    body->rpo_next = header;
+    i = 0;
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        bb->rpo = i;
+        i++;
+    }
+}
+
+/* Whether the exit test @cmp passing for the last of UNROLL_FACTOR steps of
+ * @iv means it passes for all of them.
+ */
+int unroll_monotonic(induction_t *iv, insn_t *cmp)
+{
+    int rising = cmp->rs1 == iv->var;
+
+    switch (cmp->opcode) {
+    case OP_lt:
+    case OP_leq:
+        break;
+    case OP_gt:
+    case OP_geq:
+        rising = !rising;
+        break;
+    default:
+        return 0;
+    }
+    if (iv->step > 2147483647 / UNROLL_FACTOR ||
+        iv->step < -2147483647 / UNROLL_FACTOR)
+        return 0;
+    if (rising)
+        return iv->step > 0;
+    return iv->step < 0;
+}
+
+int unroll_loop(fn_t *fn, loop_t *loop)
+{
+    basic_block_t *header = loop->header, *ph, **chain;
+    induction_t iv;
+    insn_t *br, *cmp, *insn, *def;
+    var_t *bound;
+    int len, size, trips = -1, val, found = 0;
+
+    chain = unroll_chain(loop, &len);
+    if (!chain)
+        return 0;
+    size = unroll_size(header, chain, len);
+    if (size < 0)
+        return 0;
+    br = header->insn_list.tail;
+    if (br->opcode != OP_branch)
+        return 0;
+    cmp = var_def(br->rs1);
+    if (!cmp || cmp->belong_to != header)
+        return 0;
+    ph = loop_preheader(fn, loop);
+    if (!ph)
+        return 0;
+
+    for (insn = header->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode != OP_phi)
+            break;
+        if (!ivsr_basic(loop, ph, insn, &iv))
+            continue;
+        if (cmp->rs1 == iv.var || cmp->rs2 == iv.var) {
+            found = 1;
+            break;
+        }
+    }
+    if (!found)
+        return 0;
+    bound = cmp->rs1 == iv.var ? cmp->rs2 : cmp->rs1;
+    if (bound == iv.var)
+        return 0;
+
+    if (var_constant(bound, &val))
+        trips = unroll_trips(&iv, cmp, val);
+    if (trips >= 0 && trips * size <= UNROLL_BUDGET) {
+        unroll_full(fn, loop, ph, chain, len, trips);
+        return 1;
+    }
+
+    if (size * UNROLL_FACTOR > UNROLL_BUDGET || !unroll_monotonic(&iv, cmp))
+        return 0;
+    /* the bound must be known before the copy runs */
+    def = var_def(bound);
+    if (!var_constant(bound, &val) &&
+        (!licm_invariant(loop, bound) ||
+         (def && loop_contains(loop, def->belong_to))))
+        return 0;
+    unroll_partial(fn, loop, ph, chain, len, &iv, cmp);
+    return 1;
+}
+
+/* Forget the values of the last loop unrolled */
+void unroll_reset(fn_t *fn)
+{
+    basic_block_t *bb;
+    insn_t *insn;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next)
+        for (insn = bb->insn_list.head; insn; insn = insn->next)
+            if (insn->rd)
+                insn->rd->copy = NULL;
+}
+
+void unroll(fn_t *fn)
+{
+    loop_t *loop;
+    int changed = 0;
+
+    build_def_use(fn);
+    for (loop = fn->loops; loop; loop = loop->next) {
+        unroll_reset(fn);
+        if (!unroll_loop(fn, loop))
+            continue;
+        build_def_use(fn);
+        changed = 1;
+    }
+    /* fold the exit tests of the copies */
+    if (changed) {
+        sccp(fn);
+        build_loops(fn);
+    }
+}
+
+/* Loop idiom recognition. A loop whose only effect is to fill a range of
+ * bytes with a value or to copy it from another range, both indexed by a
+ * basic induction variable stepping by one, becomes a call to a helper of
+ * the libc, and so does a loop scanning for the zero ending a string. The
+ * helpers behave exactly as the loops would, overlapping copies included,
+ * but move a word at a time once the addresses are aligned.
+ */
+int idiom_is_helper(char *name)
+{
+    return !strcmp(name, "__fill_bytes") || !strcmp(name, "__copy_bytes_up") ||
+           !strcmp(name, "__copy_bytes_down") ||
+           !strcmp(name, "__scan_bytes");
+}
+
+/* The defined function @name, or NULL */
+func_t *idiom_helper(char *name)
+{
+    func_t *func = find_func(name);
+
+    if (!func || !func->fn)
+        return NULL;
+    return func;
+}
+
+/* Note the byte access @insn may be in @read or @write, returns whether
+ * @insn has no other effect.
+ */
+int idiom_access(insn_t *insn, insn_t **read, insn_t **write)
+{
+    if (insn->opcode == OP_read) {
+        if (insn->sz != 1 || read[0] || !sccp_tracked(insn->rd))
+            return 0;
+        read[0] = insn;
+        return 1;
+    }
+    if (insn->opcode == OP_write) {
+        if (insn->sz != 1 || write[0])
+            return 0;
+        write[0] = insn;
+        return 1;
+    }
+    return !dce_is_critical(insn);
+}
+
+/* Whether @var is @iv in the current iteration, or in the next one, offset
+ * by @k from the value of the phi.
+ */
+int idiom_index(induction_t *iv, var_t *var, int *k)
+{
+    insn_t *def;
+
+    if (!gvn_stable(var))
+        return 0;
+    def = var_def(var);
+    while (var != iv->var && def && def->opcode == OP_assign) {
+        var = def->rs1;
+        if (!gvn_stable(var))
+            return 0;
+        def = var_def(var);
+    }
+    if (var == iv->var) {
+        k[0] = 0;
+        return 1;
+    }
+    if (def != iv->inc)
+        return 0;
+    k[0] = iv->step;
+    return 1;
+}
+
+/* Whether the address @var is an invariant @base indexed by @iv */
+int idiom_address(loop_t *loop,
+                  induction_t *iv,
+                  var_t *var,
+                  var_t **base,
+                  int *k)
+{
+    insn_t *def;
+
+    if (!gvn_stable(var))
+        return 0;
+    def = var_def(var);
+    if (!def || def->opcode != OP_add)
+        return 0;
+    if (licm_invariant(loop, def->rs1) && idiom_index(iv, def->rs2, k)) {
+        base[0] = def->rs1;
+        return 1;
+    }
+    if (licm_invariant(loop, def->rs2) && idiom_index(iv, def->rs1, k)) {
+        base[0] = def->rs2;
+        return 1;
+    }
+    return 0;
+}
+
+/* An invariant @var of @loop, available at the end of @ph */
+var_t *idiom_value(loop_t *loop, basic_block_t *ph, var_t *var)
+{
+    int val;
+
+    if (var_constant(var, &val))
+        return bb_append_constant(ph, val);
+    if (licm_invariant(loop, var))
+        return var;
+    return NULL;
+}
+
+/* Call @func with @args at the end of @bb, returns the value it returns */
+var_t *idiom_call(basic_block_t *bb, func_t *func, var_t **args, int argc)
+{
+    insn_t *insn;
+    int i;
+
+    for (i = 0; i < argc; i++) {
+        insn = arena_alloc(INSN_ARENA, sizeof(insn_t));
+        insn->opcode = OP_push;
+        insn->rs1 = args[i];
+        insn->sz = argc - i;
+        bb_insert_insn_after(bb, bb->insn_list.tail, insn);
+    }
+    insn = arena_alloc(INSN_ARENA, sizeof(insn_t));
+    insn->opcode = OP_call;
+    insn->str = func->return_def.var_name;
+    bb_insert_insn_after(bb, bb->insn_list.tail, insn);
+    return bb_append_op(bb, OP_func_ret, NULL, NULL);
+}
+
+/* @base offset by @lo and @k, at the end of @bb */
+var_t *idiom_offset(basic_block_t *bb, var_t *base, var_t *lo, int k)
+{
+    if (k)
+        lo = bb_append_op(bb, OP_add, lo, bb_append_constant(bb, k));
+    return bb_append_op(bb, OP_add, base, lo);
+}
+
+/* Replace @loop, entered from @ph and running while @cmp of @iv holds, by
+ * a fill with the value of @write, or a copy from @read.
+ */
+int idiom_counted(fn_t *fn,
+                  loop_t *loop,
+                  basic_block_t *ph,
+                  induction_t *iv,
+                  insn_t *cmp,
+                  insn_t *read,
+                  insn_t *write)
+{
+    var_t *dest, *src, *bound, *val, *n, *lo, *args[3];
+    opcode_t op;
+    func_t *func;
+    int dest_k, src_k;
+
+    if (!cmp || cmp->belong_to != loop->header)
+        return 0;
+    op = cmp->opcode;
+    if (cmp->rs1 == iv->var) {
+        bound = cmp->rs2;
+    } else if (cmp->rs2 == iv->var) {
+        bound = cmp->rs1;
+        /* the variable goes on the left */
+        if (op == OP_lt)
+            op = OP_gt;
+        else if (op == OP_gt)
+            op = OP_lt;
+        else if (op == OP_leq)
+            op = OP_geq;
+        else if (op == OP_geq)
+            op = OP_leq;
+    } else
+        return 0;
+    if (iv->step > 0 && op != OP_lt && op != OP_leq && op != OP_neq)
+        return 0;
+    if (iv->step < 0 && op != OP_gt && op != OP_geq && op != OP_neq)
         return 0;
-    /* The global variable is unique and has no subscripts in our SSA. Do NOT
-     * evaluate its value.
-     */
-    if (insn->rd->is_global)
+    if (!idiom_address(loop, iv, write->rs1, &dest, &dest_k))
         return 0;
-    if (!insn->rs1->is_const) {
-        if (!insn->prev)
+
+    if (read) {
+        if (write->rs2 != read->rd || read->belong_to == loop->header)
+            return 0;
+        if (!idiom_address(loop, iv, read->rs1, &src, &src_k))
+            return 0;
+        if (iv->step > 0)
+            func = idiom_helper("__copy_bytes_up");
+        else
+            func = idiom_helper("__copy_bytes_down");
+    } else
+        func = idiom_helper("__fill_bytes");
+    if (!func)
+        return 0;
+    bound = idiom_value(loop, ph, bound);
+    if (!bound)
+        return 0;
+    if (!read) {
+        val = idiom_value(loop, ph, write->rs2);
+        if (!val)
+            return 0;
+    }
+
+    /* the bytes run from the lowest value of the variable, n of them */
+    if (iv->step > 0) {
+        n = bb_append_op(ph, OP_sub, bound, iv->init);
+        lo = iv->init;
+    } else {
+        n = bb_append_op(ph, OP_sub, iv->init, bound);
+        lo = bound;
+    }
+    if (op == OP_leq || op == OP_geq)
+        n = bb_append_op(ph, OP_add, n, bb_append_constant(ph, 1));
+    else if (iv->step < 0)
+        lo = bb_append_op(ph, OP_add, lo, bb_append_constant(ph, 1));
+
+    args[0] = idiom_offset(ph, dest, lo, dest_k);
+    if (read)
+        args[1] = idiom_offset(ph, src, lo, src_k);
+    else
+        args[1] = val;
+    args[2] = n;
+    idiom_call(ph, func, args, 3);
+    loop_bypass(fn, loop, ph);
+    return 1;
+}
+
+/* Replace @loop, entered from @ph and running while @read of the string
+ * indexed by @iv is not zero, by a call measuring the string.
+ */
+int idiom_scan(fn_t *fn,
+               loop_t *loop,
+               basic_block_t *ph,
+               induction_t *iv,
+               insn_t *read,
+               insn_t *br)
+{
+    insn_t *test = var_def(br->rs1);
+    var_t *base, *args[1], *len;
+    func_t *func;
+    int k, val;
+
+    if (br->rs1 != read->rd) {
+        if (!test || test->opcode != OP_neq)
+            return 0;
+        if (!(test->rs1 == read->rd && var_constant(test->rs2, &val)) &&
+            !(test->rs2 == read->rd && var_constant(test->rs1, &val)))
+            return 0;
+        if (val)
             return 0;
-        if (insn->prev->opcode != OP_load_constant)
+    }
+    if (iv->step != 1 || !idiom_address(loop, iv, read->rs1, &base, &k) || k)
+        return 0;
+    func = idiom_helper("__scan_bytes");
+    if (!func)
+        return 0;
+
+    args[0] = bb_append_op(ph, OP_add, base, iv->init);
+    len = idiom_call(ph, func, args, 1);
+    var_replace_uses(iv->var, bb_append_op(ph, OP_add, iv->init, len));
+    loop_bypass(fn, loop, ph);
+    return 1;
+}
+
+int idiom_loop(fn_t *fn, loop_t *loop)
+{
+    basic_block_t *header = loop->header, *ph, **chain;
+    insn_t *br, *insn, *phi = NULL, *read = NULL, *write = NULL;
+    induction_t iv;
+    int len, i;
+
+    chain = unroll_chain(loop, &len);
+    if (!chain)
+        return 0;
+    br = header->insn_list.tail;
+    if (br->opcode != OP_branch)
+        return 0;
+
+    /* one phi, for the induction variable, and no effect but the access */
+    for (insn = header->insn_list.head; insn != br; insn = insn->next) {
+        if (insn->opcode == OP_phi) {
+            if (phi)
+                return 0;
+            phi = insn;
+        } else if (!idiom_access(insn, &read, &write))
             return 0;
-        if (insn->rs1 != insn->prev->rd)
+    }
+    for (i = 0; i < len; i++)
+        for (insn = chain[i]->insn_list.head; insn; insn = insn->next)
+            if (!idiom_access(insn, &read, &write))
+                return 0;
+    if (!phi)
+        return 0;
+    ph = loop_preheader(fn, loop);
+    if (!ph || !ivsr_basic(loop, ph, phi, &iv))
+        return 0;
+    if (iv.step != 1 && iv.step != -1)
+        return 0;
+
+    /* nothing computed by the loop but the variable is read past it */
+    for (insn = header->insn_list.head; insn != br; insn = insn->next)
+        if (insn != phi && insn->rd && !var_used_in_loop(loop, insn->rd))
             return 0;
+
+    if (read && read->belong_to == header && !write)
+        return idiom_scan(fn, loop, ph, &iv, read, br);
+    if (!write || write->belong_to == header ||
+        !var_used_in_loop(loop, iv.var))
+        return 0;
+    return idiom_counted(fn, loop, ph, &iv, var_def(br->rs1), read, write);
+}
+
+void idiom(fn_t *fn)
+{
+    loop_t *loop;
+    int changed = 0;
+
+    /* the helpers are not to call themselves */
+    if (idiom_is_helper(fn->func->return_def.var_name))
+        return;
+
+    build_def_use(fn);
+    for (loop = fn->loops; loop; loop = loop->next) {
+        if (!idiom_loop(fn, loop))
+            continue;
+        build_def_use(fn);
+        changed = 1;
+    }
+    if (changed)
+        build_loops(fn);
+}
+
+/* Function inlining. A call to a small leaf function, or to a function
+ * called from nowhere else, is replaced by a copy of the blocks of the
+ * callee: the arguments are assigned to copies of its parameters, and its
+ * returns flow into the rest of the calling block. A caller is left alone
+ * once it grows past INLINE_CALLER_BUDGET instructions. Inlining runs before
+ * the other passes, which then fold the constants passed along.
+ */
+var_t *inline_var(block_t *scope, var_t *var)
+{
+    var_t *copy;
+
+    if (!var || var->is_global || var->is_func)
+        return var;
+    if (var->copy)
+        return var->copy;
+
+    copy = require_var(scope);
+    memcpy(copy, var, sizeof(var_t));
+    copy->var_name = intern_name(gen_name());
+    copy->copy = NULL;
+    var->copy = copy;
+    if (var->base == var)
+        copy->base = copy;
+    else
+        copy->base = inline_var(scope, var->base);
+    return copy;
+}
+
+/* Forget the copies made while inlining @callee */
+void inline_reset(fn_t *callee)
+{
+    basic_block_t *bb;
+    insn_t *insn;
+    phi_operand_t *op;
+    int i;
+
+    for (i = 0; i < callee->func->num_params; i++)
+        callee->func->param_defs[i].copy = NULL;
+    for (bb = callee->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            if (insn->rd) {
+                insn->rd->copy = NULL;
+                if (insn->rd->base)
+                    insn->rd->base->copy = NULL;
+            }
+            if (insn->rs1) {
+                insn->rs1->copy = NULL;
+                if (insn->rs1->base)
+                    insn->rs1->base->copy = NULL;
+            }
+            if (insn->rs2) {
+                insn->rs2->copy = NULL;
+                if (insn->rs2->base)
+                    insn->rs2->base->copy = NULL;
+            }
+            for (op = insn->phi_ops; op; op = op->next) {
+                op->var->copy = NULL;
+                if (op->var->base)
+                    op->var->base->copy = NULL;
+            }
+        }
+    }
+}
+
+void inline_drop(fn_t *dead);
+
+/* Add @cnt to the references counted in fn->calls of the functions called
+ * or named by @insn, dropping those no longer referenced by anything.
+ */
+void inline_refs(insn_t *insn, int cnt)
+{
+    func_t *func = NULL;
+    var_t *var = NULL;
+    fn_t *fn;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (i == 0 && insn->opcode == OP_call)
+            func = find_func(insn->str);
+        else if (i == 1 && insn->rs1 && insn->rs1->is_func)
+            var = insn->rs1;
+        else if (i == 2 && insn->rs2 && insn->rs2->is_func)
+            var = insn->rs2;
+        if (var)
+            func = find_func(var->var_name);
+        if (func && func->fn) {
+            fn = func->fn;
+            fn->calls += cnt;
+            /* the image exports all its functions, and the idioms may call
+             * their helpers later
+             */
+            if (!fn->calls && cnt < 0 && !build_libc_image &&
+                strcmp(func->return_def.var_name, "main") &&
+                !idiom_is_helper(func->return_def.var_name))
+                inline_drop(fn);
+        }
+        func = NULL;
+        var = NULL;
+    }
+}
+
+/* Remove @dead from FUNC_LIST, along with the references it makes */
+void inline_drop(fn_t *dead)
+{
+    fn_t *fn, *prev = NULL;
+    basic_block_t *bb;
+    insn_t *insn;
+
+    for (fn = FUNC_LIST.head; fn != dead; fn = fn->next)
+        prev = fn;
+    if (prev)
+        prev->next = dead->next;
+    else
+        FUNC_LIST.head = dead->next;
+    if (FUNC_LIST.tail == dead)
+        FUNC_LIST.tail = prev;
+
+    for (bb = dead->bbs; bb; bb = bb->rpo_next)
+        for (insn = bb->insn_list.head; insn; insn = insn->next)
+            inline_refs(insn, -1);
+}
+
+/* The instructions of @fn but its phis, and whether it calls nothing */
+int inline_size(fn_t *fn, int *is_leaf)
+{
+    basic_block_t *bb;
+    insn_t *insn;
+    int size = 0;
+
+    is_leaf[0] = 1;
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            if (insn->opcode == OP_phi)
+                continue;
+            if (insn->opcode == OP_call || insn->opcode == OP_indirect)
+                is_leaf[0] = 0;
+            size++;
+        }
+    }
+    return size;
+}
+
+/* The defined function called by @call in @fn if it is worth inlining, as
+ * long as @fn stays within @size instructions.
+ */
+fn_t *inline_callee(fn_t *fn, insn_t *call, int size)
+{
+    func_t *func = find_func(call->str);
+    fn_t *callee;
+    bb_connection_t *prev;
+    insn_t *insn;
+    int callee_size, is_leaf, args = 0, i;
+
+    if (!func || !func->fn || func->fn == fn || func->va_args)
+        return NULL;
+    callee = func->fn;
+    if (callee->prebuilt || callee->bbs->prev_idx || !callee->exit->prev_idx)
+        return NULL;
+
+    /* the arguments are pushed right before the call */
+    for (insn = call->prev; insn && insn->opcode == OP_push;
+         insn = insn->prev) {
+        if (insn->sz != args + 1)
+            break;
+        args++;
+    }
+    if (args != func->num_params)
+        return NULL;
+
+    /* a value is returned by every way out of it */
+    if (call->next && call->next->opcode == OP_func_ret &&
+        strcmp(func->return_def.type_name, "void")) {
+        prev = callee->exit->prev;
+        for (i = 0; i < callee->exit->prev_idx; i++) {
+            insn = prev[i].bb->insn_list.tail;
+            if (!insn || insn->opcode != OP_return || !insn->rs1)
+                return NULL;
+        }
+    }
+
+    callee_size = inline_size(callee, &is_leaf);
+    if (size + callee_size > INLINE_CALLER_BUDGET)
+        return NULL;
+    if (is_leaf && callee_size <= INLINE_LEAF_BUDGET)
+        return callee;
+    if (callee->calls == 1 && callee_size <= INLINE_SINGLE_BUDGET)
+        return callee;
+    return NULL;
+}
+
+/* The copy of @bb, a block of the callee, the rest of the calling block
+ * standing for its exit.
+ */
+basic_block_t *inline_block(fn_t *callee,
+                            basic_block_t *bb,
+                            basic_block_t **copies,
+                            basic_block_t *rest)
+{
+    if (bb == callee->exit)
+        return rest;
+    return copies[bb->rpo];
+}
+
+/* Move what follows @pos in @bb, and the edges out of @bb, to a new block */
+basic_block_t *inline_split(fn_t *fn, basic_block_t *bb, insn_t *pos)
+{
+    basic_block_t *rest = bb_create(bb->scope), *succ;
+    bb_connection_type_t type;
+    insn_t *insn;
+    phi_operand_t *op;
+    int i;
+
+    rest->visited = fn->visited;
+    rest->executable = 1;
+    while (pos->next) {
+        insn = pos->next;
+        bb_unlink_insn(bb, insn);
+        bb_insert_insn_after(rest, rest->insn_list.tail, insn);
+    }
+    for (i = 0; i < 3; i++) {
+        if (i == 0) {
+            succ = bb->next;
+            type = NEXT;
+        } else if (i == 1) {
+            succ = bb->then_;
+            type = THEN;
+        } else {
+            succ = bb->else_;
+            type = ELSE;
+        }
+        if (!succ)
+            continue;
+        bb_disconnect(bb, succ);
+        bb_connect(rest, succ, type);
+        for (insn = succ->insn_list.head; insn; insn = insn->next) {
+            if (insn->opcode != OP_phi)
+                continue;
+            for (op = insn->phi_ops; op; op = op->next)
+                if (op->from == bb)
+                    op->from = rest;
+        }
+    }
+    return rest;
+}
+
+/* Copy the instructions of @from, but its return, to @bb */
+void inline_copy_block(basic_block_t *bb, basic_block_t *from)
+{
+    insn_t *insn, *copy;
+    phi_operand_t *op, *copy_op, *last;
+
+    for (insn = from->insn_list.head; insn; insn = insn->next) {
+        if (insn->opcode == OP_return)
+            continue;
+        inline_refs(insn, 1);
+        copy = arena_alloc(INSN_ARENA, sizeof(insn_t));
+        memcpy(copy, insn, sizeof(insn_t));
+        copy->rd = inline_var(bb->scope, insn->rd);
+        copy->rs1 = inline_var(bb->scope, insn->rs1);
+        copy->rs2 = inline_var(bb->scope, insn->rs2);
+        copy->phi_ops = NULL;
+        last = NULL;
+        for (op = insn->phi_ops; op; op = op->next) {
+            copy_op = arena_alloc(INSN_ARENA, sizeof(phi_operand_t));
+            copy_op->var = inline_var(bb->scope, op->var);
+            copy_op->from = op->from;
+            if (last)
+                last->next = copy_op;
+            else
+                copy->phi_ops = copy_op;
+            last = copy_op;
+        }
+        bb_insert_insn_after(bb, bb->insn_list.tail, copy);
+    }
+}
+
+/* Replace @call, in @fn, by a copy of the blocks of @callee */
+void inline_call(fn_t *fn, insn_t *call, fn_t *callee)
+{
+    basic_block_t *bb = call->belong_to, *rest, *from, *copy, *last;
+    basic_block_t **copies;
+    block_t *scope = bb->scope;
+    insn_t *insn, *ret = NULL;
+    phi_operand_t *op, *vals = NULL;
+    var_t *args[MAX_PARAMS];
+    int cnt = 0, i;
+
+    /* the callee is numbered densely to look its copies up */
+    for (from = callee->bbs; from; from = from->rpo_next)
+        from->rpo = cnt++;
+    copies = arena_alloc(INSN_ARENA, cnt * HOST_PTR_SIZE);
+
+    for (i = callee->func->num_params - 1; i >= 0; i--) {
+        args[i] = call->prev->rs1;
+        bb_unlink_insn(bb, call->prev);
+    }
+    if (call->next && call->next->opcode == OP_func_ret)
+        ret = call->next;
+    rest = inline_split(fn, bb, ret ? ret : call);
+    if (ret)
+        bb_unlink_insn(bb, ret);
+    bb_unlink_insn(bb, call);
+
+    /* the arguments become the parameters */
+    for (i = 0; i < callee->func->num_params; i++) {
+        insn = arena_alloc(INSN_ARENA, sizeof(insn_t));
+        insn->opcode = OP_assign;
+        insn->rd = inline_var(
+            scope, get_subscript(&callee->func->param_defs[i], 0));
+        insn->rs1 = args[i];
+        bb_insert_insn_after(bb, bb->insn_list.tail, insn);
+    }
+
+    last = bb;
+    for (from = callee->bbs; from; from = from->rpo_next) {
+        if (from == callee->exit)
+            continue;
+        copy = bb_create(scope);
+        copy->visited = fn->visited;
+        copy->executable = 1;
+        inline_copy_block(copy, from);
+        copies[from->rpo] = copy;
+        copy->rpo_next = last->rpo_next;
+        last->rpo_next = copy;
+        last = copy;
+    }
+    rest->rpo_next = last->rpo_next;
+    last->rpo_next = rest;
+    bb_connect(bb, copies[0], NEXT);
+
+    /* the edges of the copies, the returns flowing into the rest */
+    for (from = callee->bbs; from; from = from->rpo_next) {
+        if (from == callee->exit)
+            continue;
+        copy = copies[from->rpo];
+        if (from->next)
+            bb_connect(copy, inline_block(callee, from->next, copies, rest),
+                       NEXT);
+        if (from->then_)
+            bb_connect(copy, inline_block(callee, from->then_, copies, rest),
+                       THEN);
+        if (from->else_)
+            bb_connect(copy, inline_block(callee, from->else_, copies, rest),
+                       ELSE);
+        for (insn = copy->insn_list.head; insn; insn = insn->next)
+            for (op = insn->phi_ops; op; op = op->next)
+                op->from = copies[op->from->rpo];
+
+        insn = from->insn_list.tail;
+        if (!ret || !insn || insn->opcode != OP_return || !insn->rs1)
+            continue;
+        op = arena_alloc(INSN_ARENA, sizeof(phi_operand_t));
+        op->var = inline_var(scope, insn->rs1);
+        op->from = copy;
+        op->next = vals;
+        vals = op;
+    }
+
+    /* the value returned, merged if returned from several places */
+    if (vals) {
+        insn = arena_alloc(INSN_ARENA, sizeof(insn_t));
+        insn->rd = ret->rd;
+        if (vals->next) {
+            insn->opcode = OP_phi;
+            insn->phi_ops = vals;
+        } else {
+            insn->opcode = OP_assign;
+            insn->rs1 = vals->var;
+        }
+        bb_insert_insn_after(rest, NULL, insn);
+    }
+    inline_reset(callee);
+}
+
+/* Inline the calls worth it, see inline_callee(), in every function */
+void inline_calls()
+{
+    fn_t *fn, *callee;
+    basic_block_t *bb;
+    insn_t *insn, **calls;
+    int calls_idx, size, is_leaf, changed, i;
+
+    for (insn = GLOBAL_FUNC.fn->bbs->insn_list.head; insn; insn = insn->next)
+        inline_refs(insn, 1);
+    for (fn = FUNC_LIST.head; fn; fn = fn->next)
+        for (bb = fn->bbs; bb; bb = bb->rpo_next)
+            for (insn = bb->insn_list.head; insn; insn = insn->next)
+                inline_refs(insn, 1);
+
+    for (fn = FUNC_LIST.head; fn; fn = fn->next) {
+        /* the calls of the copies are left alone */
+        calls_idx = 0;
+        for (bb = fn->bbs; bb; bb = bb->rpo_next)
+            for (insn = bb->insn_list.head; insn; insn = insn->next)
+                if (insn->opcode == OP_call)
+                    calls_idx++;
+        if (!calls_idx)
+            continue;
+        calls = arena_alloc(INSN_ARENA, calls_idx * HOST_PTR_SIZE);
+        calls_idx = 0;
+        for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+            for (insn = bb->insn_list.head; insn; insn = insn->next) {
+                insn->belong_to = bb;
+                if (insn->opcode == OP_call)
+                    calls[calls_idx++] = insn;
+            }
+        }
+
+        size = inline_size(fn, &is_leaf);
+        changed = 0;
+        for (i = 0; i < calls_idx; i++) {
+            callee = inline_callee(fn, calls[i], size);
+            if (!callee)
+                continue;
+            size += inline_size(callee, &is_leaf);
+            inline_call(fn, calls[i], callee);
+            inline_refs(calls[i], -1);
+            changed = 1;
+        }
+        if (!changed)
+            continue;
+
+        i = 0;
+        for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+            bb->rpo = i++;
+            bb->idom = NULL;
+        }
+        fn_build_idom(fn);
+        fn_build_dom(fn);
+        build_loops(fn);
+    }
+}
+
+/* Tail calls. A call whose value, if any, is returned right away leaves
+ * nothing for its caller to do. A function calling itself that way jumps
+ * back to its start instead, the arguments flowing into phis of the
+ * parameters, so the recursion runs as a loop. Other calls in tail position
+ * become OP_tail_call, which releases the frame of the caller before jumping
+ * to the callee, so the callee returns straight to the caller's caller.
+ * Either way the frame must hold nothing the callee may point into.
+ */
+int tail_frame_free(fn_t *fn)
+{
+    basic_block_t *bb;
+    insn_t *insn;
+    var_t *var;
+
+    if (fn->func->va_args)
+        return 0;
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            if (insn->opcode == OP_address_of && !insn->rs1->is_global)
+                return 0;
+            if (insn->opcode != OP_allocat)
+                continue;
+            /* arrays and structures live in the frame, see reg_alloc() */
+            var = insn->rd;
+            if (var->array_size)
+                return 0;
+            if (!var->is_ptr && strcmp(var->type_name, "int") &&
+                strcmp(var->type_name, "char") &&
+                strcmp(var->type_name, "void"))
+                return 0;
+        }
     }
-
-    insn->opcode = OP_load_constant;
-    insn->rd->is_const = 1;
-    insn->rd->init_val = insn->rs1->init_val;
-    insn->rs1 = NULL;
     return 1;
 }
 
-int eval_const_arithmetic(insn_t *insn)
+/* The direct call @bb of @fn ends with, if all that follows it is the
+ * return of its value.
+ */
+insn_t *tail_call(fn_t *fn, basic_block_t *bb)
 {
-    if (!insn->rs1)
-        return 0;
-    if (!insn->rs1->is_const)
-        return 0;
-    if (!insn->rs2)
-        return 0;
-    if (!insn->rs2->is_const)
-        return 0;
+    insn_t *insn = bb->insn_list.tail, *ret = NULL;
+    func_t *func;
+
+    if (bb->next != fn->exit || !insn)
+        return NULL;
+    if (insn->opcode == OP_return) {
+        ret = insn;
+        insn = insn->prev;
+    }
+    if (insn && insn->opcode == OP_func_ret) {
+        if (!ret || ret->rs1 != insn->rd)
+            return NULL;
+        insn = insn->prev;
+    } else if (ret && ret->rs1)
+        return NULL;
+    if (!insn || insn->opcode != OP_call)
+        return NULL;
+
+    func = find_func(insn->str);
+    if (!func || !func->fn)
+        return NULL;
+    return insn;
+}
 
-    int res;
-    int l = insn->rs1->init_val;
-    int r = insn->rs2->init_val;
+/* Drop what follows @call in @bb, the return of its value */
+void tail_drop_return(basic_block_t *bb, insn_t *call)
+{
+    while (call->next)
+        bb_unlink_insn(bb, call->next);
+}
 
-    switch (insn->opcode) {
-    case OP_add:
-        res = l + r;
-        break;
-    case OP_sub:
-        res = l - r;
-        break;
-    case OP_mul:
-        res = l * r;
-        break;
-    case OP_div:
-        res = l / r;
-        break;
-    case OP_mod:
-        res = l % r;
-        break;
-    default:
-        return 0;
+/* Turn the calls of @fn to itself in tail position into a loop */
+void tail_recurse(fn_t *fn)
+{
+    func_t *func = fn->func;
+    basic_block_t *header = fn->bbs, *entry, *bb, **tails;
+    insn_t *insn, *call, *phis[MAX_PARAMS];
+    phi_operand_t *op;
+    var_t *params[MAX_PARAMS], *vars[MAX_PARAMS], *args[MAX_PARAMS];
+    int tails_idx = 0, cnt, i, j;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        call = tail_call(fn, bb);
+        if (call && find_func(call->str) == func)
+            tails_idx++;
     }
+    /* the recursion has to end somewhere */
+    if (!tails_idx || tails_idx == fn->exit->prev_idx ||
+        !tail_frame_free(fn))
+        return;
 
-    insn->rs1 = NULL;
-    insn->rs2 = NULL;
-    insn->rd->is_const = 1;
-    insn->rd->init_val = res;
-    insn->opcode = OP_load_constant;
-    return 1;
+    tails = arena_alloc(INSN_ARENA, tails_idx * HOST_PTR_SIZE);
+    tails_idx = 0;
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        call = tail_call(fn, bb);
+        if (!call || find_func(call->str) != func)
+            continue;
+        cnt = 0;
+        for (insn = call->prev; insn && insn->opcode == OP_push;
+             insn = insn->prev) {
+            if (insn->sz != cnt + 1)
+                break;
+            cnt++;
+        }
+        if (cnt == func->num_params)
+            tails[tails_idx++] = bb;
+    }
+    if (!tails_idx)
+        return;
+
+    /* the parameters are read through phis at the start of the loop */
+    for (i = 0; i < func->num_params; i++) {
+        params[i] = get_subscript(&func->param_defs[i], 0);
+        vars[i] = require_var(header->scope);
+        memcpy(vars[i], params[i], sizeof(var_t));
+        vars[i]->var_name = intern_name(gen_name());
+    }
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            for (i = 0; i < func->num_params; i++) {
+                if (insn->rs1 == params[i])
+                    insn->rs1 = vars[i];
+                if (insn->rs2 == params[i])
+                    insn->rs2 = vars[i];
+                for (op = insn->phi_ops; op; op = op->next)
+                    if (op->var == params[i])
+                        op->var = vars[i];
+            }
+        }
+    }
+
+    entry = bb_create(header->scope);
+    entry->visited = fn->visited;
+    entry->executable = 1;
+    entry->rpo_next = header;
+    fn->bbs = entry;
+    bb_connect(entry, header, NEXT);
+    for (i = func->num_params - 1; i >= 0; i--) {
+        phis[i] = bb_new_insn(header, NULL, OP_phi, vars[i], NULL, NULL);
+        op = arena_alloc(INSN_ARENA, sizeof(phi_operand_t));
+        op->var = params[i];
+        op->from = entry;
+        phis[i]->phi_ops = op;
+    }
+
+    for (j = 0; j < tails_idx; j++) {
+        bb = tails[j];
+        call = tail_call(fn, bb);
+        tail_drop_return(bb, call);
+        for (i = func->num_params - 1; i >= 0; i--) {
+            args[i] = call->prev->rs1;
+            bb_unlink_insn(bb, call->prev);
+        }
+        bb_unlink_insn(bb, call);
+        for (i = 0; i < func->num_params; i++) {
+            op = arena_alloc(INSN_ARENA, sizeof(phi_operand_t));
+            op->var = args[i];
+            op->from = bb;
+            op->next = phis[i]->phi_ops;
+            phis[i]->phi_ops = op;
+        }
+        bb_disconnect(bb, fn->exit);
+        bb_connect(bb, header, NEXT);
+    }
+
+    i = 0;
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        bb->rpo = i++;
+        bb->idom = NULL;
+    }
+    fn_build_idom(fn);
+    fn_build_dom(fn);
+    build_loops(fn);
 }
 
-int const_folding(insn_t *insn)
+/* Let the other calls of @fn in tail position reuse its frame */
+void tail_calls(fn_t *fn)
 {
-    if (mark_const(insn))
-        return 1;
-    if (eval_const_arithmetic(insn))
-        return 1;
-    return 0;
+    basic_block_t *bb;
+    insn_t *call;
+
+    if (!tail_frame_free(fn))
+        return;
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        call = tail_call(fn, bb);
+        if (!call)
+            continue;
+        tail_drop_return(bb, call);
+        call->opcode = OP_tail_call;
+    }
 }
 
 void optimize()
 {
     fn_t *fn;
+
+    for (fn = FUNC_LIST.head; fn; fn = fn->next)
+        tail_recurse(fn);
+    inline_calls();
     for (fn = FUNC_LIST.head; fn; fn = fn->next) {
-        /* basic block level (control flow) optimizations */
+        build_def_use(fn);
+        sccp(fn);
+        gvn(fn);
+        licm(fn);
+        idiom(fn);
+        unroll(fn);
+        ivsr(fn);
+        dce(fn);
+        tail_calls(fn);
+    }
+}
 
-        basic_block_t *bb;
-        for (bb = fn->bbs; bb; bb = bb->rpo_next) {
-            /* instruction level optimizations */
-            insn_t *insn;
-            for (insn = bb->insn_list.head; insn; insn = insn->next) {
-                if (cse(insn, bb))
-                    continue;
-                if (const_folding(insn))
+/* Out-of-SSA translation. The phis of a block become parallel copies at the
+ * end of its predecessors, an edge leaving a branch first getting a block of
+ * its own to hold them. Beforehand, each phi absorbs those of its operands
+ * which interfere neither with it nor with each other: they then write the
+ * phi variable directly and their copies vanish. The remaining copies are
+ * ordered so that none overwrites a value still to be read, a cycle going
+ * through a temporary.
+ */
+int out_reads(insn_t *insn, var_t *var)
+{
+    return insn->opcode != OP_phi && (insn->rs1 == var || insn->rs2 == var);
+}
+
+/* Mark the predecessors of @bb which @var is live into, up to @def */
+void out_mark_preds(fn_t *fn, basic_block_t *bb, basic_block_t *def)
+{
+    bb_connection_t *prev = bb->prev;
+    basic_block_t *pred;
+    int i;
+
+    for (i = 0; i < bb->prev_idx; i++) {
+        pred = prev[i].bb;
+        if (pred == def || pred->visited == fn->visited)
+            continue;
+        pred->visited = fn->visited;
+        out_mark_preds(fn, pred, def);
+    }
+}
+
+/* Mark the blocks @var is live into, walking back from its uses to its
+ * definition. The marks hold until the next call.
+ */
+void out_mark_live(fn_t *fn, var_t *var)
+{
+    basic_block_t *def = var->def ? var->def->belong_to : fn->bbs, *bb;
+    use_t *use;
+    phi_operand_t *op;
+
+    fn->visited++;
+    for (use = var->uses; use; use = use->next) {
+        if (use->insn->opcode != OP_phi) {
+            bb = use->insn->belong_to;
+            if (bb != def && bb->visited != fn->visited) {
+                bb->visited = fn->visited;
+                out_mark_preds(fn, bb, def);
+            }
+            continue;
+        }
+        /* read at the end of the predecessor */
+        for (op = use->insn->phi_ops; op; op = op->next) {
+            bb = op->from;
+            if (op->var != var || bb == def || bb->visited == fn->visited)
+                continue;
+            bb->visited = fn->visited;
+            out_mark_preds(fn, bb, def);
+        }
+    }
+}
+
+/* Whether @var, whose blocks are marked, is still to be read after @pos */
+int out_live_after(fn_t *fn, var_t *var, insn_t *pos)
+{
+    basic_block_t *bb = pos->belong_to, *succ;
+    insn_t *insn;
+    phi_operand_t *op;
+    int i;
+
+    for (insn = pos->next; insn; insn = insn->next) {
+        if (out_reads(insn, var))
+            return 1;
+        if (insn->rd == var)
+            return 0;
+    }
+    for (i = 0; i < 3; i++) {
+        if (i == 0)
+            succ = bb->next;
+        else if (i == 1)
+            succ = bb->then_;
+        else
+            succ = bb->else_;
+        if (!succ)
+            continue;
+        if (succ->visited == fn->visited)
+            return 1;
+        for (insn = succ->insn_list.head; insn; insn = insn->next) {
+            if (insn->opcode != OP_phi)
+                break;
+            for (op = insn->phi_ops; op; op = op->next)
+                if (op->from == bb && op->var == var)
+                    return 1;
+        }
+    }
+    return 0;
+}
+
+/* Whether @var can be merged with @phi and the operands already merged with
+ * it: none may be live where another one is defined.
+ */
+int out_coalescible(fn_t *fn, insn_t *phi, var_t *var)
+{
+    phi_operand_t *op;
+    var_t *member;
+
+    if (var == phi->rd || var->copy || !sccp_tracked(var) ||
+        var->def_cnt != 1 || !var->def)
+        return 0;
+    /* constants and allocations are kept in the variable they define */
+    switch (var->def->opcode) {
+    case OP_phi:
+    case OP_allocat:
+    case OP_load_constant:
+    case OP_load_data_address:
+        return 0;
+    default:
+        break;
+    }
+
+    out_mark_live(fn, var);
+    if (out_live_after(fn, var, phi))
+        return 0;
+    for (op = phi->phi_ops; op; op = op->next)
+        if (op->var->copy == phi->rd && out_live_after(fn, var, op->var->def))
+            return 0;
+
+    out_mark_live(fn, phi->rd);
+    if (out_live_after(fn, phi->rd, var->def))
+        return 0;
+    for (op = phi->phi_ops; op; op = op->next) {
+        member = op->var;
+        if (member->copy != phi->rd)
+            continue;
+        out_mark_live(fn, member);
+        if (out_live_after(fn, member, var->def))
+            return 0;
+    }
+    return 1;
+}
+
+var_t *out_var(var_t *var)
+{
+    if (var && var->copy)
+        return var->copy;
+    return var;
+}
+
+/* Give the edge from @pred to @bb a block of its own */
+basic_block_t *out_split(fn_t *fn, basic_block_t *pred, basic_block_t *bb)
+{
+    basic_block_t *mid = bb_create(pred->scope), *pos;
+    bb_connection_type_t type = pred->then_ == bb ? THEN : ELSE;
+    insn_t *insn;
+    phi_operand_t *op;
+
+    bb_disconnect(pred, bb);
+    bb_connect(pred, mid, type);
+    bb_connect(mid, bb, NEXT);
+    for (insn = bb->insn_list.head; insn; insn = insn->next)
+        for (op = insn->phi_ops; op; op = op->next)
+            if (op->from == pred)
+                op->from = mid;
+
+    /* fall through from the branch if it can, else into @bb */
+    if (type == ELSE)
+        pos = pred;
+    else
+        for (pos = fn->bbs; pos->rpo_next != bb; pos = pos->rpo_next)
+            ;
+    mid->rpo_next = pos->rpo_next;
+    pos->rpo_next = mid;
+    return mid;
+}
+
+/* Place after @pos in @bb the copies of @srcs to @dsts, @cnt in all, as if
+ * made at once.
+ */
+void out_copies(basic_block_t *bb,
+                insn_t *pos,
+                var_t **dsts,
+                var_t **srcs,
+                int cnt)
+{
+    var_t *tmp;
+    int i, j;
+
+    while (cnt) {
+        /* a copy whose target no other one reads */
+        for (i = 0; i < cnt; i++) {
+            for (j = 0; j < cnt; j++)
+                if (j != i && srcs[j] == dsts[i])
+                    break;
+            if (j == cnt)
+                break;
+        }
+        if (i == cnt) {
+            /* only cycles are left, set one target aside */
+            tmp = bb_new_var(bb);
+            pos = bb_new_insn(bb, pos, OP_assign, tmp, dsts[0], NULL);
+            for (j = 0; j < cnt; j++)
+                if (srcs[j] == dsts[0])
+                    srcs[j] = tmp;
+            continue;
+        }
+        pos = bb_new_insn(bb, pos, OP_assign, dsts[i], srcs[i], NULL);
+        cnt--;
+        dsts[i] = dsts[cnt];
+        srcs[i] = srcs[cnt];
+    }
+}
+
+/* Replace the phis of @bb by copies on its incoming edges */
+void out_block(fn_t *fn, basic_block_t *bb, var_t **dsts, var_t **srcs)
+{
+    bb_connection_t *prev = bb->prev;
+    basic_block_t *pred, *at, **preds;
+    insn_t *insn, *pos;
+    phi_operand_t *op;
+    int preds_idx = bb->prev_idx, cnt, i;
+
+    /* splitting edges reorders the predecessors */
+    preds = arena_alloc(INSN_ARENA, preds_idx * HOST_PTR_SIZE);
+    for (i = 0; i < preds_idx; i++)
+        preds[i] = prev[i].bb;
+
+    for (i = 0; i < preds_idx; i++) {
+        pred = preds[i];
+        cnt = 0;
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            if (insn->opcode != OP_phi)
+                break;
+            for (op = insn->phi_ops; op; op = op->next) {
+                if (op->from != pred || out_var(op->var) == insn->rd)
                     continue;
-                /* more optimizations */
+                dsts[cnt] = insn->rd;
+                srcs[cnt] = out_var(op->var);
+                cnt++;
             }
         }
+        if (!cnt)
+            continue;
+
+        /* a single predecessor leaves them to the block itself */
+        if (preds_idx == 1) {
+            at = bb;
+            for (pos = bb->insn_list.head; pos->next; pos = pos->next)
+                if (pos->next->opcode != OP_phi)
+                    break;
+        } else {
+            at = pred;
+            if (pred->then_)
+                at = out_split(fn, pred, bb);
+            pos = at->insn_list.tail;
+        }
+        out_copies(at, pos, dsts, srcs, cnt);
+    }
+
+    while (bb->insn_list.head && bb->insn_list.head->opcode == OP_phi)
+        bb_unlink_insn(bb, bb->insn_list.head);
+}
+
+void fn_unwind_phi(fn_t *fn)
+{
+    basic_block_t *bb;
+    insn_t *insn;
+    phi_operand_t *op;
+    var_t **dsts, **srcs;
+    int cnt = 0, i;
+
+    build_def_use(fn);
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            for (op = insn->phi_ops; op; op = op->next)
+                op->var->copy = NULL;
+            if (insn->rd)
+                insn->rd->copy = NULL;
+        }
+    }
+
+    /* merge the operands of each phi with it where possible */
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        i = 0;
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            if (insn->opcode != OP_phi)
+                break;
+            i++;
+            if (!sccp_tracked(insn->rd))
+                continue;
+            for (op = insn->phi_ops; op; op = op->next)
+                if (out_coalescible(fn, insn, op->var))
+                    op->var->copy = insn->rd;
+        }
+        if (i > cnt)
+            cnt = i;
+    }
+    if (!cnt)
+        return;
+
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        for (insn = bb->insn_list.head; insn; insn = insn->next) {
+            if (insn->opcode == OP_phi)
+                continue;
+            insn->rd = out_var(insn->rd);
+            insn->rs1 = out_var(insn->rs1);
+            insn->rs2 = out_var(insn->rs2);
+        }
+    }
+
+    dsts = arena_alloc(INSN_ARENA, cnt * HOST_PTR_SIZE);
+    srcs = arena_alloc(INSN_ARENA, cnt * HOST_PTR_SIZE);
+    for (bb = fn->bbs; bb; bb = bb->rpo_next)
+        if (bb->insn_list.head && bb->insn_list.head->opcode == OP_phi)
+            out_block(fn, bb, dsts, srcs);
+
+    i = 0;
+    for (bb = fn->bbs; bb; bb = bb->rpo_next) {
+        bb->rpo = i++;
+        bb->visited = fn->visited;
     }
 }
 
+void unwind_phi()
+{
+    fn_t *fn;
+
+    for (fn = FUNC_LIST.head; fn; fn = fn->next)
+        fn_unwind_phi(fn);
+}
+
 void bb_index_reversed_rpo(fn_t *fn, basic_block_t *bb)
 {
     bb->rpo_r = fn->bb_cnt++;
@@ -1269,24 +4793,6 @@ void build_reversed_rpo()
     free(args);
 }
 
-void bb_reset_live_kill_idx(fn_t *fn, basic_block_t *bb)
-{
-    UNUSED(fn);
-    bb->live_kill_idx = 0;
-}
-
-void add_live_gen(basic_block_t *bb, var_t *var)
-{
-    if (var->is_global)
-        return;
-
-    int i;
-    for (i = 0; i < bb->live_gen_idx; i++)
-        if (bb->live_gen[i] == var)
-            return;
-    bb->live_gen[bb->live_gen_idx++] = var;
-}
-
 void update_consumed(insn_t *insn, var_t *var)
 {
     if (insn->idx > var->consumed)
@@ -1295,8 +4801,6 @@ void update_consumed(insn_t *insn, var_t *var)
 
 void bb_solve_locals(fn_t *fn, basic_block_t *bb)
 {
-    UNUSED(fn);
-
     int i = 0;
     insn_t *insn;
     for (insn = bb->insn_list.head; insn; insn = insn->next) {
@@ -1313,89 +4817,9 @@ void bb_solve_locals(fn_t *fn, basic_block_t *bb)
             update_consumed(insn, insn->rs2);
         }
         if (insn->rd)
-            if (insn->opcode != OP_unwound_phi)
-                bb_add_killed_var(bb, insn->rd);
-    }
-}
-
-void add_live_in(basic_block_t *bb, var_t *var)
-{
-    int i;
-    for (i = 0; i < bb->live_in_idx; i++)
-        if (bb->live_in[i] == var)
-            return;
-    bb->live_in[bb->live_in_idx++] = var;
-}
-
-void compute_live_in(basic_block_t *bb)
-{
-    bb->live_in_idx = 0;
-
-    int i;
-    for (i = 0; i < bb->live_out_idx; i++) {
-        if (var_check_killed(bb->live_out[i], bb))
-            continue;
-        add_live_in(bb, bb->live_out[i]);
-    }
-    for (i = 0; i < bb->live_gen_idx; i++)
-        add_live_in(bb, bb->live_gen[i]);
-}
-
-int merge_live_in(var_t *live_out[], int live_out_idx, basic_block_t *bb)
-{
-    int i;
-    for (i = 0; i < bb->live_in_idx; i++) {
-        int j, found = 0;
-        for (j = 0; j < live_out_idx; j++)
-            if (live_out[j] == bb->live_in[i]) {
-                found = 1;
-                break;
-            }
-        if (!found)
-            live_out[live_out_idx++] = bb->live_in[i];
-    }
-    return live_out_idx;
-}
-
-int recompute_live_out(basic_block_t *bb)
-{
-    var_t *live_out[MAX_ANALYSIS_STACK_SIZE];
-    int live_out_idx = 0;
-
-    if (bb->next) {
-        compute_live_in(bb->next);
-        live_out_idx = merge_live_in(live_out, live_out_idx, bb->next);
-    }
-    if (bb->then_) {
-        compute_live_in(bb->then_);
-        live_out_idx = merge_live_in(live_out, live_out_idx, bb->then_);
-    }
-    if (bb->else_) {
-        compute_live_in(bb->else_);
-        live_out_idx = merge_live_in(live_out, live_out_idx, bb->else_);
-    }
-
-    if (bb->live_out_idx != live_out_idx) {
-        memcpy(bb->live_out, live_out, HOST_PTR_SIZE * live_out_idx);
-        bb->live_out_idx = live_out_idx;
-        return 1;
-    }
-
-    int i;
-    for (i = 0; i < live_out_idx; i++) {
-        int j, same = 0;
-        for (j = 0; j < bb->live_out_idx; j++)
-            if (live_out[i] == bb->live_out[j]) {
-                same = 1;
-                break;
-            }
-        if (!same) {
-            memcpy(bb->live_out, live_out, HOST_PTR_SIZE * live_out_idx);
-            bb->live_out_idx = live_out_idx;
-            return 1;
-        }
+            bb_add_killed_var(bb, insn->rd);
     }
-    return 0;
+    update_live_in(fn, bb);
 }
 
 void liveness_analysis()
@@ -1408,13 +4832,15 @@ void liveness_analysis()
         args->fn = fn;
         args->bb = fn->bbs;
 
-        fn->visited++;
-        args->preorder_cb = bb_reset_live_kill_idx;
-        bb_forward_traversal(args);
-
+        /* parameters are defined at the entry, unused ones stay unnumbered */
         int i;
         for (i = 0; i < fn->func->num_params; i++)
-            bb_add_killed_var(fn->bbs, fn->func->param_defs[i].subscripts[0]);
+            reset_live_id(get_subscript(&fn->func->param_defs[i], 0));
+        fn_number_vars(args, 0);
+
+        for (i = 0; i < fn->func->num_params; i++)
+            bb_add_killed_var(fn->bbs,
+                              get_subscript(&fn->func->param_defs[i], 0));
 
         fn->visited++;
         args->preorder_cb = bb_solve_locals;
@@ -1422,64 +4848,24 @@ void liveness_analysis()
     }
     free(args);
 
+    /* blocks are seeded in reverse postorder of the reversed CFG */
     for (fn = FUNC_LIST.head; fn; fn = fn->next) {
-        basic_block_t *bb = fn->exit;
-        int changed;
-        do {
-            changed = 0;
-            for (bb = fn->exit; bb; bb = bb->rpo_r_next)
-                changed |= recompute_live_out(bb);
-        } while (changed);
-    }
-}
-
-void bb_release(fn_t *fn, basic_block_t *bb)
-{
-    UNUSED(fn);
-
-    insn_t *insn = bb->insn_list.head;
-    insn_t *next_insn;
-    while (insn) {
-        next_insn = insn->next;
-        free(insn);
-        insn = next_insn;
-    }
-
-    /* disconnect all predecessors */
-    int i;
-    for (i = 0; i < MAX_BB_PRED; i++) {
-        if (!bb->prev[i].bb)
-            continue;
-        switch (bb->prev[i].type) {
-        case NEXT:
-            bb->prev[i].bb->next = NULL;
-            break;
-        case THEN:
-            bb->prev[i].bb->then_ = NULL;
-            break;
-        case ELSE:
-            bb->prev[i].bb->else_ = NULL;
-            break;
-        default:
-            abort();
+        basic_block_t **blocks =
+            arena_alloc(INSN_ARENA, fn->bb_cnt * HOST_PTR_SIZE);
+        basic_block_t *bb;
+        int i = 0;
+        for (bb = fn->exit; bb; bb = bb->rpo_r_next) {
+            blocks[i] = bb;
+            i++;
         }
-
-        bb->prev[i].bb = NULL;
+        solve_liveness(fn, blocks, i);
     }
-    free(bb);
 }
 
+/* The first phase IR has been lowered by the register allocation, so the
+ * instructions, phi operands and symbol lists are dropped at once.
+ */
 void ssa_release()
 {
-    fn_t *fn;
-    bb_traversal_args_t *args = calloc(1, sizeof(bb_traversal_args_t));
-    for (fn = FUNC_LIST.head; fn; fn = fn->next) {
-        args->fn = fn;
-        args->bb = fn->bbs;
-
-        fn->visited++;
-        args->postorder_cb = bb_release;
-        bb_forward_traversal(args);
-    }
-    free(args);
+    arena_release(INSN_ARENA);
 }
@@ -3,6 +3,10 @@
 set -u
 
 readonly SHECC="$PWD/out/shecc"
+readonly LIBC_IMAGE="$PWD/out/libc.img"
+
+# extra options of shecc for the programs compiled by try
+TRY_OPTS=''
 
 # try - test shecc with given code
 # Usage:
@@ -25,7 +29,7 @@ function try() {
     local tmp_in="$(mktemp --suffix .c)"
     local tmp_exe="$(mktemp)"
     echo "$input" > "$tmp_in"
-    "$SHECC" -o "$tmp_exe" "$tmp_in"
+    "$SHECC" $TRY_OPTS -o "$tmp_exe" "$tmp_in"
     chmod +x $tmp_exe
 
     local output=''
@@ -117,6 +121,18 @@ expr 1 "1 || 1"
 expr 0 "0 && 0"
 expr 0 "1 && 0"
 expr 1 "1 && 1"
+expr 1 "1 && 2"
+expr 1 "4 && 3"
+try_ 1 << EOF
+int f(int a, int b)
+{
+    return a && b;
+}
+int main(int argc, char **argv)
+{
+    return f(argc + 1, argc * 4);
+}
+EOF
 
 expr 16 "2 << 3"
 expr 32 "256 >> 3"
@@ -296,6 +312,23 @@ int main() {
 }
 EOF
 
+# elements added to a product, only pointers being scaled
+try_ 53 << EOF
+int main() {
+    char *name = "struct";
+    char *names[2];
+    int ary[2];
+    names[1] = name;
+    ary[0] = 5;
+    ary[1] = 7;
+    if (name[0] + name[1] * 13 + name[5] * 17 != 3595)
+        return 1;
+    if (ary[0] + ary[1] * 2 != 19)
+        return 2;
+    return *(names[1] + 1) - 63;
+}
+EOF
+
 # global initialization
 try_ 20 << EOF
 int a = 5 * 2;
@@ -323,6 +356,13 @@ expr 1 "sizeof(char)";
 items 10 "int a; a = 0; switch (3) { case 0: return 2; case 3: a = 10; break; case 1: return 0; } return a;"
 items 10 "int a; a = 0; switch (3) { case 0: return 2; default: a = 10; break; } return a;"
 
+# more break edges into the end of a switch than a block used to hold
+cases=""
+for i in $(seq 0 159); do
+    cases="$cases case $i: a = $i + 1; break;"
+done
+items 151 "int a; a = 0; switch (150) {$cases } return a;"
+
 # enum
 try_ 6 << EOF
 typedef enum { enum1 = 5, enum2 } enum_t;
@@ -345,6 +385,33 @@ int main()
 }
 EOF
 
+# chunks, reused or not, keep their data clear of the neighbouring headers
+try_ 1 << EOF
+int main()
+{
+    char *a, *b, *c;
+    int i, s = 0;
+    a = malloc(4000);
+    b = malloc(4000);
+    c = malloc(4000);
+    for (i = 0; i < 4000; i++) {
+        a[i] = 1;
+        b[i] = 2;
+        c[i] = 3;
+    }
+    free(b);
+    b = malloc(4090);
+    for (i = 0; i < 4090; i++)
+        b[i] = 4;
+    for (i = 0; i < 4000; i++)
+        s = s + a[i] + c[i];
+    free(a);
+    free(c);
+    free(b);
+    return s == 16000;
+}
+EOF
+
 try_ 1 << EOF
 int main()
 {
@@ -369,6 +436,148 @@ int main()
 }
 EOF
 
+# #ifndef...#endif and #pragma
+try_ 7 << EOF
+#pragma once
+#ifndef A
+#define A 7
+#endif
+#ifndef A
+#define A 0
+#endif
+int main()
+{
+    return A;
+}
+EOF
+
+# try_include - test shecc with a header
+# Usage:
+# - try_include exit_code header_code input_code
+# write "header_code" to header.h next to "input_code", which includes it as
+# "header.h", and expect the compiled program exit with code "exit_code".
+function try_include() {
+    local expected="$1"
+    local header="$2"
+    local input="$3"
+
+    local tmp_dir="$(mktemp -d)"
+    echo "$header" > "$tmp_dir/header.h"
+    echo "$input" > "$tmp_dir/input.c"
+    "$SHECC" -o "$tmp_dir/exe" "$tmp_dir/input.c"
+    chmod +x "$tmp_dir/exe"
+
+    $TARGET_EXEC "$tmp_dir/exe"
+    local actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$input => $expected expected, but got $actual"
+        echo "input: $tmp_dir/input.c"
+        echo "executable: $tmp_dir/exe"
+        exit 1
+    else
+        echo "$input"
+        echo "exit code => $actual"
+    fi
+}
+
+# a header included twice is loaded once if guarded or `#pragma once`, and
+# again if its guard is undefined in between
+INCLUDE_TWICE='int main()
+{
+    int x = 0;
+#include "header.h"
+#include "header.h"
+    return x;
+}'
+try_include 7 "#ifndef HEADER_H
+#define HEADER_H
+x = x + 7;
+#endif" "$INCLUDE_TWICE"
+try_include 7 "#pragma once
+x = x + 7;" "$INCLUDE_TWICE"
+try_include 14 "#ifndef HEADER_H
+#define HEADER_H
+x = x + 7;
+#endif" 'int main()
+{
+    int x = 0;
+#include "header.h"
+#undef HEADER_H
+#include "header.h"
+    return x;
+}'
+
+# try_pch - test shecc with a precompiled header
+# Usage:
+# - try_pch exit_code header_code input_code [included_header_code]
+# precompile "header_code" into header.h.pch, then compile "input_code", which
+# includes "header.h", with `--pch` and expect the compiled program exit with
+# code "exit_code". With "included_header_code", header.h is rewritten after it
+# has been precompiled, so that the stale header.h.pch must be ignored.
+function try_pch() {
+    local expected="$1"
+    local header="$2"
+    local input="$3"
+    local included="${4-$2}"
+
+    local tmp_dir="$(mktemp -d)"
+    echo "$header" > "$tmp_dir/header.h"
+    echo "$input" > "$tmp_dir/input.c"
+    if ! "$SHECC" --emit-pch -o "$tmp_dir/header.h.pch" "$tmp_dir/header.h"; then
+        echo "$header => failed to precompile"
+        echo "header: $tmp_dir/header.h"
+        exit 1
+    fi
+    echo "$included" > "$tmp_dir/header.h"
+    "$SHECC" --pch -o "$tmp_dir/exe" "$tmp_dir/input.c"
+    chmod +x "$tmp_dir/exe"
+
+    $TARGET_EXEC "$tmp_dir/exe"
+    local actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$input => $expected expected, but got $actual"
+        echo "input: $tmp_dir/input.c"
+        echo "executable: $tmp_dir/exe"
+        exit 1
+    else
+        echo "$input"
+        echo "exit code => $actual"
+    fi
+}
+
+# precompiled header with types, macros, an enum and prototypes
+PCH_HEADER="typedef struct { int x; int y; } pt_t;
+#define SQ(a) ((a) * (a))
+#define K 7
+typedef enum { RED, GREEN = 5, BLUE } color_t;
+int add(int a, int b);
+int norm(pt_t *p);"
+PCH_INPUT='#include "header.h"
+int add(int a, int b) { return a + b; }
+int norm(pt_t *p)
+{
+    int x = SQ(p->x);
+    return x + SQ(p->y);
+}
+int main()
+{
+    pt_t p;
+    color_t c = BLUE;
+    p.x = 3;
+    p.y = 4;
+    return add(norm(&p), c + K);
+}'
+try_pch 38 "$PCH_HEADER" "$PCH_INPUT"
+
+# a header whose tokens changed since it was precompiled is parsed again
+try_pch 40 "$PCH_HEADER" "$PCH_INPUT" "${PCH_HEADER/K 7/K 9}"
+
+# so is a header included after other definitions than it has been parsed from
+try_pch 38 "$PCH_HEADER" "#define Z 1
+$PCH_INPUT"
+
 # #if defined(...) ... #elif defined(...) ... #else ... #endif
 try_ 0 << EOF
 #define A 0
@@ -568,6 +777,377 @@ int main()
 }
 EOF
 
+# global value numbering keeps loads after stores to the same address
+try_ 12 << EOF
+int main()
+{
+    char a[4];
+    int i = 1, x, y;
+    a[i] = 1;
+    x = a[i];
+    a[i] = 2;
+    y = a[i];
+    return x * 10 + y;
+}
+EOF
+
+# redundant expressions across blocks and commuted operands
+try_ 39 << EOF
+int f(int a, int b, int c)
+{
+    int x = a * b + c, y = 0, i;
+    if (c > 2)
+        y = c + b * a;
+    else
+        y = (a * b) << 1;
+    for (i = 0; i < c; i++)
+        y = y + (b * a == a * b);
+    return x + y;
+}
+int main()
+{
+    return f(3, 4, 5);
+}
+EOF
+
+# dead code elimination keeps stores, calls and the values they read
+try_ 15 << EOF
+int g;
+int bump(int x)
+{
+    g = g + x;
+    return x;
+}
+int f(int n)
+{
+    int i, d = 0, s = 0;
+    for (i = 0; i < n; i++) {
+        d = d + i * 3;
+        s = s + i;
+        bump(1);
+    }
+    return s;
+}
+int main()
+{
+    int r = f(5);
+    return r + g;
+}
+EOF
+
+# loop-invariant code motion, out of nested loops and into split preheaders
+try_ 184 << EOF
+int a[10];
+int f(int n, int k)
+{
+    int i, j, s = 0;
+    for (i = 0; i < n; i++) {
+        j = 0;
+        while (j < n) {
+            s = s + (k * 3 + n);
+            a[j] = k << 2;
+            j++;
+        }
+    }
+    if (k > 1)
+        do {
+            s = s + k * n;
+            k--;
+        } while (k > 1);
+    return s + a[3];
+}
+int main()
+{
+    return f(4, 2) + f(0, 5);
+}
+EOF
+
+# strength-reduced array indexing, with and without the counter kept
+try_ 60 << EOF
+int g[8];
+int f(int n)
+{
+    int a[8], i, s = 0, j;
+    for (i = 0; i < n; i++)
+        a[i] = i * 3;
+    for (i = n - 1; i >= 0; i--)
+        g[i] = a[i];
+    i = 0;
+    do {
+        s = s + g[i] * 2;
+        i++;
+    } while (i != n);
+    for (j = 0; j < n; j++)
+        s = s + j * 5;
+    return s + j;
+}
+int main()
+{
+    return f(8);
+}
+EOF
+
+# a scaled exit bound that would overflow keeps comparing the counter
+try_output 0 "1669241088" << EOF
+int g0;
+int g1;
+int g2;
+int g3;
+int g4;
+int g5;
+int g6;
+int g7;
+int f(int n)
+{
+    int i, s = 0;
+    for (i = 0; i < n; i++) {
+        s = s + i * 1000000;
+        g0 = g0 + 3;
+        g1 = g1 ^ g7;
+        g2 = g2 + g0;
+        g3 = g3 - g1;
+        g4 = g4 + g2;
+        g5 = g5 ^ g3;
+        g6 = g6 + g4;
+        g7 = g7 - g5;
+    }
+    return s;
+}
+int main(int argc, char **argv)
+{
+    printf("%d", f(argc * 3000));
+    return 0;
+}
+EOF
+
+# as does a bound whose scaled value fits, but not one more step
+try_output 0 "12 -312" << EOF
+int main()
+{
+    int i, n = 0, s = 0;
+    for (i = 536870900; i <= 536870911; i++) {
+        s = s + i * 4;
+        n++;
+        if (n == 100)
+            break;
+    }
+    printf("%d %d", n, s);
+    return 0;
+}
+EOF
+
+# unrolled loops, fully and with remainders
+try_ 131 << EOF
+int g[10];
+int f(int n)
+{
+    int i, s = 0;
+    for (i = 0; i < n; i++)
+        s = s + g[i];
+    for (i = n; i > 0; i = i - 3)
+        s = s + i;
+    return s;
+}
+int main()
+{
+    int i, p = 1;
+    for (i = 0; i < 10; i++)
+        g[i] = i + 1;
+    for (i = 0; i < 3; i++)
+        p = p * 3 + i;
+    return f(10) + f(5) + f(0) + p;
+}
+EOF
+
+# byte loops filling, copying and scanning memory, overlapping included
+try_ 161 << EOF
+int fill(char *p, int n, int c)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        p[i] = c;
+    return 0;
+}
+int down(char *dest, char *src, int count)
+{
+    while (count > 0) {
+        count--;
+        dest[count] = src[count];
+    }
+    return 0;
+}
+int up(char *dest, char *src, int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        dest[i] = src[i];
+    return 0;
+}
+int len(char *str)
+{
+    int i = 0;
+    while (str[i])
+        i++;
+    return i;
+}
+int main()
+{
+    char *a = malloc(64);
+    int s = 0, i;
+    fill(a, 64, 1);
+    fill(a + 3, 30, 2);
+    up(a + 1, a + 2, 20);
+    up(a + 40, a + 37, 10);
+    down(a + 9, a + 5, 20);
+    a[60] = 0;
+    for (i = 0; i < 64; i++)
+        s = s * 3 + a[i];
+    return (s & 127) + len(a + 7);
+}
+EOF
+
+# calls inlined, leaves and functions with a single caller, one of them
+# still called through a pointer
+try_ 41 << EOF
+typedef struct {
+    int (*op)(int);
+} ops_t;
+int g;
+int sq(int x)
+{
+    return x * x;
+}
+void set(int v)
+{
+    g = v;
+}
+int twice(int x)
+{
+    return x + x;
+}
+void install(ops_t *po)
+{
+    po->op = twice;
+}
+int find(int *p, int n)
+{
+    int i, r = -1;
+    for (i = 0; i < n; i++) {
+        if (!p[i])
+            continue;
+        r = i;
+        break;
+    }
+    return r;
+}
+int classify(int v)
+{
+    int s = 0, i;
+    if (v < 0)
+        return 1;
+    if (v == 0)
+        return 2;
+    for (i = 0; i < v; i++)
+        s = s + sq(i);
+    return s;
+}
+int main()
+{
+    ops_t ops;
+    int *a = malloc(16);
+    int t = 0, k;
+    install(&ops);
+    a[0] = 0;
+    a[1] = 0;
+    a[2] = 7;
+    a[3] = 0;
+    for (k = 0; k < 4; k++)
+        t = t + sq(k);
+    set(t);
+    t = g + classify(-5) + classify(0) + classify(4) + twice(1);
+    t = t + ops.op(3);
+    return t + find(a, 4);
+}
+EOF
+
+# calls in tail position, deep enough to need a constant stack
+try_ 48 << EOF
+int cnt;
+int is_odd(int n);
+int is_even(int n)
+{
+    if (n == 0)
+        return 1;
+    return is_odd(n - 1);
+}
+int is_odd(int n)
+{
+    if (n == 0)
+        return 0;
+    return is_even(n - 1);
+}
+int gcd(int a, int b)
+{
+    if (b == 0)
+        return a;
+    return gcd(b, a % b);
+}
+void count(int n)
+{
+    if (n == 0)
+        return;
+    cnt = cnt + 1;
+    count(n - 1);
+}
+int swap(int a, int b, int n)
+{
+    if (n == 0)
+        return a * 10 + b;
+    return swap(b, a, n - 1);
+}
+int main()
+{
+    count(3000000);
+    return is_even(3000000) + is_odd(777777) * 2 + gcd(1071, 462) +
+           swap(1, 2, 3) + cnt % 7;
+}
+EOF
+
+# phi copies which overwrite each other
+try_ 75 << EOF
+int rotate(int n)
+{
+    int a = 1, b = 2, c = 3, t;
+    while (n > 0) {
+        t = a;
+        a = b;
+        b = c;
+        c = t;
+        n--;
+    }
+    return a * 100 + b * 10 + c;
+}
+int fib(int n)
+{
+    int a = 0, b = 1, i = 0, t;
+    do {
+        if (i >= n)
+            break;
+        t = a + b;
+        a = b;
+        b = t;
+        i++;
+        if (b > 1000)
+            continue;
+    } while (1);
+    return a;
+}
+int main()
+{
+    return rotate(4) % 64 + fib(12) / 4;
+}
+EOF
+
 # constant folding
 try_ 20 << EOF
 int main()
@@ -580,6 +1160,91 @@ int main()
 }
 EOF
 
+# constant propagation through branches and loops
+try_ 9 << EOF
+int main()
+{
+    int a = 3, b = 0, i;
+    if (a > 2)
+        b = a * 2;
+    else
+        b = a / 0;
+    for (i = 0; i < 4; i++)
+        b = b - a + 3;
+    if (b != 6)
+        return 1;
+    while (0)
+        b = 100;
+    return b + (a << 1) - (a - 3 ? 7 : 3);
+}
+EOF
+
+# a variable whose address is taken is never propagated
+try_ 6 << EOF
+int main()
+{
+    int x, *p;
+    x = 1;
+    p = &x;
+    p[0] = 5;
+    return x + 1;
+}
+EOF
+
+# nor kept in a register while stored to through a pointer
+try_output 126 "14" << EOF
+int main()
+{
+    int y, *p, i;
+    p = &y;
+    y = 4;
+    p[0] = 14;
+    printf("%d", y);
+    for (i = 0; i < 3; i++) {
+        y = y + 1;
+        p[0] = p[0] * 2;
+    }
+    return y;
+}
+EOF
+
+# nor are its later versions, whether stored to directly or by a callee
+try_ 57 << EOF
+void set(int *p, int v)
+{
+    p[0] = v;
+}
+int main()
+{
+    int x, *p, s;
+    x = 1;
+    p = &x;
+    x = 2;
+    p[0] = 5;
+    s = x;
+    x = 3;
+    set(p, 7);
+    return s * 10 + x;
+}
+EOF
+
+# more values than the SCCP work list has room for at first
+try_ 226 << EOF
+int f(int n)
+{
+    int a = 1, b = a + 2, c = b * 3, d = c - 4, e = d + 5;
+    int g = e * 2, h = g - n, i = h + a, j = i * b, k = j - c;
+    int l = k + d, m = l - e, o = m + g, p = o - h, q = p + i;
+    int r = q - j, s = r + k, t = s - l, u = t + m, v = u - o;
+    int w = v + p, x = w - q, y = x + r, z = y - s;
+    return z + t + u + v + w;
+}
+int main(int argc, char **argv)
+{
+    return f(argc + 2);
+}
+EOF
+
 # Variables can be declared within a for-loop iteration
 try_ 120 << EOF
 int main()
@@ -592,4 +1257,24 @@ int main()
 }
 EOF
 
+# a subset of the above, linked against the prebuilt libc image rather than
+# the libc compiled along with each program
+TRY_OPTS="--libc-image $LIBC_IMAGE"
+while read -r expected input; do
+    items "$expected" "$input"
+done << 'EOF'
+42 exit(24 + 18);
+1 char *ptr = "hello"; exit(!strcmp(ptr, "hello") && strncmp(ptr, "help", 4) < 0);
+5 char buf[8]; strcpy(buf, "hello"); exit(strlen(buf));
+1 char buf[16]; sprintf(buf, "%d-%x-%s", 42, 255, "ok"); exit(!strcmp(buf, "42-ff-ok"));
+1 int *a = malloc(sizeof(int) * 5); free(a); int *b = malloc(sizeof(int) * 3); exit(a == b);
+3 int *a = calloc(4, sizeof(int)), z = a[3]; char s[4]; memcpy(s, "abc", 4); exit(z + strlen(s));
+4 FILE *fp = NULL; exit(sizeof(FILE) + (fp != NULL));
+EOF
+
+# any other file is not taken for an image, and libc is compiled as usual
+TRY_OPTS="--libc-image $0"
+items 42 "exit(24 + 18);"
+TRY_OPTS=''
+
 echo OK
@@ -18,8 +18,20 @@
 #define MAX_LINE_LEN 200
 #define MAX_SIZE 65536
 
+/* Each inlined line holds a string literal, which occupies a local variable
+ * of the enclosing block in shecc. Split the lines into several functions to
+ * stay below the limit of locals per block.
+ */
+#define LINES_PER_FUNC 256
+
 char *SOURCE;
 int source_idx;
+int num_lines;
+int num_funcs;
+
+/* size and hash of the inlined libc, which identify its prebuilt images */
+int libc_size;
+unsigned int libc_hash;
 
 void write_char(char c)
 {
@@ -37,8 +49,20 @@ void write_line(char *src)
 {
     int i;
 
+    if (num_lines % LINES_PER_FUNC == 0) {
+        char func[MAX_LINE_LEN];
+
+        if (num_lines)
+            write_str("}\n");
+        sprintf(func, "void __libc_part%d() {\n", num_funcs++);
+        write_str(func);
+    }
+    num_lines++;
+
     write_str("  __c(\"");
     for (i = 0; src[i]; i++) {
+        libc_size++;
+        libc_hash = libc_hash * 33 + (unsigned char) src[i];
         if (src[i] == '\"') {
             write_char('\\');
             write_char('\"');
@@ -77,6 +101,9 @@ void save_to(char *file)
 
 int main(int argc, char *argv[])
 {
+    char line[MAX_LINE_LEN];
+    int i;
+
     if (argc <= 2) {
         printf("Usage: inliner <input.c> <output.inc>\n");
         return -1;
@@ -97,14 +124,27 @@ int main(int argc, char *argv[])
      *   __c("}\n");
      */
     write_str("void __c(char *src) {\n");
-    write_str("    int i;\n");
-    write_str("    for (i = 0; src[i]; i++)\n");
-    write_str("        SOURCE[source_idx++] = src[i];\n");
+    write_str("    source_append(src, strlen(src));\n");
     write_str("}\n");
 
-    write_str("void libc_generate() {\n");
     load_from(argv[1]);
+    if (num_lines)
+        write_str("}\n");
+
+    write_str("void libc_generate() {\n");
+    for (i = 0; i < num_funcs; i++) {
+        char call[MAX_LINE_LEN];
+
+        sprintf(call, "  __libc_part%d();\n", i);
+        write_str(call);
+    }
     write_str("}\n");
+
+    sprintf(line, "int libc_size() { return %d; }\n", libc_size);
+    write_str(line);
+    sprintf(line, "int libc_hash() { return %d; }\n",
+            (int) (libc_hash & 0x7FFFFFFF));
+    write_str(line);
     save_to(argv[2]);
 
     return 0;